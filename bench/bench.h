@@ -0,0 +1,98 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef H_Bench_H
+#define H_Bench_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/*
+ * What the benchmarks share: a monotonic clock, a timer that repeats a
+ * run until it's long enough to measure, and the process's own counters.
+ * Inputs come from test/corpus.h, so that every run measures the same
+ * bytes; for figures with a cold page cache, drop it before a run.
+ */
+
+/* Seconds since some fixed point */
+static inline double bench_now()
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return t.tv_sec+t.tv_nsec*1e-9;
+}
+
+typedef void (*bench_fn)(void *ctx);
+
+/* Seconds one fn(ctx) takes, the best of runs lasting 0.2 s in all */
+static inline double bench_time(bench_fn fn,void *ctx)
+{
+	double best=-1,start,t,total=0;
+	int runs=0;
+
+	do {
+		start=bench_now();
+		fn(ctx);
+		t=bench_now()-start;
+		if((best<0) || (t<best)) best=t;
+		total+=t;
+		runs++;
+	} while((total<0.2) || (runs<3));
+	return best;
+}
+
+/* Peak resident set and page faults of the process so far */
+struct bench_usage {
+	double rssMB;
+	long minflt,majflt;
+};
+
+static inline bench_usage bench_getusage()
+{
+	struct rusage ru;
+	bench_usage u;
+
+	getrusage(RUSAGE_SELF,&ru);
+#ifdef __APPLE__
+	u.rssMB=ru.ru_maxrss/1048576.0;
+#else
+	u.rssMB=ru.ru_maxrss/1024.0;
+#endif
+	u.minflt=ru.ru_minflt;
+	u.majflt=ru.ru_majflt;
+	return u;
+}
+
+/* The size argument of a benchmark, in MiB, or its default */
+static inline size_t bench_size(int argc,char **argv,int arg,size_t def)
+{
+	if(argc>arg) return (size_t)atol(argv[arg])<<20;
+	return def<<20;
+}
+
+#endif
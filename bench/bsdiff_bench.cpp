@@ -0,0 +1,162 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+/*
+ * bsdiff and bspatch on an asset-like old file and a lightly modified new
+ * version of it, one option at a time: reading the inputs into the heap
+ * against mapping them, the pre-pass over identical runs, all cores, and
+ * LZ4 blocks. Each run is forked off on its own, so that its time, the
+ * time to its first byte of output, peak RSS and page faults are its own.
+ * Throughput is that of the new file, diffed or rebuilt.
+ *
+ *   bsdiff_bench [MiB]
+ */
+
+#include "bsdiff.h"
+#include "../test/corpus.h"
+#include "bench.h"
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <sys/wait.h>
+
+struct bench_sink {
+	FILE *f;
+	double start,first;
+};
+
+static bool sink_write(void *opaque,const unsigned char *data,size_t len)
+{
+	bench_sink *s=(bench_sink*)opaque;
+
+	if(s->first<0) s->first=bench_now()-s->start;
+	return fwrite(data,1,len,s->f)==len;
+}
+
+static void put(const std::string &path,const std::vector<unsigned char> &v)
+{
+	FILE *f=fopen(path.c_str(),"wb");
+
+	if((f==NULL) || (fwrite(&v[0],1,v.size(),f)!=v.size()) || fclose(f)) {
+		perror(path.c_str());
+		exit(1);
+	};
+}
+
+/* runs a diff (patch==NULL) or a patch in a child and prints its figures */
+static void run(const char *name,const std::string &dir,size_t newsize,
+		const BSDiffOptions *diff,const BSPatchOptions *patch)
+{
+	pid_t pid;
+	int status;
+
+	fflush(stdout);
+	if((pid=fork())==0) {
+		std::string out=dir+(diff ? "/out.patch" : "/out.new");
+		bench_sink s;
+		BSDIFF_STATUS st;
+		bench_usage u0=bench_getusage(),u;
+		double t;
+		long size;
+
+		s.f=fopen(out.c_str(),"wb");
+		s.first=-1;
+		s.start=bench_now();
+		if(diff)
+			st=bsdiff(BSInput((dir+"/old").c_str()),BSInput((dir+"/new").c_str()),
+				BSOutput(sink_write,&s),*diff);
+		else
+			st=bspatch(BSInput((dir+"/old").c_str()),BSOutput(sink_write,&s),
+				BSInput((dir+"/ref.patch").c_str()),*patch);
+		t=bench_now()-s.start;
+		u=bench_getusage();
+		size=ftell(s.f);
+		fclose(s.f);
+		if(st!=BSDIFF_OK) {
+			printf("%-18s %s\n",name,bsdiff_strerror(st));
+			fflush(stdout);
+			_exit(1);
+		};
+		printf("%-18s %8.2f %8.0f %10ld %8.1f %8.0f %8ld %6ld\n",name,t,s.first*1e3,
+			size,newsize/t/1e6,u.rssMB,u.minflt-u0.minflt,u.majflt-u0.majflt);
+		fflush(stdout);
+		_exit(0);
+	};
+	waitpid(pid,&status,0);
+}
+
+int main(int argc,char **argv)
+{
+	size_t n=bench_size(argc,argv,1,64),newsize;
+	char dirbuf[]="/tmp/kiwi_bench.XXXXXX";
+	std::string dir;
+	BSDiffOptions d;
+	BSPatchOptions p;
+
+	if(mkdtemp(dirbuf)==NULL) {
+		perror("mkdtemp");
+		return 1;
+	};
+	dir=dirbuf;
+	{
+		std::vector<unsigned char> o,nw,patch;
+		corpus_asset(1,n,&o);
+		corpus_edit(2,o,64<<10,&nw);
+		put(dir+"/old",o);
+		put(dir+"/new",nw);
+		if(bsdiff(BSInput(&o[0],o.size()),BSInput(&nw[0],nw.size()),BSOutput(&patch))!=BSDIFF_OK)
+			return 1;
+		put(dir+"/ref.patch",patch);
+		newsize=nw.size();
+	}
+
+	printf("%-18s %8s %8s %10s %8s %8s %8s %6s\n","run","s","1st ms","bytes out",
+		"MB/s","RSS MB","minflt","majflt");
+	run("diff read",dir,newsize,&d,NULL);
+	d.Mapped=true;
+	run("diff mapped",dir,newsize,&d,NULL);
+	d.Mapped=false;
+	d.Prepass=true;
+	run("diff prepass",dir,newsize,&d,NULL);
+	d.Prepass=false;
+	d.Threads=0;
+	run("diff all cores",dir,newsize,&d,NULL);
+	d.Threads=1;
+	d.Codec=BSDIFF_CODEC_LZ4;
+	run("diff lz4",dir,newsize,&d,NULL);
+
+	run("patch read",dir,newsize,NULL,&p);
+	p.Mapped=true;
+	run("patch mapped",dir,newsize,NULL,&p);
+	p.Mapped=false;
+	p.Threads=0;
+	run("patch all cores",dir,newsize,NULL,&p);
+
+	unlink((dir+"/old").c_str());
+	unlink((dir+"/new").c_str());
+	unlink((dir+"/ref.patch").c_str());
+	unlink((dir+"/out.patch").c_str());
+	unlink((dir+"/out.new").c_str());
+	rmdir(dir.c_str());
+	return 0;
+}
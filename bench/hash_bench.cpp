@@ -0,0 +1,117 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+/*
+ * Throughput of the checksums Kiwi offers, with every kernel set the
+ * processor runs: MD5 one message at a time as md5.hpp hashes it, the
+ * multi-buffer MD5 engine on as many messages as it has lanes (how new
+ * entries are hashed in batch) and XXH3.
+ *
+ *   hash_bench [MiB]
+ */
+
+#include "../src/md5batch.cpp"
+#include "../src/xxh3.cpp"
+#include "../test/corpus.h"
+#include "bench.h"
+#include "md5.hpp"
+
+struct hash_ctx {
+	std::vector<unsigned char> *data;
+	std::vector<const unsigned char*> parts;
+	std::vector<size_t> sizes;
+	volatile uint64_t sink;
+};
+
+static void run_md5(void *c)
+{
+	hash_ctx *h=(hash_ctx*)c;
+	MD5 md5;
+
+	md5.digestMemory(&(*h->data)[0],(int)h->data->size());
+	h->sink+=md5.digestRaw[0];
+}
+
+static void run_md5batch(void *c)
+{
+	hash_ctx *h=(hash_ctx*)c;
+	unsigned char d[16][16];
+
+	md5_buffers(&h->parts[0],&h->sizes[0],h->parts.size(),d);
+	h->sink+=d[0][0];
+}
+
+static void run_xxh3(void *c)
+{
+	hash_ctx *h=(hash_ctx*)c;
+	h->sink+=xxh3_64(&(*h->data)[0],h->data->size());
+}
+
+int main(int argc,char **argv)
+{
+	std::vector<const md5_kernel_set*> md5sets;
+	std::vector<const xxh3_kernel_set*> xxh3sets;
+	std::vector<unsigned char> data;
+	hash_ctx h;
+	size_t i,k,n=bench_size(argc,argv,1,64);
+	double t;
+
+	md5sets.push_back(&md5_scalar);
+	xxh3sets.push_back(&xxh3_scalar);
+#ifdef MD5_X86
+	if(bs_cpu()&BS_CPU_SSE2) md5sets.push_back(&md5_sse2);
+	if(bs_cpu()&BS_CPU_AVX2) md5sets.push_back(&md5_avx2);
+	if(bs_cpu()&BS_CPU_AVX512) md5sets.push_back(&md5_avx512);
+#endif
+#ifdef XXH3_X86
+	if(bs_cpu()&BS_CPU_SSE2) xxh3sets.push_back(&xxh3_sse2);
+	if(bs_cpu()&BS_CPU_AVX2) xxh3sets.push_back(&xxh3_avx2);
+#endif
+
+	corpus_asset(1,n,&data);
+	h.data=&data;
+	h.sink=0;
+
+	printf("%-24s %10s\n","hash","MB/s");
+	t=bench_time(run_md5,&h);
+	printf("%-24s %10.0f\n","md5.hpp",n/t/1e6);
+
+	for(i=0;i<md5sets.size();i++) {
+		MK=md5sets[i];
+		h.parts.clear();
+		h.sizes.clear();
+		for(k=0;k<(size_t)MK->lanes;k++) {
+			h.parts.push_back(&data[0]+k*(n/MK->lanes));
+			h.sizes.push_back(n/MK->lanes);
+		};
+		t=bench_time(run_md5batch,&h);
+		printf("md5 batch %-6s x%-6d %10.0f\n",MK->name,MK->lanes,n/t/1e6);
+	};
+
+	for(i=0;i<xxh3sets.size();i++) {
+		XK=xxh3sets[i];
+		t=bench_time(run_xxh3,&h);
+		printf("xxh3 %-19s %10.0f\n",XK->name,n/t/1e6);
+	};
+	return 0;
+}
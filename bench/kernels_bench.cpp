@@ -0,0 +1,132 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+/*
+ * Throughput of bsdiff's and bspatch's byte kernels, with every kernel set
+ * the processor runs: the match lengths of the suffix search, the
+ * mismatch count of the scan's scoring and bspatch's byte add, over 1 MiB
+ * that match to the end, then matches as bsdiff meets them: from random
+ * offsets of an asset-like file against a copy changed every few to few
+ * thousand bytes.
+ *
+ *   kernels_bench [MiB]
+ */
+
+#include "../src/bskernels.cpp"
+#include "../test/corpus.h"
+#include "bench.h"
+#include <vector>
+
+struct kernels_ctx {
+	const unsigned char *a,*b;
+	unsigned char *p;
+	off_t n;
+	const std::vector<off_t> *at;
+	volatile off_t sink;
+};
+
+static void run_matchlen(void *c)
+{
+	kernels_ctx *k=(kernels_ctx*)c;
+	k->sink+=bs_matchlen(k->a,k->b,k->n);
+}
+
+static void run_rmatchlen(void *c)
+{
+	kernels_ctx *k=(kernels_ctx*)c;
+	k->sink+=bs_rmatchlen(k->a+k->n-1,k->b+k->n-1,k->n);
+}
+
+static void run_matchcount(void *c)
+{
+	kernels_ctx *k=(kernels_ctx*)c;
+	k->sink+=bs_matchcount(k->a,k->b,k->n);
+}
+
+static void run_add(void *c)
+{
+	kernels_ctx *k=(kernels_ctx*)c;
+	bs_add(k->p,k->a,k->n);
+}
+
+/* a match length at each offset, as bsdiff's search() would ask */
+static void run_asset(void *c)
+{
+	kernels_ctx *k=(kernels_ctx*)c;
+	size_t i;
+
+	for(i=0;i<k->at->size();i++)
+		k->sink+=bs_matchlen(k->a+(*k->at)[i],k->b+(*k->at)[i],k->n-(*k->at)[i]);
+}
+
+int main(int argc,char **argv)
+{
+	std::vector<const bs_kernel_set*> sets;
+	std::vector<unsigned char> a,b,p,o,e;
+	std::vector<off_t> at;
+	kernels_ctx k;
+	uint64_t s=1;
+	size_t i,n=bench_size(argc,argv,1,1);
+	off_t total;
+	double t;
+
+	sets.push_back(&bs_scalar);
+#ifdef BS_X86
+	if(bs_cpu()&BS_CPU_SSE2) sets.push_back(&bs_sse2);
+	if(bs_cpu()&BS_CPU_AVX2) sets.push_back(&bs_avx2);
+#endif
+
+	corpus_random(1,n,&a);
+	b=a;
+	p=a;
+	corpus_asset(2,4<<20,&o);
+	e=o;
+	for(i=0;i<e.size();i+=1+(size_t)(corpus_next(&s)%(16u<<(corpus_next(&s)%3*4))))
+		e[i]^=0x5a;
+	for(i=0;i<100000;i++)
+		at.push_back((off_t)(corpus_next(&s)%e.size()));
+
+	printf("%-8s %-12s %10s\n","kernels","loop","GB/s");
+	for(i=0;i<sets.size();i++) {
+		K=sets[i];
+		k.a=&a[0];k.b=&b[0];k.p=&p[0];k.n=(off_t)n;k.at=&at;k.sink=0;
+
+		t=bench_time(run_matchlen,&k);
+		printf("%-8s %-12s %10.2f\n",K->name,"matchlen",n/t/1e9);
+		t=bench_time(run_rmatchlen,&k);
+		printf("%-8s %-12s %10.2f\n",K->name,"rmatchlen",n/t/1e9);
+		t=bench_time(run_matchcount,&k);
+		printf("%-8s %-12s %10.2f\n",K->name,"matchcount",n/t/1e9);
+		t=bench_time(run_add,&k);
+		printf("%-8s %-12s %10.2f\n",K->name,"add",n/t/1e9);
+
+		k.a=&o[0];k.b=&e[0];k.n=(off_t)e.size();
+		total=0;
+		for(size_t j=0;j<at.size();j++)
+			total+=bs_matchlen(k.a+at[j],k.b+at[j],k.n-at[j]);
+		t=bench_time(run_asset,&k);
+		printf("%-8s %-12s %10.2f   (%.1f M calls/s, %.0f bytes each)\n",K->name,"asset",
+			total/t/1e9,at.size()/t/1e6,(double)total/at.size());
+	};
+	return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+/*
+ * Writing a patch tarball of many small files and a few large ones: the
+ * stream Tar one file at a time, with the files read ahead by putFiles(),
+ * FdTar moving the bodies in the kernel to a file and to /dev/null, then
+ * the tar.bz2 Kiwi writes, on one core and on all of them. Run it twice
+ * to compare a cold page cache, dropped in between, with a warm one.
+ *
+ *   tar_bench [MiB]
+ */
+
+#include "Pixy.h"
+#include "Tarball.h"
+#include "CodecStream.h"
+#include "../test/corpus.h"
+#include "bench.h"
+#include <fstream>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+typedef std::vector<std::pair<std::string,std::string> > tar_files;
+
+static void report(const char *name,double t,size_t bytes)
+{
+	printf("%-22s %8.2f %10.0f\n",name,t,bytes/t/1e6);
+	fflush(stdout);
+}
+
+int main(int argc,char **argv)
+{
+	size_t n=bench_size(argc,argv,1,64),total=0,len;
+	char dirbuf[]="/tmp/kiwi_bench.XXXXXX";
+	std::vector<unsigned char> data;
+	std::string dir,out;
+	tar_files files;
+	uint64_t s=1;
+	double t;
+	size_t i;
+	int fd;
+
+	if(mkdtemp(dirbuf)==NULL) {
+		perror("mkdtemp");
+		return 1;
+	};
+	dir=dirbuf;
+	out=dir+"/out.tar";
+
+	/* a quarter in 8 MiB files, the rest in files of up to 64 KiB */
+	corpus_asset(1,8<<20,&data);
+	for(i=0;total<n;i++) {
+		char name[32];
+		len=(total<n/4) ? data.size() : 1+(size_t)(corpus_next(&s)%(64<<10));
+		sprintf(name,"/%06lu",(unsigned long)i);
+		FILE *f=fopen((dir+name).c_str(),"wb");
+		if((f==NULL) || (fwrite(&data[0],1,len,f)!=len) || fclose(f)) {
+			perror((dir+name).c_str());
+			return 1;
+		};
+		files.push_back(std::make_pair(dir+name,std::string("patch")+name));
+		total+=len;
+	};
+	printf("%lu files, %lu bytes\n",(unsigned long)files.size(),(unsigned long)total);
+	printf("%-22s %8s %10s\n","run","s","MB/s");
+
+	{
+		t=bench_now();
+		std::ofstream o(out.c_str(),std::ios::binary);
+		lindenb::io::Tar tar(o);
+		for(i=0;i<files.size();i++)
+			tar.putFile(files[i].first.c_str(),files[i].second.c_str());
+		tar.finish();
+		o.close();
+		report("Tar putFile",bench_now()-t,total);
+	}
+	{
+		t=bench_now();
+		std::ofstream o(out.c_str(),std::ios::binary);
+		lindenb::io::Tar tar(o);
+		tar.putFiles(files,1);
+		tar.finish();
+		o.close();
+		report("Tar putFiles 1 reader",bench_now()-t,total);
+	}
+	{
+		t=bench_now();
+		std::ofstream o(out.c_str(),std::ios::binary);
+		lindenb::io::Tar tar(o);
+		tar.putFiles(files);
+		tar.finish();
+		o.close();
+		report("Tar putFiles",bench_now()-t,total);
+	}
+	{
+		t=bench_now();
+		fd=open(out.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+		{
+			lindenb::io::FdTar tar(fd);
+			for(i=0;i<files.size();i++)
+				tar.putFile(files[i].first.c_str(),files[i].second.c_str());
+			tar.finish();
+		}
+		close(fd);
+		report("FdTar to a file",bench_now()-t,total);
+	}
+	{
+		t=bench_now();
+		fd=open("/dev/null",O_WRONLY);
+		{
+			lindenb::io::FdTar tar(fd);
+			for(i=0;i<files.size();i++)
+				tar.putFile(files[i].first.c_str(),files[i].second.c_str());
+			tar.finish();
+		}
+		close(fd);
+		report("FdTar to /dev/null",bench_now()-t,total);
+	}
+	for(int threads=1;threads>=0;threads--) {
+		t=bench_now();
+		FILE *f=fopen(out.c_str(),"wb");
+		{
+			Pixy::CodecStreambuf bz2(BSDIFF_CODEC_BZIP2,f,threads);
+			std::ostream o(&bz2);
+			lindenb::io::Tar tar(o);
+			tar.putFiles(files);
+			tar.finish();
+			bz2.close();
+		}
+		fclose(f);
+		report(threads ? "tar.bz2 1 core" : "tar.bz2 all cores",bench_now()-t,total);
+	}
+
+	for(i=0;i<files.size();i++)
+		unlink(files[i].first.c_str());
+	unlink(out.c_str());
+	rmdir(dir.c_str());
+	return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef H_PixyCodecStream_H
+#define H_PixyCodecStream_H
+
+#include "bscodec.h"
+#include "pbzip.h"
+#include "bserror.h"
+#include <stdio.h>
+#include <streambuf>
+#include <vector>
+
+namespace Pixy {
+
+/*! \class CodecStreambuf
+ *  \brief
+ *  An output stream buffer that compresses all that is written through it
+ *  with one of the patch codecs (see bscodec.h) straight into a FILE, so
+ *  that an std::ostream, such as the one a lindenb::io::Tar writes to, is
+ *  compressed as it goes. The bzip2 codec makes a plain .bz2 stream, or
+ *  given more than one thread a parallel one, see pbzip.h.
+ *
+ *  \note
+ *  Errors put the stream in a failed state rather than throw; close()
+ *  tells whether the whole stream made it out.
+ */
+class CodecStreambuf : public std::streambuf {
+
+  public:
+
+  /*! \brief
+   *  inThreads only matters to bzip2, 0 meaning one per processor.
+   */
+  inline CodecStreambuf(BSDIFF_CODEC inCodec, FILE* inFile, int inThreads = 1)
+  : mWriter(0), mParallel(0), mBuffer(1 << 16) {
+    try {
+      if (inCodec == BSDIFF_CODEC_BZIP2 && Thread::resolve(inThreads) > 1)
+        mParallel = pbz_writer_open(inFile, inThreads);
+      else
+        mWriter = bs_writer_open(inCodec, inFile);
+    } catch (...) {
+      mWriter = 0;
+      mParallel = 0;
+    }
+    setp(&mBuffer[0], &mBuffer[0] + mBuffer.size());
+  }
+
+  inline virtual ~CodecStreambuf() {
+    if (mWriter)
+      bs_writer_discard(mWriter);
+    if (mParallel)
+      pbz_writer_discard(mParallel);
+  }
+
+  /*! \brief
+   *  Compresses what's left and ends the stream, leaving the FILE open.
+   *  Returns false if any of it couldn't be compressed or written.
+   */
+  inline bool close() {
+    if ((!mWriter && !mParallel) || sync() != 0)
+      return false;
+
+    bs_writer *lWriter = mWriter;
+    pbz_writer *lParallel = mParallel;
+    mWriter = 0;
+    mParallel = 0;
+    try {
+      if (lParallel)
+        pbz_writer_close(lParallel);
+      else
+        bs_writer_close(lWriter);
+    } catch (...) {
+      return false;
+    }
+    return true;
+  }
+
+  protected:
+
+  inline virtual int_type overflow(int_type c) {
+    if (sync() != 0)
+      return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  /* writes larger than the buffer skip it */
+  inline virtual std::streamsize xsputn(const char* s, std::streamsize n) {
+    if (n < (std::streamsize)mBuffer.size())
+      return std::streambuf::xsputn(s, n);
+    if (sync() != 0 || !compress(s, n))
+      return 0;
+    return n;
+  }
+
+  inline virtual int sync() {
+    std::streamsize n = pptr() - pbase();
+    setp(&mBuffer[0], &mBuffer[0] + mBuffer.size());
+    return compress(&mBuffer[0], n) ? 0 : -1;
+  }
+
+  private:
+
+  inline bool compress(const char* s, std::streamsize n) {
+    if (!mWriter && !mParallel)
+      return false;
+    if (n == 0)
+      return true;
+
+    try {
+      if (mParallel)
+        pbz_writer_write(mParallel, (const unsigned char*)s, (size_t)n);
+      else
+        bs_writer_write(mWriter, (const unsigned char*)s, (off_t)n);
+    } catch (...) {
+      if (mWriter)
+        bs_writer_discard(mWriter);
+      if (mParallel)
+        pbz_writer_discard(mParallel);
+      mWriter = 0;
+      mParallel = 0;
+      return false;
+    }
+    return true;
+  }
+
+  bs_writer* mWriter;
+  pbz_writer* mParallel;
+  std::vector<char> mBuffer;
+
+  // not copyable
+  CodecStreambuf(const CodecStreambuf&);
+  CodecStreambuf& operator=(const CodecStreambuf&);
+};
+
+};
+
+#endif
@@ -25,6 +25,7 @@
 #define H_PatchEntry_H
 
 #include "Pixy.h"
+#include "checksum.h"
 #include <string>
 #include <sstream>
 
@@ -40,7 +41,7 @@ typedef enum {
 
 class Repository;
 struct PatchEntry {
-  inline PatchEntry() { Repo = 0; };
+  inline PatchEntry() { Repo = 0; Algo = CHECKSUM_MD5; };
   /*! \brief
    *  convenience constructor
    */
@@ -49,12 +50,14 @@ struct PatchEntry {
              std::string inLocal,
              std::string inRemote = "",
              std::string inChecksum = "",
-             Repository* inRepo = 0) {
+             Repository* inRepo = 0,
+             CHECKSUM_ALGO inAlgo = CHECKSUM_MD5) {
     Local = inLocal;
     Remote = inRemote;
     Op = inOp;
     Repo = inRepo;
     Checksum = inChecksum;
+    Algo = inAlgo;
   }
   inline ~PatchEntry() { Repo = 0; }
 
@@ -91,7 +94,7 @@ struct PatchEntry {
     switch (Op) {
       case P_CREATE:
       case P_MODIFY:
-        s << " " << Remote << " " << Checksum;
+        s << " " << Remote << " " << checksumString();
         break;
       case P_RENAME:
         s << " " << Remote;
@@ -100,6 +103,21 @@ struct PatchEntry {
     return s.str();
   }
 
+  /*! \brief
+   *  The checksum as it's written in patch scripts: MD5 ones bare, like
+   *  they've always been, others prefixed by the algorithm's name,
+   *  e.g. "xxh3:9a3c0d61f2b7e845", and root hashes of chunked ones by
+   *  the name and "-tree", e.g. "md5-tree:<root>".
+   */
+  inline std::string checksumString() {
+    if (!Manifest.empty())
+      return std::string(checksum_name(Algo)) + "-tree:" + Checksum;
+    if (Algo == CHECKSUM_MD5)
+      return Checksum;
+
+    return std::string(checksum_name(Algo)) + ":" + Checksum;
+  }
+
   // see ENUM PATCHOP
   PATCHOP Op;
 
@@ -122,12 +140,22 @@ struct PatchEntry {
   Repository* Repo;
 
   /*
-   * MD5 checksum used to verify the integrity of downloaded files.
+   * Checksum used to verify the integrity of downloaded files.
    * In the case of MODIFY entries, the checksum is that of the downloaded diff file,
    * and in the case of CREATE, it's of the downloaded file.
    */
   std::string Checksum;
 
+  // the algorithm Checksum was computed with
+  CHECKSUM_ALGO Algo;
+
+  /*
+   * Chunk manifest of a chunked checksum, see chunkhash.h, which is then the
+   * root hash. Shipped in the tarball beside the file, empty if the checksum
+   * is of the whole file.
+   */
+  std::string Manifest;
+
   std::string Fullpath;
 
   std::string Aux;
@@ -94,6 +94,8 @@ namespace Pixy
     void evtClickGenerateMD5();
 
     void evtChangeStructure(bool);
+    void evtChangeChecksum(bool);
+    void evtChangeChunked(bool);
 
     void evtClickGenerateScript();
     void evtClickGenerateTarball();
@@ -111,6 +113,15 @@ namespace Pixy
 
     bool validateEntry(const QString& inPath);
 
+    /*! \brief
+     *  Checksums the files of new entries as the repository is set to,
+     *  outManifests getting the chunk manifest of those checksummed by
+     *  chunk. Unreadable files are given an empty checksum.
+     */
+    void checksumFiles(const std::vector<std::string>& inPaths,
+                       std::vector<std::string>* outChecksums,
+                       std::vector<std::string>* outManifests);
+
     Ui::KiwiUi mUi;
     Ui::KiwiAbout mDlgAboutUi;
 
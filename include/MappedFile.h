@@ -0,0 +1,190 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef H_PixyMappedFile_H
+#define H_PixyMappedFile_H
+
+#include "Pixy.h"
+#include <stdint.h>
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Pixy {
+
+/*! \class MappedFile
+ *  \brief
+ *  A read-only view of a whole file through the virtual memory system, so
+ *  that large inputs are paged in on demand and shared with the page cache
+ *  instead of being copied into the heap.
+ */
+class MappedFile {
+
+  public:
+
+  /*! access pattern hints, see advise() */
+  typedef enum {
+    ADVISE_NORMAL,
+    ADVISE_SEQUENTIAL, //! read front to back, pages behind can be dropped
+    ADVISE_RANDOM,     //! no point in reading ahead
+    ADVISE_WILLNEED    //! start paging the whole file in right away
+  } ADVICE;
+
+  inline MappedFile() : mData(0), mSize(0) {
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+    mFile = INVALID_HANDLE_VALUE;
+    mMapping = NULL;
+#endif
+  }
+
+  inline ~MappedFile() {
+    unmap();
+  }
+
+  /*! \brief
+   *  Maps inPath, returns false (with errno or GetLastError() set) if the
+   *  file can't be opened or mapped. A private mapping may be written to
+   *  through getWritableData(), the changes never reach the file.
+   */
+  inline bool map(const char* inPath, bool inPrivate = false) {
+    unmap();
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+    LARGE_INTEGER lSize;
+    mFile = CreateFileA(inPath, GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mFile == INVALID_HANDLE_VALUE)
+      return false;
+    if (!GetFileSizeEx(mFile, &lSize)) {
+      unmap();
+      return false;
+    }
+    mSize = (uint64_t)lSize.QuadPart;
+    if (mSize == 0) {
+      mData = (const unsigned char*)"";
+      return true;
+    }
+    mMapping = CreateFileMappingA(mFile, NULL,
+      inPrivate ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+    if (mMapping == NULL) {
+      unmap();
+      return false;
+    }
+    mData = (const unsigned char*)MapViewOfFile(mMapping,
+      inPrivate ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+#else
+    struct stat lStat;
+    int fd = ::open(inPath, O_RDONLY);
+    if (fd < 0)
+      return false;
+    if (fstat(fd, &lStat) != 0) {
+      ::close(fd);
+      return false;
+    }
+    mSize = (uint64_t)lStat.st_size;
+    if (mSize == 0) {
+      ::close(fd);
+      mData = (const unsigned char*)"";
+      return true;
+    }
+    void* lData = inPrivate ?
+      mmap(NULL, (size_t)mSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) :
+      mmap(NULL, (size_t)mSize, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    mData = (lData == MAP_FAILED) ? 0 : (const unsigned char*)lData;
+#endif
+    if (!mData) {
+      unmap();
+      return false;
+    }
+    return true;
+  }
+
+  inline void unmap() {
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+    if (mData && mSize)
+      UnmapViewOfFile(mData);
+    if (mMapping)
+      CloseHandle(mMapping);
+    if (mFile != INVALID_HANDLE_VALUE)
+      CloseHandle(mFile);
+    mMapping = NULL;
+    mFile = INVALID_HANDLE_VALUE;
+#else
+    if (mData && mSize)
+      munmap((void*)mData, (size_t)mSize);
+#endif
+    mData = 0;
+    mSize = 0;
+  }
+
+  /*! \brief
+   *  Tells the kernel how the mapping is going to be read. Only a hint,
+   *  silently ignored where unsupported.
+   */
+  inline void advise(ADVICE inAdvice) {
+#if PIXY_PLATFORM != PIXY_PLATFORM_WIN32 && defined(POSIX_MADV_NORMAL)
+    int lAdvice = POSIX_MADV_NORMAL;
+    switch (inAdvice) {
+      case ADVISE_SEQUENTIAL: lAdvice = POSIX_MADV_SEQUENTIAL; break;
+      case ADVISE_RANDOM: lAdvice = POSIX_MADV_RANDOM; break;
+      case ADVISE_WILLNEED: lAdvice = POSIX_MADV_WILLNEED; break;
+      default: break;
+    }
+    if (mData && mSize)
+      posix_madvise((void*)mData, (size_t)mSize, lAdvice);
+#else
+    (void)inAdvice;
+#endif
+  }
+
+  inline bool isMapped() const { return mData != 0; }
+  inline const unsigned char* getData() const { return mData; }
+  inline uint64_t getSize() const { return mSize; }
+
+  // only to be written to when mapped privately
+  inline unsigned char* getWritableData() const { return (unsigned char*)mData; }
+
+  private:
+  // mappings can not be copied
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+
+  const unsigned char* mData;
+  uint64_t mSize;
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+  HANDLE mFile;
+  HANDLE mMapping;
+#endif
+};
+
+};
+
+#endif
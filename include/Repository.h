@@ -149,7 +149,8 @@ class Repository {
                   std::string local,
                   std::string remote = "",
                   std::string temp = "",
-                  std::string checksum = "");
+                  std::string checksum = "",
+                  CHECKSUM_ALGO algo = CHECKSUM_MD5);
 
     void removeEntry(QTreeWidgetItem* inWidget);
 
@@ -181,12 +182,28 @@ class Repository {
     void setFlat(bool inFlat) { fFlat = inFlat; };
     inline bool isFlat() { return fFlat; };
 
+    /*! \brief
+     *  The algorithm files added from now on are checksummed with, entries
+     *  already in keep theirs.
+     */
+    void setChecksum(CHECKSUM_ALGO inAlgo) { mChecksum = inAlgo; };
+    inline CHECKSUM_ALGO getChecksum() { return mChecksum; };
+
+    /*! \brief
+     *  Whether files added from now on that span more than one chunk get a
+     *  chunked checksum, see chunkhash.h.
+     */
+    void setChunked(bool inChunked) { fChunked = inChunked; };
+    inline bool isChunked() { return fChunked; };
+
 	protected:
 	  std::vector<PatchEntry*> mEntries;
     Version mVersion;
 
     std::string mRoot;
     bool fFlat;
+    CHECKSUM_ALGO mChecksum;
+    bool fChunked;
 
   private:
     // Repositores can not be copied
@@ -18,12 +18,23 @@
 #include <cerrno>
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <vector>
+#include <utility>
+#include "Thread.h"
 #if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
   #include <io.h>
   #include "getlogin.h"
   #define snprintf _snprintf
 #else
   #include <unistd.h>
+  #include <fcntl.h>
+  #include <sys/types.h>
+  #include <sys/stat.h>
+  #if defined(__linux__)
+    #include <sys/sendfile.h>
+    #include <sys/syscall.h>
+  #endif
 #endif
 
 
@@ -102,6 +113,86 @@ class Tar
 	    snprintf(header->name,100,"%s",filename);
 	    }
 
+	/** where putFiles() is at: file i is read ahead from files[i].first */
+	struct Prefetch
+		{
+		enum { PENDING, READY, LARGE, FAILED };
+		const std::vector<std::pair<std::string,std::string> >* files;
+		std::vector<int> state;
+		std::vector<std::vector<char> > data;
+		std::size_t next;	/* next file a reader takes up */
+		std::size_t reserved;	/* files given their room, in order */
+		std::size_t inflight;	/* bytes read ahead and not written yet */
+		std::size_t budget;
+		bool stop;
+		Pixy::Mutex lock;
+		Pixy::Condition cond;
+		};
+
+	/*
+	 * A reader thread: takes up the next file, waits for room to hold it,
+	 * then reads it in whole. The room is handed out in archive order, so
+	 * the file the writer waits for is never kept out by later ones. Files
+	 * that wouldn't fit at all are left for the writer to stream.
+	 */
+	static void _prefetch(void* inData,int)
+	    {
+	    Prefetch* p=(Prefetch*)inData;
+	    p->lock.lock();
+	    while(!p->stop && p->next < p->files->size())
+		{
+		std::size_t i=p->next++;
+		p->lock.unlock();
+
+		long int len=-1;
+		std::FILE* in=std::fopen((*p->files)[i].first.c_str(),"rb");
+		if(in!=NULL && std::fseek(in,0L,SEEK_END)==0)
+		    {
+		    len=std::ftell(in);
+		    std::fseek(in,0L,SEEK_SET);
+		    }
+
+		p->lock.lock();
+		while(!p->stop && (p->reserved!=i ||
+			(p->inflight>0 && len>=0 && (std::size_t)len<=p->budget &&
+			 p->inflight+(std::size_t)len>p->budget)))
+		    p->cond.wait(p->lock);
+		if(p->stop)
+		    {
+		    p->lock.unlock();
+		    if(in!=NULL) std::fclose(in);
+		    p->lock.lock();
+		    break;
+		    }
+		p->reserved++;
+		if(len<0 || (std::size_t)len>p->budget)
+		    {
+		    p->state[i]=(len<0 ? Prefetch::FAILED : Prefetch::LARGE);
+		    p->cond.notifyAll();
+		    p->lock.unlock();
+		    if(in!=NULL) std::fclose(in);
+		    p->lock.lock();
+		    continue;
+		    }
+		p->inflight+=(std::size_t)len;
+		p->cond.notifyAll();
+		p->lock.unlock();
+
+		std::vector<char> buf((std::size_t)len);
+		std::size_t nRead=(len>0) ? std::fread(&buf[0],1,(std::size_t)len,in) : 0;
+		bool failed=(std::ferror(in)!=0);
+		std::fclose(in);
+		buf.resize(nRead);
+
+		p->lock.lock();
+		p->inflight-=(std::size_t)len-nRead;
+		p->data[i].swap(buf);
+		p->state[i]=(failed ? Prefetch::FAILED : Prefetch::READY);
+		p->cond.notifyAll();
+		}
+	    p->lock.unlock();
+	    }
+
 	void _endRecord(std::size_t len)
 	    {
 	    char c='\0';
@@ -155,7 +246,7 @@ class Tar
 	    _endRecord(len);
 	    }
 
-	void putFile(const char* filename,const char* nameInArchive)
+	virtual void putFile(const char* filename,const char* nameInArchive)
 	    {
 	    char buff[BUFSIZ];
 	    std::FILE* in=std::fopen(filename,"rb");
@@ -187,8 +278,274 @@ class Tar
 
 	    _endRecord(len);
 	    }
+
+	/**
+	 * putFile() for each of files, (file, name in archive) pairs, in that
+	 * order, while up to inThreads reader threads (0: one per processor)
+	 * read the files coming next into memory, up to inBudget bytes of them,
+	 * so that opening and reading many small files overlaps with whatever
+	 * the output stream does, e.g. compressing. Larger files are streamed
+	 * as putFile() does.
+	 */
+	void putFiles(const std::vector<std::pair<std::string,std::string> >& files,
+		int inThreads=0,std::size_t inBudget=(64<<20))
+	    {
+	    Prefetch p;
+	    p.files=&files;
+	    p.state.assign(files.size(),Prefetch::PENDING);
+	    p.data.resize(files.size());
+	    p.next=p.reserved=p.inflight=0;
+	    p.budget=inBudget;
+	    p.stop=false;
+
+	    int nThreads=Pixy::Thread::resolve(inThreads);
+	    if((std::size_t)nThreads>files.size()) nThreads=(int)files.size();
+	    Pixy::Thread* readers=new Pixy::Thread[nThreads];
+	    int nStarted=0;
+	    for(int t=0;t<nThreads;++t)
+		if(readers[t].start(&Tar::_prefetch,&p,t)) ++nStarted;
+
+	    try
+		{
+		for(std::size_t i=0;i<files.size();++i)
+		    {
+		    p.lock.lock();
+		    // with no reader to be had, all of them are read from here
+		    while(nStarted>0 && p.state[i]==Prefetch::PENDING)
+			p.cond.wait(p.lock);
+		    int state=p.state[i];
+		    std::vector<char> buf;
+		    buf.swap(p.data[i]);
+		    p.lock.unlock();
+
+		    if(state==Prefetch::READY)
+			{
+			put(files[i].second.c_str(),buf.empty() ? "" : &buf[0],buf.size());
+			p.lock.lock();
+			p.inflight-=buf.size();
+			p.cond.notifyAll();
+			p.lock.unlock();
+			}
+		    else
+			{
+			putFile(files[i].first.c_str(),files[i].second.c_str());
+			}
+		    }
+		}
+	    catch(...)
+		{
+		_stopPrefetch(&p,readers,nThreads);
+		throw;
+		}
+	    _stopPrefetch(&p,readers,nThreads);
+	    }
+
+    private:
+
+	static void _stopPrefetch(Prefetch* p,Pixy::Thread* readers,int nThreads)
+	    {
+	    p->lock.lock();
+	    p->stop=true;
+	    p->cond.notifyAll();
+	    p->lock.unlock();
+	    for(int t=0;t<nThreads;++t) readers[t].join();
+	    delete[] readers;
+	    }
     };
 
+#if PIXY_PLATFORM != PIXY_PLATFORM_WIN32
+/**
+ * Where FdTar writes headers and padding to: they're buffered so that the
+ * padding of a record goes out with the next header in a single write(2).
+ */
+class FdTarBuf : public std::streambuf
+    {
+    public:
+	FdTarBuf(int fd):fd(fd)
+	    {
+	    setp(buff,buff+sizeof(buff));
+	    }
+    protected:
+	int fd;
+	char buff[1<<16];
+
+	virtual int overflow(int c)
+	    {
+	    if(sync()!=0) return traits_type::eof();
+	    if(c!=traits_type::eof())
+		{
+		*pptr()=(char)c;
+		pbump(1);
+		}
+	    return traits_type::not_eof(c);
+	    }
+
+	virtual int sync()
+	    {
+	    const char* p=pbase();
+	    while(p<pptr())
+		{
+		ssize_t n=::write(fd,p,pptr()-p);
+		if(n<0 && errno==EINTR) continue;
+		if(n<=0) break;
+		p+=n;
+		}
+	    bool done=(p==pptr());
+	    setp(buff,buff+sizeof(buff));
+	    return done ? 0 : -1;
+	    }
+    };
+
+struct FdTarOut
+    {
+    FdTarBuf buf;
+    std::ostream stream;
+    FdTarOut(int fd):buf(fd),stream(&buf) {}
+    };
+
+/**
+ * A Tar for uncompressed archives, written to a file descriptor (left open).
+ * putFile() has the kernel move the file bodies over with copy_file_range(2),
+ * or sendfile(2) where the descriptors don't allow it, e.g. across file
+ * systems or to a pipe, rather than copying them through user space. What
+ * neither can do is copied with read(2) and write(2).
+ *
+ * Kiwi compresses its own archives as it writes them, through a Tar; FdTar
+ * is for a plain .tar, e.g. one left for an outside compressor or written
+ * straight to a pipe or socket. test/tar_test.cpp holds it to Tar's output.
+ */
+class FdTar : private FdTarOut, public Tar
+    {
+    protected:
+	int fd;
+	enum Method { COPY_RANGE, SENDFILE, READ_WRITE };
+	Method method;	/* the first way the descriptor hasn't refused */
+
+	/*
+	 * moves up to n bytes from offset pos of in to fd, the way it can,
+	 * starting with how, which is where this file got to; returns 0 at the
+	 * end of the file
+	 */
+	ssize_t _move(int in,long long pos,std::size_t n,Method& how)
+	    {
+	    if(n>(1<<30)) n=(1<<30);
+	    for(;;)
+		{
+		ssize_t moved=-1;
+		errno=0;
+#if defined(__linux__) && defined(SYS_copy_file_range)
+		if(how==COPY_RANGE)
+		    {
+		    loff_t off=pos;
+		    moved=::syscall(SYS_copy_file_range,in,&off,fd,(loff_t*)NULL,n,0u);
+		    }
+#endif
+#if defined(__linux__)
+		if(how==SENDFILE)
+		    {
+		    off_t off=(off_t)pos;
+		    moved=::sendfile(fd,in,&off,n);
+		    }
+#endif
+		if(how==READ_WRITE)
+		    {
+		    char buff[1<<16];
+		    moved=::pread(in,buff,(n<sizeof(buff)) ? n : sizeof(buff),(off_t)pos);
+		    if(moved>0)
+			{
+			out.write(buff,moved);
+			out.flush();
+			}
+		    return moved;
+		    }
+
+		if(moved<0 && errno==EINTR) continue;
+		if(moved>0) return moved;
+		// past the first call, nothing moved is the end of a file that
+		// shrank; on it, some file systems have copy_file_range(2) report
+		// nothing at all, which only this file is taken to another way for
+		if(moved==0 && pos>0) return 0;
+		how=(how==COPY_RANGE) ? SENDFILE : READ_WRITE;
+		if(moved<0 && method<how) method=how;
+		}
+	    }
+
+    public:
+	FdTar(int fd):FdTarOut(fd),Tar(FdTarOut::stream),fd(fd),method(COPY_RANGE)
+	    {
+	    }
+
+	virtual ~FdTar()
+	    {
+	    out.flush();
+	    }
+
+	/** false once anything couldn't be written out */
+	bool good() const
+	    {
+	    return out.good();
+	    }
+
+	virtual void putFile(const char* filename,const char* nameInArchive)
+	    {
+	    int in=::open(filename,O_RDONLY);
+	    if(in<0)
+		{
+		std::ostringstream os;
+		os << "Cannot open " << filename << " "<< std::strerror(errno);
+		throw std::runtime_error(os.str());
+		}
+	    struct stat st;
+	    if(::fstat(in,&st)!=0 || !S_ISREG(st.st_mode))
+		{
+		::close(in);
+		Tar::putFile(filename,nameInArchive);
+		return;
+		}
+	    std::size_t len=(std::size_t)st.st_size;
+
+	    PosixTarHeader header;
+	    _init(&header);
+	    _filename(&header,nameInArchive);
+	    header.typeflag[0]=0;
+	    _size(&header,len);
+	    _checksum(&header);
+	    out.write((const char*)&header,sizeof(PosixTarHeader));
+	    out.flush();
+
+	    std::size_t done=0;
+	    Method how=method;
+	    while(done<len && out.good())
+		{
+		ssize_t moved=_move(in,done,len-done,how);
+		if(moved==0) break;
+		if(moved<0)
+		    {
+		    int err=errno;
+		    ::close(in);
+		    std::ostringstream os;
+		    os << "Cannot read " << filename << " "<< std::strerror(err);
+		    throw std::runtime_error(os.str());
+		    }
+		done+=moved;
+		}
+	    ::close(in);
+
+	    // a file that shrank meanwhile is made up with zeros, as the
+	    // header says how long it is
+	    char zeros[BUFSIZ];
+	    std::memset(zeros,0,sizeof(zeros));
+	    while(done<len && out.good())
+		{
+		std::size_t n=(len-done<sizeof(zeros)) ? len-done : sizeof(zeros);
+		out.write(zeros,n);
+		done+=n;
+		}
+	    _endRecord(len);
+	    }
+    };
+#endif
+
 
 }}
 
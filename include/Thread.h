@@ -0,0 +1,305 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef H_PixyThread_H
+#define H_PixyThread_H
+
+#include "Pixy.h"
+#include <vector>
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+namespace Pixy {
+
+/*! \class Thread
+ *  \brief
+ *  Minimal fork/join helpers for the CPU-bound parts of Kiwi (suffix
+ *  sorting, diffing, compression) which don't live on the Qt side and so
+ *  can't use QThread. An instance runs a single job alongside the caller.
+ */
+class Thread {
+
+  public:
+
+  typedef void (*Job)(void* inData, int inIdx);
+
+  inline Thread() {
+    mTask.Started = false;
+  }
+
+  inline ~Thread() {
+    join();
+  }
+
+  /*! \brief
+   *  Calls inJob(inData, inIdx) on a new thread. Returns false, having
+   *  called nothing, if no thread could be had or one is still running.
+   */
+  inline bool start(Job inJob, void* inData, int inIdx = 0) {
+    if (mTask.Started)
+      return false;
+
+    mTask.Fn = inJob;
+    mTask.Data = inData;
+    mTask.Idx = inIdx;
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+    mTask.Handle = (HANDLE)_beginthreadex(NULL, 0, &Thread::entry, &mTask, 0, NULL);
+    mTask.Started = (mTask.Handle != 0);
+#else
+    mTask.Started = (pthread_create(&mTask.Handle, NULL, &Thread::entry, &mTask) == 0);
+#endif
+    return mTask.Started;
+  }
+
+  /*! \brief
+   *  Waits for the job given to start() to return, if there is one.
+   */
+  inline void join() {
+    if (!mTask.Started)
+      return;
+
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+    WaitForSingleObject(mTask.Handle, INFINITE);
+    CloseHandle(mTask.Handle);
+#else
+    pthread_join(mTask.Handle, NULL);
+#endif
+    mTask.Started = false;
+  }
+
+  /*! \brief
+   *  Returns the number of processors online, at least 1.
+   */
+  inline static int hardwareConcurrency() {
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+    SYSTEM_INFO lInfo;
+    GetSystemInfo(&lInfo);
+    return (lInfo.dwNumberOfProcessors > 0) ? (int)lInfo.dwNumberOfProcessors : 1;
+#else
+    long lCount = sysconf(_SC_NPROCESSORS_ONLN);
+    return (lCount > 0) ? (int)lCount : 1;
+#endif
+  }
+
+  /*! \brief
+   *  Resolves a user supplied thread count: 0 means one per processor.
+   */
+  inline static int resolve(int inCount) {
+    return (inCount <= 0) ? hardwareConcurrency() : inCount;
+  }
+
+  /*! \brief
+   *  Calls inJob(inData, i) for every i in [0, inCount), each on its own
+   *  thread, and returns once all of them are done. Jobs that can't be
+   *  given a thread are run on the calling one.
+   */
+  inline static void runAll(int inCount, Job inJob, void* inData) {
+    if (inCount <= 1) {
+      if (inCount == 1)
+        inJob(inData, 0);
+      return;
+    }
+
+    std::vector<Task> lTasks(inCount);
+    for (int i = 0; i < inCount; ++i) {
+      lTasks[i].Fn = inJob;
+      lTasks[i].Data = inData;
+      lTasks[i].Idx = i;
+      lTasks[i].Started = false;
+    }
+
+    // the calling thread takes the first job itself
+    for (int i = 1; i < inCount; ++i) {
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+      lTasks[i].Handle = (HANDLE)_beginthreadex(NULL, 0, &Thread::entry, &lTasks[i], 0, NULL);
+      lTasks[i].Started = (lTasks[i].Handle != 0);
+#else
+      lTasks[i].Started = (pthread_create(&lTasks[i].Handle, NULL, &Thread::entry, &lTasks[i]) == 0);
+#endif
+    }
+
+    inJob(inData, 0);
+
+    for (int i = 1; i < inCount; ++i) {
+      if (!lTasks[i].Started) {
+        inJob(inData, i);
+        continue;
+      }
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+      WaitForSingleObject(lTasks[i].Handle, INFINITE);
+      CloseHandle(lTasks[i].Handle);
+#else
+      pthread_join(lTasks[i].Handle, NULL);
+#endif
+    }
+  }
+
+  private:
+
+  struct Task {
+    Job Fn;
+    void* Data;
+    int Idx;
+    bool Started;
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+    HANDLE Handle;
+#else
+    pthread_t Handle;
+#endif
+  };
+
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+  static unsigned __stdcall entry(void* inTask) {
+#else
+  static void* entry(void* inTask) {
+#endif
+    Task* lTask = (Task*)inTask;
+    lTask->Fn(lTask->Data, lTask->Idx);
+    return 0;
+  }
+
+  Task mTask;
+
+  // threads can not be copied
+  Thread(const Thread&);
+  Thread& operator=(const Thread&);
+};
+
+/*! \class Mutex
+ *  \brief
+ *  A plain, non-recursive lock.
+ */
+class Mutex {
+
+  public:
+
+  inline Mutex() {
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+    InitializeCriticalSection(&mHandle);
+#else
+    pthread_mutex_init(&mHandle, NULL);
+#endif
+  }
+
+  inline ~Mutex() {
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+    DeleteCriticalSection(&mHandle);
+#else
+    pthread_mutex_destroy(&mHandle);
+#endif
+  }
+
+  inline void lock() {
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+    EnterCriticalSection(&mHandle);
+#else
+    pthread_mutex_lock(&mHandle);
+#endif
+  }
+
+  inline void unlock() {
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+    LeaveCriticalSection(&mHandle);
+#else
+    pthread_mutex_unlock(&mHandle);
+#endif
+  }
+
+  private:
+
+  friend class Condition;
+
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+  CRITICAL_SECTION mHandle;
+#else
+  pthread_mutex_t mHandle;
+#endif
+
+  Mutex(const Mutex&);
+  Mutex& operator=(const Mutex&);
+};
+
+/*! \class Condition
+ *  \brief
+ *  A condition variable to wait on with a Mutex held. Wake-ups may be
+ *  spurious, so waits belong in a loop re-checking the condition.
+ */
+class Condition {
+
+  public:
+
+  inline Condition() {
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+    InitializeConditionVariable(&mHandle);
+#else
+    pthread_cond_init(&mHandle, NULL);
+#endif
+  }
+
+  inline ~Condition() {
+#if PIXY_PLATFORM != PIXY_PLATFORM_WIN32
+    pthread_cond_destroy(&mHandle);
+#endif
+  }
+
+  /*! \brief
+   *  Releases inMutex, which must be held, until woken up.
+   */
+  inline void wait(Mutex& inMutex) {
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+    SleepConditionVariableCS(&mHandle, &inMutex.mHandle, INFINITE);
+#else
+    pthread_cond_wait(&mHandle, &inMutex.mHandle);
+#endif
+  }
+
+  inline void notifyAll() {
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+    WakeAllConditionVariable(&mHandle);
+#else
+    pthread_cond_broadcast(&mHandle);
+#endif
+  }
+
+  private:
+
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+  CONDITION_VARIABLE mHandle;
+#else
+  pthread_cond_t mHandle;
+#endif
+
+  Condition(const Condition&);
+  Condition& operator=(const Condition&);
+};
+
+};
+
+#endif
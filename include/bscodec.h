@@ -0,0 +1,73 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef H_BSCodec_H
+#define H_BSCodec_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <vector>
+#include "bsdiff.h"
+
+/*
+ * The compressors behind the three blocks of a patch. A block is written
+ * in one go by a bs_writer, to a FILE or appended to a buffer, and read
+ * back from memory, in pieces of whatever length the patch calls for, by
+ * a bs_reader. The compressed bytes do not depend on the destination.
+ *
+ * Both throw a bs_error on failure, see bserror.h; a damaged or truncated
+ * block fails with BSDIFF_ERR_CORRUPT.
+ */
+
+struct bs_writer;
+struct bs_reader;
+
+/*! starts a block compressed with codec at the current position of f */
+bs_writer* bs_writer_open(BSDIFF_CODEC codec, FILE* f);
+
+/*! starts a block compressed with codec at the end of out */
+bs_writer* bs_writer_open(BSDIFF_CODEC codec, std::vector<unsigned char>* out);
+
+/*! compresses len more bytes of the block */
+void bs_writer_write(bs_writer* w, const unsigned char* buf, off_t len);
+
+/*! flushes and ends the block; the destination is left open */
+void bs_writer_close(bs_writer* w);
+
+/*! releases a writer without flushing, once the block is to be given up */
+void bs_writer_discard(bs_writer* w);
+
+/*! starts decompressing the inlen bytes at in, which outlive the reader */
+bs_reader* bs_reader_open(BSDIFF_CODEC codec, const unsigned char* in, off_t inlen);
+
+/*! decompresses exactly len bytes into buf */
+void bs_reader_read(bs_reader* r, unsigned char* buf, off_t len);
+
+/*! decompresses at most len bytes into buf; returns how many, 0 once the
+ *  block is exhausted */
+off_t bs_reader_readsome(bs_reader* r, unsigned char* buf, off_t len);
+
+/*! releases a reader; NULL is ignored */
+void bs_reader_close(bs_reader* r);
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef H_BSDiff_H
+#define H_BSDiff_H
+
+#include <stddef.h>
+#include <vector>
+
+/*
+ * Entry points of the bsdiff/bspatch port found in src/bsdiff.cpp and
+ * src/bspatch.cpp. Patches are written in the BSDIFF40 format and remain
+ * compatible with Colin Percival's original tools, unless a compressor
+ * other than bzip2 is asked for: those patches carry the "BSDIFF4C"
+ * magic, which records the codec of each block. Inputs too large for the
+ * memory budget are diffed window by window into a "BSDIFF4W" patch.
+ *
+ * Every entry point is reentrant and reports failure through its return
+ * value, never by ending the process, so any number of diffs and patches
+ * may run side by side in one process.
+ */
+
+/*! outcome of a bsdiff() or bspatch() call */
+typedef enum {
+  BSDIFF_OK = 0,        //! success
+  BSDIFF_ERR_IO,        //! a file could not be read or written, or a sink refused data
+  BSDIFF_ERR_MEMORY,    //! an allocation failed
+  BSDIFF_ERR_CORRUPT,   //! the patch is truncated, damaged or not a patch at all
+  BSDIFF_ERR_ARGUMENT,  //! an option is out of range
+  BSDIFF_ERR_CANCELLED, //! the progress callback asked to stop
+  BSDIFF_ERR_INTERNAL   //! an unexpected exception, e.g. out of a sink or progress callback
+} BSDIFF_STATUS;
+
+/*! \brief
+ *  Receives the next inLen bytes of a patch or new file; returns false
+ *  to fail the call with BSDIFF_ERR_IO.
+ */
+typedef bool (*BSSink)(void* inOpaque, const unsigned char* inData, size_t inLen);
+
+/*! \brief
+ *  Told the fraction of the work done so far, from 0 to 1; returns false
+ *  to cancel the call, which then fails with BSDIFF_ERR_CANCELLED. It may
+ *  be called from any of the call's threads, but never from two at once.
+ */
+typedef bool (*BSProgress)(void* inOpaque, double inDone);
+
+/*! \struct BSInput
+ *  \brief
+ *  A file to read, or bytes already in memory which outlive the call;
+ *  the Mapped options only concern files.
+ */
+struct BSInput {
+  inline BSInput(const char* inPath)
+  : Path(inPath), Data(0), Size(0) { }
+
+  inline BSInput(const void* inData, size_t inSize)
+  : Path(0), Data((const unsigned char*)inData), Size(inSize) { }
+
+  const char* Path;
+  const unsigned char* Data;
+  size_t Size;
+};
+
+/*! \struct BSOutput
+ *  \brief
+ *  Where a patch or new file goes: a file, written to "<Path>.tmp" and
+ *  renamed over Path once complete, so that a failed call leaves Path as
+ *  it was, the end of a buffer, or a sink fed the bytes in order.
+ */
+struct BSOutput {
+  inline BSOutput(const char* inPath)
+  : Path(inPath), Buffer(0), Sink(0), Opaque(0) { }
+
+  inline BSOutput(std::vector<unsigned char>* inBuffer)
+  : Path(0), Buffer(inBuffer), Sink(0), Opaque(0) { }
+
+  inline BSOutput(BSSink inSink, void* inOpaque)
+  : Path(0), Buffer(0), Sink(inSink), Opaque(inOpaque) { }
+
+  const char* Path;
+  std::vector<unsigned char>* Buffer;
+  BSSink Sink;
+  void* Opaque;
+};
+
+/*! suffix array construction engines usable by bsdiff() */
+typedef enum {
+  BSDIFF_SORT_QSUFSORT, //! Larsson-Sadakane prefix doubling, O(n log n)
+  BSDIFF_SORT_SAIS,     //! induced sorting (SA-IS), O(n)
+  BSDIFF_SORT_PARALLEL  //! prefix doubling over 2-byte buckets, multithreaded
+} BSDIFF_SORT;
+
+/*! width of the suffix array entries */
+typedef enum {
+  BSDIFF_INDEX_AUTO, //! 32-bit entries whenever the old file is below 2 GiB
+  BSDIFF_INDEX_64    //! always use off_t-sized entries
+} BSDIFF_INDEX;
+
+/*! compressors of the ctrl, diff and extra blocks of a patch; the values
+ *  are those stored in a BSDIFF4C header */
+typedef enum {
+  BSDIFF_CODEC_BZIP2 = 0, //! bzip2 at level 9, the only codec of BSDIFF40
+  BSDIFF_CODEC_LZ4 = 1    //! LZ4 blocks, far faster both ways but larger
+} BSDIFF_CODEC;
+
+/*! \struct BSDiffOptions
+ *  \brief
+ *  Tunables of a single bsdiff() run. The defaults produce the same patch
+ *  as the reference implementation, only faster.
+ */
+struct BSDiffOptions {
+  inline BSDiffOptions() {
+    Sort = BSDIFF_SORT_SAIS;
+    Index = BSDIFF_INDEX_AUTO;
+    Threads = 1;
+    Segments = 1;
+    Mapped = false;
+    Codec = BSDIFF_CODEC_BZIP2;
+    MemoryBudget = 0;
+    Prepass = false;
+    Progress = 0;
+    ProgressData = 0;
+  }
+
+  // the engine used to sort the suffixes of the old file; all engines
+  // yield the same suffix array and hence byte-identical patches
+  BSDIFF_SORT Sort;
+
+  // 32-bit indices halve the size of the suffix array, which together with
+  // the old and new files makes up nearly all of bsdiff()'s memory
+  BSDIFF_INDEX Index;
+
+  // number of worker threads for the parallel stages, 0 for one per
+  // processor; the patch does not depend on it
+  int Threads;
+
+  // number of slices of the new file that are diffed concurrently, 0 for
+  // one per thread; more than one slice yields a slightly larger patch
+  // than the serial scan, which is what the default of 1 runs (up to 32
+  // slices stay within 2% of it, see test/segments_test.cpp)
+  int Segments;
+
+  // memory-map the inputs instead of reading them into the heap; they
+  // then share the page cache and are paged in as the diff needs them
+  bool Mapped;
+
+  // the compressor of all three blocks; anything but bzip2 writes a
+  // BSDIFF4C patch, which the original bspatch can not apply
+  BSDIFF_CODEC Codec;
+
+  // upper bound in bytes on the heap a diff may use, 0 for none; inputs
+  // that don't fit are diffed in windows, each against the part of the
+  // old file most of its content comes from, which yields a larger patch
+  // in the windowed BSDIFF4W format (budgets below 16 MB act as 16 MB)
+  size_t MemoryBudget;
+
+  // before sorting the old file, hash its blocks to find the runs both
+  // files share byte for byte; when they cover all but 1/128 of the new
+  // file, the old one isn't sorted at all and the diff is made of the
+  // runs, so lightly modified files diff many times faster for a slightly
+  // different patch (whole-file diffs only; otherwise the diff is the same
+  // as without it)
+  bool Prepass;
+
+  // called with ProgressData as the call goes, and the means to cancel it
+  BSProgress Progress;
+  void* ProgressData;
+};
+
+/*! \struct BSPatchOptions
+ *  \brief
+ *  Tunables of a single bspatch() run.
+ */
+struct BSPatchOptions {
+  inline BSPatchOptions() {
+    Threads = 1;
+    Mapped = false;
+    BufferSize = 1 << 20;
+    Progress = 0;
+    ProgressData = 0;
+  }
+
+  // number of threads, 0 for one per processor; with more than one the
+  // diff and extra blocks are each decoded ahead on a thread of their
+  // own while the calling thread builds the new file
+  int Threads;
+
+  // memory-map the old file and the patch instead of reading them; the
+  // old file is otherwise read piecewise, with pread(), as the patch
+  // calls for it
+  bool Mapped;
+
+  // size in bytes of the output buffer, of the cache of the old file
+  // and of each decoder's ring buffer (at least 4 KiB); the new file is
+  // written out each time the buffer fills, so it is never held whole
+  size_t BufferSize;
+
+  // called with ProgressData as the call goes, and the means to cancel it
+  BSProgress Progress;
+  void* ProgressData;
+};
+
+/*! \struct BSDiffStats
+ *  \brief
+ *  Figures reported back by bsdiff() on request.
+ */
+struct BSDiffStats {
+  inline BSDiffStats() {
+    PeakMemory = 0;
+    IndexSize = 0;
+  }
+
+  // high-water mark, in bytes, of all the buffers sized after the inputs
+  size_t PeakMemory;
+
+  // size in bytes of a single suffix array entry
+  size_t IndexSize;
+};
+
+/*! \class BSDiffIndex
+ *  \brief
+ *  The old file of a diff along with its suffix array, prepared once and
+ *  reusable by any number of bsdiff() calls against different new files.
+ *
+ *  Given a cache directory, the suffix array is stored there under the MD5
+ *  of the old file's content and memory-mapped by later instances, which
+ *  then skip the sort entirely.
+ */
+class BSDiffIndex {
+  public:
+    BSDiffIndex(const BSInput& inOld,
+                const char* inCacheDir = 0,
+                const BSDiffOptions& inOptions = BSDiffOptions());
+    ~BSDiffIndex();
+
+    /*! \brief
+     *  BSDIFF_OK once the index is ready; otherwise why it is not, which
+     *  any bsdiff() against it then returns as well.
+     */
+    BSDIFF_STATUS getStatus() const;
+
+    /*! \brief
+     *  Whether the suffix array was mapped from the cache instead of sorted.
+     */
+    bool isCached() const;
+
+    struct Data;
+
+  private:
+    friend BSDIFF_STATUS bsdiff(const BSDiffIndex&, const BSInput&,
+                                const BSOutput&, const BSDiffOptions&,
+                                BSDiffStats*);
+
+    Data* mData;
+
+    // indices can not be copied
+    BSDiffIndex(const BSDiffIndex&);
+    BSDiffIndex& operator=(const BSDiffIndex&);
+};
+
+/*! \brief
+ *  Creates a patch at outPatch which turns inOld into inNew.
+ */
+BSDIFF_STATUS bsdiff(const BSInput& inOld,
+                     const BSInput& inNew,
+                     const BSOutput& outPatch,
+                     const BSDiffOptions& inOptions = BSDiffOptions(),
+                     BSDiffStats* outStats = 0);
+
+/*! \brief
+ *  Same as above, with the old file taken from a prepared index. Only the
+ *  Threads, Segments, Mapped, Codec and Progress options apply; the index
+ *  was sorted (or loaded) whole with the options it was constructed with.
+ */
+BSDIFF_STATUS bsdiff(const BSDiffIndex& inOld,
+                     const BSInput& inNew,
+                     const BSOutput& outPatch,
+                     const BSDiffOptions& inOptions = BSDiffOptions(),
+                     BSDiffStats* outStats = 0);
+
+/*! \brief
+ *  Applies the BSDIFF40, BSDIFF4C or BSDIFF4W patch inPatch to inOld and
+ *  writes the result to outNew, as it is produced. Should the call fail,
+ *  whatever reached outNew is to be discarded. A file output may be
+ *  inOld's or inPatch's own file, e.g. to patch a file in place, see
+ *  BSOutput.
+ */
+BSDIFF_STATUS bspatch(const BSInput& inOld,
+                      const BSOutput& outNew,
+                      const BSInput& inPatch,
+                      const BSPatchOptions& inOptions = BSPatchOptions());
+
+/*! \brief
+ *  A short English description of inStatus.
+ */
+const char* bsdiff_strerror(BSDIFF_STATUS inStatus);
+
+#endif
@@ -0,0 +1,146 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef H_BSError_H
+#define H_BSError_H
+
+#include <new>
+#include <stdint.h>
+#include "Thread.h"
+#include "bsdiff.h"
+
+/*
+ * Failures deep inside bsdiff and bspatch are thrown as a bs_error and
+ * unwind to the public entry point that was called, which releases what
+ * it holds and returns the status; nothing ends the process. Worker
+ * threads catch their own and hand them to the thread that started them.
+ */
+struct bs_error {
+	BSDIFF_STATUS status;
+};
+
+inline void bs_fail(BSDIFF_STATUS status)
+{
+	bs_error e={status};
+	throw e;
+}
+
+/*
+ * The status of the exception being handled, inside a catch(...); any
+ * other than ours or an allocation's, e.g. thrown by a caller's sink or
+ * progress callback, is BSDIFF_ERR_INTERNAL
+ */
+inline BSDIFF_STATUS bs_caught()
+{
+	try {
+		throw;
+	} catch(const bs_error &e) {
+		return e.status;
+	} catch(const std::bad_alloc &) {
+		return BSDIFF_ERR_MEMORY;
+	} catch(...) {
+		return BSDIFF_ERR_INTERNAL;
+	};
+}
+
+/*
+ * Progress of one call, in units of the caller's choosing. The callback
+ * is serialised by the lock; once it asks to stop, every thread of the
+ * call fails with BSDIFF_ERR_CANCELLED at its next step.
+ */
+struct bs_progress {
+	BSProgress fn;
+	void *opaque;
+	uint64_t done,total;
+	volatile bool cancelled;
+	Pixy::Mutex lock;
+};
+
+inline void bs_progress_init(bs_progress *p,BSProgress fn,void *opaque,
+		uint64_t total)
+{
+	p->fn=fn;
+	p->opaque=opaque;
+	p->done=0;
+	p->total=(total>0) ? total : 1;
+	p->cancelled=false;
+}
+
+/* Records n more units done and tells the callback */
+inline void bs_advance(bs_progress *p,uint64_t n)
+{
+	if(p->cancelled)
+		bs_fail(BSDIFF_ERR_CANCELLED);
+	if(p->fn==NULL)
+		return;
+
+	p->lock.lock();
+	p->done+=n;
+	if(p->done>p->total) p->done=p->total;
+	if(!p->cancelled && !p->fn(p->opaque,(double)p->done/p->total))
+		p->cancelled=true;
+	p->lock.unlock();
+
+	if(p->cancelled)
+		bs_fail(BSDIFF_ERR_CANCELLED);
+}
+
+/*
+ * Pixy::Thread::runAll() for jobs that may fail: every job still runs,
+ * then the first failure is rethrown on the calling thread.
+ */
+struct bs_jobs {
+	Pixy::Thread::Job job;
+	void *data;
+	BSDIFF_STATUS status;
+	Pixy::Mutex lock;
+};
+
+inline void bs_job(void *data,int w)
+{
+	bs_jobs *j=(bs_jobs*)data;
+	BSDIFF_STATUS status;
+
+	try {
+		j->job(j->data,w);
+	} catch(...) {
+		status=bs_caught();
+		j->lock.lock();
+		if(j->status==BSDIFF_OK) j->status=status;
+		j->lock.unlock();
+	};
+}
+
+inline void bs_runall(int count,Pixy::Thread::Job job,void *data)
+{
+	bs_jobs j;
+
+	j.job=job;
+	j.data=data;
+	j.status=BSDIFF_OK;
+	Pixy::Thread::runAll(count,&bs_job,&j);
+	if(j.status!=BSDIFF_OK)
+		bs_fail(j.status);
+}
+
+#endif
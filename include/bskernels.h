@@ -0,0 +1,75 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef H_BSKernels_H
+#define H_BSKernels_H
+
+#include <sys/types.h>
+
+/*
+ * Byte kernels for the inner loops of bsdiff and bspatch. Each
+ * has a scalar, an SSE2 and an AVX2 implementation; the widest one the CPU
+ * supports is picked at runtime on first use.
+ *
+ * The reverse variants look at the n bytes *before* a and b, walking
+ * backwards from a[-1] and b[-1].
+ */
+
+/* hint that p is about to be read; address computation only, never faults */
+#if defined(__GNUC__)
+#define BS_PREFETCH(p) __builtin_prefetch(p)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define BS_PREFETCH(p) _mm_prefetch((const char*)(p),_MM_HINT_T0)
+#else
+#define BS_PREFETCH(p) ((void)0)
+#endif
+
+/*! number of leading bytes a and b have in common, at most n */
+off_t bs_matchlen(const unsigned char* a, const unsigned char* b, off_t n);
+
+/*! number of leading bytes in which a and b differ, at most n */
+off_t bs_mismatchlen(const unsigned char* a, const unsigned char* b, off_t n);
+
+/*! number of bytes before a and b they have in common, at most n */
+off_t bs_rmatchlen(const unsigned char* a, const unsigned char* b, off_t n);
+
+/*! number of bytes before a and b in which they differ, at most n */
+off_t bs_rmismatchlen(const unsigned char* a, const unsigned char* b, off_t n);
+
+/*! number of positions i < n where a[i] == b[i] */
+off_t bs_matchcount(const unsigned char* a, const unsigned char* b, off_t n);
+
+/*! adds o[i] to p[i] modulo 256 for each i < n; p and o do not overlap */
+void bs_add(unsigned char* p, const unsigned char* o, off_t n);
+
+/*! name of the instruction set the kernels run on: avx2, sse2 or scalar */
+const char* bs_kernels();
+
+/*! instruction sets the CPU and the OS both support, as BS_CPU_* bits */
+#define BS_CPU_SSE2   0x1
+#define BS_CPU_AVX2   0x2
+#define BS_CPU_AVX512 0x4 /* AVX-512F */
+unsigned int bs_cpu();
+
+#endif
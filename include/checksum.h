@@ -0,0 +1,71 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef H_Checksum_H
+#define H_Checksum_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*
+ * The hashes patch entries can be verified with. MD5 is what every
+ * Karazeh understands; XXH3 is many times faster to compute and verify
+ * but only guards against corruption, not tampering. Each entry records
+ * which one its checksum is, see PatchEntry::Algo.
+ */
+typedef enum {
+  CHECKSUM_MD5,  //! 128-bit MD5, written as 32 hex digits
+  CHECKSUM_XXH3  //! 64-bit XXH3, written as the 16 hex digits xxhsum gives
+} CHECKSUM_ALGO;
+
+/* Largest digest of any algorithm, in bytes */
+#define CHECKSUM_MAXSIZE 16
+
+/*! name the algorithm goes by in patch scripts: md5 or xxh3 */
+const char* checksum_name(CHECKSUM_ALGO inAlgo);
+
+/*! the algorithm named inName in patch scripts, false if there's none */
+bool checksum_algo(const std::string& inName, CHECKSUM_ALGO* outAlgo);
+
+/*! size of the algorithm's digest in bytes */
+size_t checksum_size(CHECKSUM_ALGO inAlgo);
+
+/*! lowercase hex string of the digest at inDigest */
+std::string checksum_hex(CHECKSUM_ALGO inAlgo, const unsigned char* inDigest);
+
+/*! digests inSizes[i] bytes at inData[i] into the bytes at outDigests[i] */
+void checksum_buffers(CHECKSUM_ALGO inAlgo,
+                      const unsigned char* const* inData,
+                      const size_t* inSizes, size_t inCount,
+                      unsigned char (*outDigests)[CHECKSUM_MAXSIZE]);
+
+/*! \brief
+ *  Digests each of inPaths into its lowercase hex string, or an empty one
+ *  for a file that can't be read. Returns how many files were digested.
+ */
+size_t checksum_files(CHECKSUM_ALGO inAlgo,
+                      const std::vector<std::string>& inPaths,
+                      std::vector<std::string>* outDigests);
+
+#endif
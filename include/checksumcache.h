@@ -0,0 +1,79 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef H_ChecksumCache_H
+#define H_ChecksumCache_H
+
+#include "checksum.h"
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*
+ * Persistent checksum cache: the digest of every file hashed through
+ * checksum_cached() is kept in CHECKSUM_CACHEFILE at the repository root,
+ * keyed by the file's path relative to the root, its size, mtime and
+ * inode, along with the algorithm it was hashed with. Tree hashes (see
+ * chunkhash.h) are kept the same way, tagged with their chunk size and
+ * followed by their manifest. A file whose key still matches isn't read
+ * again; one that changed in any of them, or is asked for with another
+ * algorithm or chunk size, is hashed anew and its record replaced.
+ *
+ * The file is a header, then fixed-size records sorted by a hash of their
+ * path, then the paths, each followed by its manifest if it has one, all
+ * in the byte order of the machine that wrote it, so that it is looked up
+ * in place through a mapping. A cache that is missing, damaged or foreign
+ * is ignored and rewritten.
+ */
+
+/* Name of the cache file within the repository root */
+#define CHECKSUM_CACHEFILE ".kiwi_checksums"
+
+/*! \brief
+ *  Digests inPaths like checksum_files(), taking the digest of any file
+ *  the cache in inRoot already knows unchanged from there, and adds the
+ *  ones it had to hash to it. Returns how many files were digested.
+ *
+ *  \note
+ *  Files modified less than a couple of seconds before being hashed are
+ *  not cached, a change right after could leave their mtime as it was.
+ */
+size_t checksum_cached(CHECKSUM_ALGO inAlgo,
+                       const std::string& inRoot,
+                       const std::vector<std::string>& inPaths,
+                       std::vector<std::string>* outDigests);
+
+/*! \brief
+ *  Same as checksum_cached(), for the tree hashes chunkhash_file() makes
+ *  of inPaths over inChunk-byte chunks on inThreads threads: outRoots gets
+ *  their root hashes and outManifests their manifests, both left empty for
+ *  a file that can't be read.
+ */
+size_t checksum_cached_tree(CHECKSUM_ALGO inAlgo,
+                            const std::string& inRoot,
+                            const std::vector<std::string>& inPaths,
+                            size_t inChunk, int inThreads,
+                            std::vector<std::string>* outRoots,
+                            std::vector<std::string>* outManifests);
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef H_ChunkHash_H
+#define H_ChunkHash_H
+
+#include "checksum.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * Chunked checksums: a file is cut into fixed-size chunks which are hashed
+ * independently, so on all cores at once, and its checksum is the root
+ * hash, the digest of all the chunks' digests one after the other. The
+ * chunk digests go in a manifest shipped beside the file, against which a
+ * client can check each chunk on its own, in parallel or as it arrives,
+ * and fetch again only the ones that don't match.
+ *
+ * The manifest is text: a line "CHUNKS <algorithm> <chunk size> <file
+ * size> <count>", then one line with the hex digest of each chunk.
+ */
+
+/* Size of the chunks files are cut into */
+#define CHUNKHASH_SIZE (4 << 20)
+
+/* Suffix of the manifest's name, after the file's own */
+#define CHUNKHASH_SUFFIX ".chunks"
+
+/*! \brief
+ *  Hashes the file at inPath in inChunk-byte chunks on inThreads threads,
+ *  0 meaning one per processor, into its root hash and manifest. Returns
+ *  false if the file can't be read.
+ */
+bool chunkhash_file(CHECKSUM_ALGO inAlgo, const std::string& inPath,
+                    size_t inChunk, int inThreads,
+                    std::string* outRoot, std::string* outManifest);
+
+/*! \brief
+ *  Checks the file at inPath against inManifest, on inThreads threads.
+ *  The file may be partially there: outBad gets the index of each chunk
+ *  that doesn't match or isn't whole. Returns false if the manifest can't
+ *  be parsed or doesn't hash to inRoot, when none of it can be trusted.
+ */
+bool chunkhash_verify(const std::string& inManifest, const std::string& inRoot,
+                      const std::string& inPath, int inThreads,
+                      std::vector<size_t>* outBad);
+
+#endif
@@ -23,10 +23,16 @@
 // documentation and/or software.
 
 // The original md5 implementation avoids external libraries.
-// This version has dependency on stdio.h for file input and
-// string.h for memcpy.
+// This version has dependency on stdio.h and MappedFile.h for file
+// input and string.h for memcpy.
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include "MappedFile.h"
+
+// Chunk digestFile() reads a file in when it can't be mapped
+#define MD5_READSIZE (1 << 20)
 
 #pragma region MD5 defines
 // Constants for MD5Transform routine.
@@ -94,8 +100,9 @@ typedef unsigned char *POINTER;
 // UINT2 defines a two byte word
 typedef unsigned short int UINT2;
 
-// UINT4 defines a four byte word
-typedef unsigned long int UINT4;
+// UINT4 defines a four byte word; unsigned long is eight bytes on LP64
+// platforms, where the rotations then yield wrong digests
+typedef uint32_t UINT4;
 
 // convenient object that wraps
 // the C-functions for use in C++ only
@@ -111,7 +118,7 @@ private:
   #pragma region static helper functions
   // The core of the MD5 algorithm is here.
   // MD5 basic transformation. Transforms state based on block.
-  static void MD5Transform( UINT4 state[4], unsigned char block[64] )
+  static void MD5Transform( UINT4 state[4], const unsigned char block[64] )
   {
     UINT4 a = state[0], b = state[1], c = state[2], d = state[3], x[16];
 
@@ -214,7 +221,7 @@ private:
 
   // Decodes input (unsigned char) into output (UINT4). Assumes len is
   // a multiple of 4.
-  static void Decode( UINT4 *output, unsigned char *input, unsigned int len )
+  static void Decode( UINT4 *output, const unsigned char *input, unsigned int len )
   {
     unsigned int i, j;
 
@@ -247,7 +254,7 @@ public:
   // operation, processing another message block, and updating the
   // context.
   void Update(
-    unsigned char *input,   // input block
+    const unsigned char *input, // input block
     unsigned int inputLen ) // length of input block
   {
     unsigned int i, index, partLen;
@@ -326,27 +333,71 @@ public:
   char digestChars[ 33 ] ;
 
   /// Load a file from disk and digest it
-  // Digests a file and returns the result.
-  char* digestFile( char *filename )
+  // Digests a file and returns the result, or NULL if it can't be
+  // read, digestChars being emptied then. The file is mapped
+  // and hashed straight from the page cache, whole blocks never being
+  // copied; what can't be mapped is read in MD5_READSIZE chunks.
+  char* digestFile( const char *filename )
   {
+    Pixy::MappedFile map;
+    uint64_t pos, size;
+
     Init() ;
 
+    // Pipes and /proc entries map as empty files, so those get read
+    if( map.map( filename ) && map.getSize() > 0 )
+    {
+      map.advise( Pixy::MappedFile::ADVISE_SEQUENTIAL ) ;
+      size = map.getSize() ;
+      for( pos = 0 ; pos < size ; pos += (1u << 30) )
+        Update( map.getData() + pos,
+          (unsigned int)((size - pos < (1u << 30)) ? size - pos : (1u << 30)) ) ;
+      Final();
+
+      return digestChars ;
+    }
+
+    return digestStream( filename ) ;
+  }
+
+  // The read() half of digestFile(): the read-ahead is hinted and stdio's
+  // own buffering skipped, as each fread() fills a whole chunk anyway.
+  char* digestStream( const char *filename )
+  {
     FILE *file;
+    unsigned char *buffer;
+    size_t len;
+    bool failed;
 
-    int len;
-    unsigned char buffer[1024] ;
+    Init() ;
+    digestChars[0] = 0 ;
 
-    if( (file = fopen (filename, "rb")) == NULL )
-      printf( "%s can't be opened\n", filename ) ;
-    else
+    if( (file = fopen( filename, "rb" )) == NULL )
+      return NULL ;
+    if( (buffer = (unsigned char*)malloc( MD5_READSIZE )) == NULL )
     {
-      while( len = fread( buffer, 1, 1024, file ) )
-        Update( buffer, len ) ;
-      Final();
-
       fclose( file );
+      return NULL ;
+    }
+
+    setvbuf( file, NULL, _IONBF, 0 );
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise( fileno( file ), 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
+
+    while( (len = fread( buffer, 1, MD5_READSIZE, file )) > 0 )
+      Update( buffer, (unsigned int)len ) ;
+    failed = ferror( file ) != 0 ;
+
+    free( buffer );
+    fclose( file );
+    if( failed )
+    {
+      Init() ;
+      return NULL ;
     }
 
+    Final();
     return digestChars ;
   }
 
@@ -0,0 +1,55 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef H_MD5Batch_H
+#define H_MD5Batch_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*
+ * Multi-buffer MD5: many independent messages are hashed at once, each in
+ * a 32-bit lane of the widest vector unit the CPU has (16 with AVX-512F,
+ * 8 with AVX2, 4 with SSE2, else one at a time), as MD5 itself can't be
+ * vectorised within a message. A lane that finishes its message is given
+ * the next one right away, so messages of any mix of sizes keep all the
+ * lanes busy. The digests are those of the MD5 class in md5.hpp.
+ */
+
+/*! \brief
+ *  Digests each of inPaths into the 32-char lowercase hex string
+ *  MD5::digestFile() gives, or an empty one for a file that can't be read.
+ *  Returns how many files were digested.
+ */
+size_t md5_files(const std::vector<std::string>& inPaths,
+                 std::vector<std::string>* outDigests);
+
+/*! digests inSizes[i] bytes at inData[i] into the 16 bytes at outDigests[i] */
+void md5_buffers(const unsigned char* const* inData, const size_t* inSizes,
+                 size_t inCount, unsigned char (*outDigests)[16]);
+
+/*! name of the instruction set the lanes run on: avx512, avx2, sse2 or scalar */
+const char* md5_kernels();
+
+#endif
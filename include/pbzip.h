@@ -0,0 +1,59 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef H_PBZip_H
+#define H_PBZip_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Parallel bzip2, after pbzip2: the input is cut into chunks of one level 9
+ * bzip2 block each, which are compressed into streams of their own on a
+ * pool of threads and written out in order, one after the other. bunzip2,
+ * and everything else built on libbzip2's stream reader, decodes the
+ * concatenation as the whole input. The output isn't that of plain bzip2
+ * though, it is slightly larger, and BZ2_bzRead() alone stops at the end
+ * of the first stream: it is meant for archives, not for patch blocks.
+ *
+ * Failures are thrown as a bs_error, see bserror.h.
+ */
+
+struct pbz_writer;
+
+/*! \brief
+ *  Starts compressing to the current position of f on inThreads threads,
+ *  0 meaning one per processor.
+ */
+pbz_writer* pbz_writer_open(FILE* f, int inThreads);
+
+/*! compresses len more bytes */
+void pbz_writer_write(pbz_writer* w, const unsigned char* buf, size_t len);
+
+/*! compresses what's left, writes it out and releases the writer */
+void pbz_writer_close(pbz_writer* w);
+
+/*! releases a writer without writing the rest out */
+void pbz_writer_discard(pbz_writer* w);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef H_XXH3_H
+#define H_XXH3_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * XXH3, the 64-bit variant with the default secret and no seed, as
+ * specified by xxHash 0.8: the hashes are those of XXH3_64bits() and of
+ * `xxhsum -H3`. Not a cryptographic hash, but an order of magnitude
+ * faster than MD5 for catching corrupt downloads. Inputs past 240 bytes
+ * are hashed 1 KiB block at a time by a scalar, SSE2 or AVX2 kernel,
+ * picked at runtime.
+ */
+
+/* state of a hash fed a piece at a time, see xxh3_update() */
+struct xxh3_state {
+	uint64_t acc[8];
+	uint64_t total;		/* bytes fed so far */
+	size_t buffered;	/* of them, not hashed yet and kept in buf */
+	unsigned char buf[1024];
+	unsigned char last[64];	/* the 64 bytes before buf */
+};
+
+void xxh3_reset(xxh3_state* s);
+
+/*! feeds n more bytes at p, which may be freed once this returns */
+void xxh3_update(xxh3_state* s, const void* p, size_t n);
+
+/*! hash of all that was fed since xxh3_reset(), which s keeps */
+uint64_t xxh3_digest(const xxh3_state* s);
+
+/*! hash of the n bytes at p */
+uint64_t xxh3_64(const void* p, size_t n);
+
+/*! name of the instruction set the kernel runs on: avx2, sse2 or scalar */
+const char* xxh3_kernels();
+
+#endif
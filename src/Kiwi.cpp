@@ -22,8 +22,10 @@
  */
 
 #include "Kiwi.h"
-
-extern int bsdiff(const char* inOld, const char* inNew, const char* inDest);
+#include "bsdiff.h"
+#include "checksumcache.h"
+#include "chunkhash.h"
+#include "CodecStream.h"
 
 #if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
   #include <io.h>
@@ -89,6 +91,9 @@ namespace Pixy
     connect(mUi.btnChangeRoot, SIGNAL(released()), this, SLOT(evtClickChangeRoot()));
     connect(mUi.btnUpdateRoot, SIGNAL(released()), this, SLOT(evtClickUpdateRoot()));
     connect(mUi.radioFlat, SIGNAL(clicked(bool)), this, SLOT(evtChangeStructure(bool)));
+    connect(mUi.radioMD5, SIGNAL(clicked(bool)), this, SLOT(evtChangeChecksum(bool)));
+    connect(mUi.radioXXH3, SIGNAL(clicked(bool)), this, SLOT(evtChangeChecksum(bool)));
+    connect(mUi.chkChunked, SIGNAL(toggled(bool)), this, SLOT(evtChangeChunked(bool)));
     connect(mUi.radioMirror, SIGNAL(clicked(bool)), this, SLOT(evtChangeStructure(bool)));
 
     // Edit tab
@@ -129,7 +134,7 @@ namespace Pixy
       case P_CREATE:
         lItem->setData(0, Qt::DisplayRole, lLocal);
         lItem->setData(1, Qt::DisplayRole, lRemote);
-        lItem->setData(2, Qt::DisplayRole, QString(inEntry->Checksum.c_str()));
+        lItem->setData(2, Qt::DisplayRole, QString(inEntry->checksumString().c_str()));
         mUi.treeCreations->addTopLevelItem(lItem);
 
         inEntry->Remote = lRemote.toStdString();
@@ -137,7 +142,7 @@ namespace Pixy
       case P_MODIFY:
         lItem->setData(0, Qt::DisplayRole, lLocal);
         lItem->setData(1, Qt::DisplayRole, lRemote);
-        lItem->setData(2, Qt::DisplayRole, QString(inEntry->Checksum.c_str()));
+        lItem->setData(2, Qt::DisplayRole, QString(inEntry->checksumString().c_str()));
         mUi.treeMods->addTopLevelItem(lItem);
 
         inEntry->Remote = lRemote.toStdString();
@@ -145,7 +150,7 @@ namespace Pixy
       case P_RENAME:
         lItem->setData(0, Qt::DisplayRole, lLocal);
         lItem->setData(1, Qt::DisplayRole, lRemote);
-        lItem->setData(2, Qt::DisplayRole, QString(inEntry->Checksum.c_str()));
+        lItem->setData(2, Qt::DisplayRole, QString(inEntry->checksumString().c_str()));
         mUi.treeRenames->addTopLevelItem(lItem);
         break;
       case P_DELETE:
@@ -249,6 +254,41 @@ namespace Pixy
 
   };
 
+  void Kiwi::checksumFiles(const std::vector<std::string>& inPaths,
+                           std::vector<std::string>* outChecksums,
+                           std::vector<std::string>* outManifests) {
+    outChecksums->assign(inPaths.size(), "");
+    outManifests->assign(inPaths.size(), "");
+
+    // files spanning several chunks are hashed by chunk on all cores if so
+    // asked, the rest in one batch, both through the checksum cache
+    std::vector<std::string> lWhole, lTree, lDigests, lRoots, lManifests;
+    std::vector<int> lWholeIdx, lTreeIdx;
+    for (int i=0; i < (int)inPaths.size(); ++i) {
+      QFileInfo lInfo(QString::fromStdString(inPaths[i]));
+      if (mRepo->isChunked() && lInfo.size() > CHUNKHASH_SIZE) {
+        lTree.push_back(inPaths[i]);
+        lTreeIdx.push_back(i);
+        continue;
+      }
+
+      lWhole.push_back(inPaths[i]);
+      lWholeIdx.push_back(i);
+    }
+
+    checksum_cached(mRepo->getChecksum(), mRepo->getRoot(), lWhole, &lDigests);
+    for (int i=0; i < (int)lWhole.size(); ++i)
+      (*outChecksums)[lWholeIdx[i]] = lDigests[i];
+
+    // a file that can't be read is left without a checksum
+    checksum_cached_tree(mRepo->getChecksum(), mRepo->getRoot(), lTree,
+                         CHUNKHASH_SIZE, 0, &lRoots, &lManifests);
+    for (int i=0; i < (int)lTree.size(); ++i) {
+      (*outChecksums)[lTreeIdx[i]] = lRoots[i];
+      (*outManifests)[lTreeIdx[i]] = lManifests[i];
+    }
+  }
+
   void Kiwi::evtClickCreate() {
 
     QFileDialog dialog(mUi.centralwidget);
@@ -263,31 +303,53 @@ namespace Pixy
     else
       return;
 
-    MD5 md5;
-    QString lLocal, lRemote;
-    QString lRoot = QString::fromStdString(mRepo->getRoot());
-    PatchEntry* lEntry = 0;
+    // hash the files up to the first invalid one all in one batch, those
+    // the checksum cache knows unchanged aren't read at all
+    std::vector<std::string> lPaths, lChecksums, lManifests;
     for (int i=0; i < fileNames.size(); ++i) {
-
       if (!this->validateEntry(fileNames.at(i)))
         break;
 
+      lPaths.push_back(fileNames.at(i).toStdString());
+    }
+    this->checksumFiles(lPaths, &lChecksums, &lManifests);
+
+    QString lLocal, lRemote, lUnreadable;
+    QString lRoot = QString::fromStdString(mRepo->getRoot());
+    PatchEntry* lEntry = 0;
+    for (int i=0; i < (int)lPaths.size(); ++i) {
+
+      // an entry whose checksum couldn't be computed could never be
+      // verified, it's left out
+      const std::string& lChecksum = lChecksums[i];
+      if (lChecksum.empty()) {
+        lUnreadable += "\n" + fileNames.at(i);
+        continue;
+      }
+
       lLocal = QString(fileNames.at(i)).remove(lRoot);
       lRemote = QString(fileNames.at(i)).remove(lRoot);
-      std::string lChecksum = md5.digestFile((char*)(fileNames.at(i).toStdString()).c_str());
 
       // only add it if it hasn't been added yet
-      lEntry = mRepo->registerEntry(P_CREATE, lLocal.toStdString(), lRemote.toStdString(), "", lChecksum);
+      lEntry = mRepo->registerEntry(P_CREATE, lLocal.toStdString(), lRemote.toStdString(), "", lChecksum, mRepo->getChecksum());
       if (!lEntry)
         continue;
 
       lEntry->Flat = lRemote.replace("/", "_").replace(0,1,"/").toStdString();
+      lEntry->Manifest = lManifests[i];
 
       this->addTreeEntry(lEntry);
 
     }
     this->refreshTree();
     lEntry = 0;
+
+    if (!lUnreadable.isEmpty())
+      QMessageBox::critical(
+        mWindow,
+        tr("Invalid file"),
+        tr("Unable to read these files to compute their checksums, they were not added:") + lUnreadable
+      );
   }
 
   void Kiwi::evtClickModify() {
@@ -316,14 +378,24 @@ namespace Pixy
     if (!this->validateEntry(dialog.selectedFiles().at(0)))
       return;
 
-    MD5 md5;
-    std::string lChecksum = md5.digestFile((char*)((dialog.selectedFiles().at(0).toStdString()).c_str()));
+    std::vector<std::string> lPaths(1, dialog.selectedFiles().at(0).toStdString()), lChecksums, lManifests;
+    this->checksumFiles(lPaths, &lChecksums, &lManifests);
+    if (lChecksums[0].empty()) {
+      QMessageBox::critical(
+        mWindow,
+        tr("Invalid file"),
+        tr("Unable to read the file to compute its checksum.")
+      );
+      return;
+    }
+    std::string lChecksum = lChecksums[0];
 
-    PatchEntry *lEntry = mRepo->registerEntry(P_MODIFY, lSrc.toStdString(), lDiff.toStdString(), "", lChecksum);
+    PatchEntry *lEntry = mRepo->registerEntry(P_MODIFY, lSrc.toStdString(), lDiff.toStdString(), "", lChecksum, mRepo->getChecksum());
     if (!lEntry)
       return;
 
     lEntry->Flat = lDiff.replace("/", "_").replace(0,1,"/").toStdString();
+    lEntry->Manifest = lManifests[0];
 
     this->addTreeEntry(lEntry);
     this->refreshTree();
@@ -483,11 +555,26 @@ namespace Pixy
       return;
     }
 
-    bsdiff(
+    BSDiffStats lStats;
+    BSDIFF_STATUS lStatus = bsdiff(
       (mUi.txtDiffOriginal->text().toStdString()).c_str(),
       (mUi.txtDiffModified->text().toStdString()).c_str(),
-      (mUi.txtDiffDest->text().toStdString()).c_str()
+      (mUi.txtDiffDest->text().toStdString()).c_str(),
+      BSDiffOptions(),
+      &lStats
     );
+    if (lStatus != BSDIFF_OK) {
+      QMessageBox::critical(
+        mWindow,
+        tr("Diff failed"),
+        tr("Unable to generate the diff patch: ") + tr(bsdiff_strerror(lStatus)));
+      return;
+    }
+
+    mUi.txtConsole->append(
+      tr("* Diff memory high-water mark: ") +
+      QString::number(lStats.PeakMemory / 1024) + tr(" KB (") +
+      QString::number(lStats.IndexSize * 8) + tr("-bit suffix indices)"));
 
     QMessageBox::information(
       mWindow,
@@ -518,8 +605,15 @@ namespace Pixy
     }
 
     MD5 md5;
-    std::string lChecksum = md5.digestFile((char*)(mUi.txtMD5Source->text().toStdString()).c_str());
-    mUi.txtMD5Result->setText(lChecksum.c_str());
+    if (!md5.digestFile(mUi.txtMD5Source->text().toStdString().c_str())) {
+      QMessageBox::critical(
+        mWindow,
+        tr("Invalid file"),
+        tr("Please make sure that the file you've located exists and is readable.")
+      );
+      return;
+    }
+    mUi.txtMD5Result->setText(md5.digestChars);
   }
 
   void Kiwi::evtChangeStructure(bool fToggled) {
@@ -546,6 +640,18 @@ namespace Pixy
 
   }
 
+  void Kiwi::evtChangeChecksum(bool fToggled) {
+    if (mUi.radioXXH3->isChecked()) {
+      mRepo->setChecksum(CHECKSUM_XXH3);
+    } else {
+      mRepo->setChecksum(CHECKSUM_MD5);
+    }
+  }
+
+  void Kiwi::evtChangeChunked(bool fToggled) {
+    mRepo->setChunked(fToggled);
+  }
+
   void Kiwi::evtClickGenerateScript() {
     if (mRepo->getEntries().empty()) {
       QMessageBox::information(
@@ -624,79 +730,55 @@ namespace Pixy
       return;
     }
 
-    std::string ofp = mRepo->getRoot() + "/patch_" + mRepo->getVersion().toNumber() + ".tar";
-    mUi.txtConsole->append(tr("Preparing tar archive.") + tr(ofp.c_str()));
-    std::fstream out(ofp.c_str(), std::ios::out);
-    if(!out.is_open())
+    // the archive is compressed as it's written, on all cores, there's no
+    // plain .tar
+    std::string ofp = mRepo->getRoot() + "/patch_" + mRepo->getVersion().toNumber() + ".tar.bz2";
+    mUi.txtConsole->append(tr("Preparing compressed tar archive ") + tr(ofp.c_str()));
+    FILE *tbz2File = fopen(ofp.c_str(), "wb");
+    if (!tbz2File)
     {
       QMessageBox::critical(mWindow, tr("Could not open archive"), tr("Unable to open archive for writing."));
       return;
     }
 
+    CodecStreambuf lBz2(BSDIFF_CODEC_BZIP2, tbz2File, 0);
+    std::ostream out(&lBz2);
     lindenb::io::Tar tarball(out);
     std::vector<PatchEntry*> lEntries = mRepo->getEntries(P_CREATE);
+    std::vector<PatchEntry*> lModified = mRepo->getEntries(P_MODIFY);
+    lEntries.insert(lEntries.end(), lModified.begin(), lModified.end());
     std::vector<PatchEntry*>::const_iterator entry;
 
+    // the files are read ahead on their own threads while the archive is
+    // being compressed, the chunk manifests follow them
+    std::vector<std::pair<std::string, std::string> > lFiles;
     std::string src, dest;
     std::string basepath = mRepo->getVersion().toNumber();
     for (entry = lEntries.begin(); entry != lEntries.end(); ++entry) {
-      src = mRepo->getRoot() + (*entry)->Local;
+      src = mRepo->getRoot() + (((*entry)->Op == P_MODIFY) ? (*entry)->Aux : (*entry)->Local);
       dest = basepath + ((mRepo->isFlat()) ? (*entry)->Flat : (*entry)->Remote);
 
       mUi.txtConsole->append(tr("* Adding file to archive: ") + src.c_str() + tr(" : ") + dest.c_str());
-      tarball.putFile(src.c_str(), dest.c_str());
+      lFiles.push_back(std::make_pair(src, dest));
     }
+    tarball.putFiles(lFiles);
 
-    lEntries = mRepo->getEntries(P_MODIFY);
     for (entry = lEntries.begin(); entry != lEntries.end(); ++entry) {
-      src = mRepo->getRoot() + (*entry)->Aux;
       dest = basepath + ((mRepo->isFlat()) ? (*entry)->Flat : (*entry)->Remote);
-
-      mUi.txtConsole->append(tr("* Adding file to archive: ") + src.c_str() + tr(" : ") + dest.c_str());
-      tarball.putFile(src.c_str(), dest.c_str());
+      if (!(*entry)->Manifest.empty())
+        tarball.put((dest + CHUNKHASH_SUFFIX).c_str(), (*entry)->Manifest);
     }
 
     tarball.finish();
-    out.close();
-
-    mUi.txtConsole->append(tr("Tar archive generated successfully."));
-
-    mUi.txtConsole->append(tr("Compressing archive using BZip2..."));
-
-#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
-  #define open _open
-  #define read _read
-  #define close _close
-#endif
-    int tarFD = open(ofp.c_str(), O_RDONLY);
-
-    std::string gofp = mRepo->getRoot() + std::string("/patch_") + mRepo->getVersion().toNumber() + std::string(".tar.bz2");
-    FILE *tbz2File = fopen(gofp.c_str(), "wb");
-    int bzError;
-    const int BLOCK_MULTIPLIER = 7;
-    BZFILE *pBz = BZ2_bzWriteOpen(&bzError, tbz2File, BLOCK_MULTIPLIER, 0, 0);
-
-    const int BUF_SIZE = 10000;
-    char* buf = new char[BUF_SIZE];
-    ssize_t bytesRead;
-    while((bytesRead = read(tarFD, buf, BUF_SIZE)) > 0)
-    {
-      BZ2_bzWrite(&bzError, pBz, buf, bytesRead);
+    bool lDone = lBz2.close() && out.good();
+    lDone = (fclose(tbz2File) == 0) && lDone;
+    if (!lDone) {
+      remove(ofp.c_str());
+      QMessageBox::critical(mWindow, tr("Could not write archive"), tr("Unable to compress the archive to disk, is there enough room left?"));
+      return;
     }
-    BZ2_bzWriteClose(&bzError, pBz, 0, NULL, NULL);
-    close(tarFD);
-    remove(ofp.c_str());
 
-    delete[] buf;
-
-    fclose(tbz2File);
-
-#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
-  #undef open
-  #undef read
-  #undef close
-#endif
-    mUi.txtConsole->append(tr("Archive compressed successfully."));
+    mUi.txtConsole->append(tr("Tar archive generated and compressed successfully."));
 
   }
 
@@ -29,6 +29,8 @@ namespace Pixy {
 	  mVersion = inVersion;
     mRoot = "";
     fFlat = false;
+    mChecksum = CHECKSUM_MD5;
+    fChunked = false;
     mEntries.clear();
   }
 
@@ -50,7 +52,8 @@ namespace Pixy {
                             std::string Local,
                             std::string Remote,
                             std::string Temp,
-                            std::string Checksum
+                            std::string Checksum,
+                            CHECKSUM_ALGO Algo
                             )
   {
     PatchEntry *lEntry = new PatchEntry();
@@ -59,6 +62,7 @@ namespace Pixy {
     lEntry->Local = Local;
     lEntry->Remote = Remote;
     lEntry->Checksum = Checksum;
+    lEntry->Algo = Algo;
     lEntry->Repo = this;
 
     if (Op == P_MODIFY)
@@ -0,0 +1,552 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#include <sys/types.h>
+
+#include <bzlib.h>
+#include "bscodec.h"
+#include "bserror.h"
+#include "bskernels.h"
+#ifdef _WIN32
+typedef unsigned char u_char;
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * LZ4 block format: a sequence is a token (literal count << 4 | match
+ * length - 4, 15 meaning "more follows" as bytes up to and including the
+ * first one below 255), the literals, then a 16-bit little-endian back
+ * reference and the rest of the match length. The last sequence of a
+ * block is made of literals only; no match starts in the last 12 bytes
+ * nor reaches into the last 5.
+ *
+ * A LZ4 patch block is a series of frames, each holding up to
+ * BS_LZ4_BLOCK bytes of input compressed on their own:
+ *	0	4	uncompressed length
+ *	4	4	stored length, bit 31 set when stored uncompressed
+ *	8	??	data
+ */
+#define BS_LZ4_BLOCK (1<<20)
+#define BS_LZ4_HASHLOG 16
+#define BS_LZ4_MAXOFF 65535
+#define BS_LZ4_MFLIMIT 12
+#define BS_LZ4_LASTLITERALS 5
+#define BS_LZ4_STORED 0x80000000u
+
+/* Room for the compressed output of bzip2 between two flushes */
+#define BS_BZ_CHUNK (1<<16)
+
+static inline uint32_t rd32(const u_char *p)
+{
+	uint32_t v;
+
+	memcpy(&v,p,4);
+	return v;
+}
+
+static inline uint32_t le32in(const u_char *p)
+{
+	return (uint32_t)p[0]|((uint32_t)p[1]<<8)|
+		((uint32_t)p[2]<<16)|((uint32_t)p[3]<<24);
+}
+
+static inline void le32out(uint32_t x,u_char *p)
+{
+	p[0]=(u_char)x;
+	p[1]=(u_char)(x>>8);
+	p[2]=(u_char)(x>>16);
+	p[3]=(u_char)(x>>24);
+}
+
+static inline uint32_t lz4_hash(uint32_t v)
+{
+	return (v*2654435761u)>>(32-BS_LZ4_HASHLOG);
+}
+
+static off_t lz4_bound(off_t n)
+{
+	return n+n/255+16;
+}
+
+static u_char *lz4_length(u_char *op,off_t len)
+{
+	for(;len>=255;len-=255) *op++=255;
+	*op++=(u_char)len;
+
+	return op;
+}
+
+/* Emits one sequence; a match length of 0 makes it the final one */
+static u_char *lz4_sequence(u_char *op,const u_char *lit,off_t litlen,
+		off_t offset,off_t mlen)
+{
+	u_char *token=op++;
+
+	*token=(u_char)(((litlen>=15) ? 15 : litlen)<<4);
+	if(litlen>=15) op=lz4_length(op,litlen-15);
+	memcpy(op,lit,litlen);
+	op+=litlen;
+
+	if(mlen==0) return op;
+
+	*op++=(u_char)offset;
+	*op++=(u_char)(offset>>8);
+	mlen-=4;
+	*token|=(u_char)((mlen>=15) ? 15 : mlen);
+	if(mlen>=15) op=lz4_length(op,mlen-15);
+
+	return op;
+}
+
+/*
+ * Greedy single-pass compressor: the last position of every 4-byte hash
+ * is remembered, and a candidate that really matches is extended both
+ * ways. Stretches without matches are skipped over increasingly fast.
+ */
+static off_t lz4_compress(const u_char *src,off_t n,u_char *dst,
+		uint32_t *table)
+{
+	const u_char *ip=src,*anchor=src,*end=src+n,*ref;
+	const u_char *mflimit=end-BS_LZ4_MFLIMIT;
+	const u_char *matchlimit=end-BS_LZ4_LASTLITERALS;
+	u_char *op=dst;
+	uint32_t h;
+	off_t len;
+
+	if(n>BS_LZ4_MFLIMIT) {
+		memset(table,0,sizeof(uint32_t)<<BS_LZ4_HASHLOG);
+		for(ip++;ip<=mflimit;) {
+			h=lz4_hash(rd32(ip));
+			ref=src+table[h];
+			table[h]=(uint32_t)(ip-src);
+			if((ip-ref>BS_LZ4_MAXOFF) || (rd32(ref)!=rd32(ip))) {
+				ip+=1+((ip-anchor)>>6);
+				continue;
+			};
+
+			while((ip>anchor) && (ref>src) && (ip[-1]==ref[-1])) {
+				ip--;
+				ref--;
+			};
+			len=4+bs_matchlen(ip+4,ref+4,matchlimit-ip-4);
+			op=lz4_sequence(op,anchor,ip-anchor,ip-ref,len);
+			ip+=len;
+			anchor=ip;
+
+			if(ip<=mflimit)
+				table[lz4_hash(rd32(ip-2))]=(uint32_t)(ip-2-src);
+		};
+	};
+
+	op=lz4_sequence(op,anchor,end-anchor,0,0);
+	return op-dst;
+}
+
+/* Returns the decompressed length, or -1 if src is not a valid block */
+static off_t lz4_decompress(const u_char *src,off_t n,u_char *dst,off_t cap)
+{
+	const u_char *ip=src,*iend=src+n,*ref;
+	u_char *op=dst,*oend=dst+cap;
+	off_t len,offset,i;
+	u_char token,b;
+
+	for(;;) {
+		if(ip>=iend) return -1;
+		token=*ip++;
+
+		len=token>>4;
+		if(len==15) do {
+			if(ip>=iend) return -1;
+			len+=(b=*ip++);
+		} while(b==255);
+		if((len>iend-ip) || (len>oend-op)) return -1;
+		memcpy(op,ip,len);
+		op+=len;
+		ip+=len;
+
+		if(ip==iend) break;
+
+		if(iend-ip<2) return -1;
+		offset=ip[0]|(ip[1]<<8);
+		ip+=2;
+		if((offset==0) || (offset>op-dst)) return -1;
+
+		len=token&15;
+		if(len==15) do {
+			if(ip>=iend) return -1;
+			len+=(b=*ip++);
+		} while(b==255);
+		len+=4;
+		if(len>oend-op) return -1;
+
+		/* Overlapping references repeat the last offset bytes */
+		ref=op-offset;
+		if(offset>=len)
+			memcpy(op,ref,len);
+		else
+			for(i=0;i<len;i++) op[i]=ref[i];
+		op+=len;
+	};
+
+	return op-dst;
+}
+
+struct bs_writer {
+	BSDIFF_CODEC codec;
+	FILE *f;
+	std::vector<u_char> *mem;
+
+	/* bzip2, compressing into out */
+	bz_stream strm;
+
+	/* LZ4: the frame being filled and the room to compress it into */
+	u_char *raw,*out;
+	off_t rawlen;
+	uint32_t *table;
+};
+
+static void emit(bs_writer *w,const u_char *buf,off_t len)
+{
+	if(len==0) return;
+	if(w->mem)
+		w->mem->insert(w->mem->end(),buf,buf+len);
+	else if(fwrite(buf,len,1,w->f)!=1)
+		bs_fail(BSDIFF_ERR_IO);
+}
+
+static void lz4_flush(bs_writer *w,const u_char *src,off_t n)
+{
+	off_t len;
+
+	len=lz4_compress(src,n,w->out+8,w->table);
+	le32out((uint32_t)n,w->out);
+	if(len<n) {
+		le32out((uint32_t)len,w->out+4);
+		emit(w,w->out,8+len);
+	} else {
+		le32out((uint32_t)n|BS_LZ4_STORED,w->out+4);
+		emit(w,w->out,8);
+		emit(w,src,n);
+	};
+}
+
+/* Runs the bzip2 encoder until it wants more input, or to the end */
+static void bz_pump(bs_writer *w,int action)
+{
+	int bz2err;
+
+	do {
+		w->strm.next_out=(char*)w->out;
+		w->strm.avail_out=BS_BZ_CHUNK;
+		bz2err=BZ2_bzCompress(&w->strm,action);
+		if((bz2err!=BZ_RUN_OK) && (bz2err!=BZ_FINISH_OK) &&
+			(bz2err!=BZ_STREAM_END))
+			bs_fail(BSDIFF_ERR_ARGUMENT);
+		emit(w,w->out,BS_BZ_CHUNK-w->strm.avail_out);
+	} while((action==BZ_RUN) ? (w->strm.avail_in>0) :
+		(bz2err!=BZ_STREAM_END));
+}
+
+static bs_writer *writer_open(BSDIFF_CODEC codec,FILE *f,
+		std::vector<u_char> *mem)
+{
+	bs_writer *w;
+
+	if((codec!=BSDIFF_CODEC_BZIP2) && (codec!=BSDIFF_CODEC_LZ4))
+		bs_fail(BSDIFF_ERR_ARGUMENT);
+	if((w=(bs_writer*)calloc(1,sizeof(bs_writer)))==NULL)
+		bs_fail(BSDIFF_ERR_MEMORY);
+	w->codec=codec;
+	w->f=f;
+	w->mem=mem;
+
+	if(codec==BSDIFF_CODEC_BZIP2) {
+		/* Same parameters, hence bytes, as BZ2_bzWriteOpen(9,0,0) */
+		if(BZ2_bzCompressInit(&w->strm,9,0,0)!=BZ_OK) {
+			free(w);
+			bs_fail(BSDIFF_ERR_MEMORY);
+		};
+		if((w->out=(u_char*)malloc(BS_BZ_CHUNK))==NULL) {
+			bs_writer_discard(w);
+			bs_fail(BSDIFF_ERR_MEMORY);
+		};
+	} else if(((w->raw=(u_char*)malloc(BS_LZ4_BLOCK))==NULL) ||
+		((w->out=(u_char*)malloc(8+lz4_bound(BS_LZ4_BLOCK)))==NULL) ||
+		((w->table=(uint32_t*)malloc(sizeof(uint32_t)<<BS_LZ4_HASHLOG))==NULL)) {
+		bs_writer_discard(w);
+		bs_fail(BSDIFF_ERR_MEMORY);
+	};
+
+	return w;
+}
+
+bs_writer *bs_writer_open(BSDIFF_CODEC codec,FILE *f)
+{
+	return writer_open(codec,f,NULL);
+}
+
+bs_writer *bs_writer_open(BSDIFF_CODEC codec,std::vector<u_char> *out)
+{
+	return writer_open(codec,NULL,out);
+}
+
+void bs_writer_write(bs_writer *w,const u_char *buf,off_t len)
+{
+	unsigned int n;
+	off_t m;
+
+	if(w->codec==BSDIFF_CODEC_BZIP2) {
+		while(len>0) {
+			n=(len>(1<<30)) ? (1<<30) : (unsigned int)len;
+			w->strm.next_in=(char*)buf;
+			w->strm.avail_in=n;
+			bz_pump(w,BZ_RUN);
+			buf+=n;
+			len-=n;
+		};
+		return;
+	};
+
+	while(len>0) {
+		/* Whole frames are compressed straight from the caller */
+		if((w->rawlen==0) && (len>=BS_LZ4_BLOCK)) {
+			lz4_flush(w,buf,BS_LZ4_BLOCK);
+			buf+=BS_LZ4_BLOCK;
+			len-=BS_LZ4_BLOCK;
+			continue;
+		};
+
+		m=BS_LZ4_BLOCK-w->rawlen;
+		if(m>len) m=len;
+		memcpy(w->raw+w->rawlen,buf,m);
+		w->rawlen+=m;
+		buf+=m;
+		len-=m;
+		if(w->rawlen==BS_LZ4_BLOCK) {
+			lz4_flush(w,w->raw,w->rawlen);
+			w->rawlen=0;
+		};
+	};
+}
+
+void bs_writer_close(bs_writer *w)
+{
+	try {
+		if(w->codec==BSDIFF_CODEC_BZIP2)
+			bz_pump(w,BZ_FINISH);
+		else if(w->rawlen>0)
+			lz4_flush(w,w->raw,w->rawlen);
+	} catch(...) {
+		bs_writer_discard(w);
+		throw;
+	};
+
+	bs_writer_discard(w);
+}
+
+void bs_writer_discard(bs_writer *w)
+{
+	if(w->codec==BSDIFF_CODEC_BZIP2)
+		BZ2_bzCompressEnd(&w->strm);
+
+	free(w->raw);
+	free(w->out);
+	free(w->table);
+	free(w);
+}
+
+struct bs_reader {
+	BSDIFF_CODEC codec;
+	const u_char *in;
+	off_t inlen;
+
+	/* bzip2 */
+	bz_stream strm;
+	bool eos;
+
+	/* LZ4: the current frame, decoded into blk */
+	u_char *blk;
+	off_t curlen,curpos;
+};
+
+bs_reader *bs_reader_open(BSDIFF_CODEC codec,const u_char *in,off_t inlen)
+{
+	bs_reader *r;
+
+	if((codec!=BSDIFF_CODEC_BZIP2) && (codec!=BSDIFF_CODEC_LZ4))
+		bs_fail(BSDIFF_ERR_CORRUPT);
+	if((r=(bs_reader*)calloc(1,sizeof(bs_reader)))==NULL)
+		bs_fail(BSDIFF_ERR_MEMORY);
+	r->codec=codec;
+	r->in=in;
+	r->inlen=inlen;
+
+	if(codec==BSDIFF_CODEC_BZIP2) {
+		if(BZ2_bzDecompressInit(&r->strm,0,0)!=BZ_OK) {
+			free(r);
+			bs_fail(BSDIFF_ERR_MEMORY);
+		};
+	} else if((r->blk=(u_char*)malloc(BS_LZ4_BLOCK))==NULL) {
+		free(r);
+		bs_fail(BSDIFF_ERR_MEMORY);
+	};
+
+	return r;
+}
+
+/* One step of the decoder; only returns 0 at the end of the stream */
+static off_t bz_some(bs_reader *r,u_char *buf,off_t len)
+{
+	unsigned int n,got;
+	int bz2err;
+
+	if((r->strm.avail_in==0) && (r->inlen>0)) {
+		n=(r->inlen>(1<<30)) ? (1<<30) : (unsigned int)r->inlen;
+		r->strm.next_in=(char*)r->in;
+		r->strm.avail_in=n;
+		r->in+=n;
+		r->inlen-=n;
+	};
+
+	n=(len>(1<<30)) ? (1<<30) : (unsigned int)len;
+	r->strm.next_out=(char*)buf;
+	r->strm.avail_out=n;
+	bz2err=BZ2_bzDecompress(&r->strm);
+	got=n-r->strm.avail_out;
+	if(bz2err==BZ_STREAM_END)
+		r->eos=true;
+	else if((bz2err!=BZ_OK) ||
+		((got==0) && (r->strm.avail_in==0) && (r->inlen==0)))
+		bs_fail(BSDIFF_ERR_CORRUPT);
+
+	return got;
+}
+
+static void bz_read(bs_reader *r,u_char *buf,off_t len)
+{
+	off_t got;
+
+	while(len>0) {
+		if(r->eos)
+			bs_fail(BSDIFF_ERR_CORRUPT);
+		got=bz_some(r,buf,len);
+		buf+=got;
+		len-=got;
+	};
+}
+
+/* Decodes the next frame into dst, which has room for a whole one */
+static off_t lz4_frame(bs_reader *r,u_char *dst)
+{
+	uint32_t rawlen,stored;
+	off_t n;
+
+	if(r->inlen<8)
+		bs_fail(BSDIFF_ERR_CORRUPT);
+	rawlen=le32in(r->in);
+	stored=le32in(r->in+4);
+	n=stored&~BS_LZ4_STORED;
+	if((rawlen==0) || (rawlen>BS_LZ4_BLOCK) || (n>r->inlen-8) ||
+		((stored&BS_LZ4_STORED) && (n!=rawlen)))
+		bs_fail(BSDIFF_ERR_CORRUPT);
+
+	if(stored&BS_LZ4_STORED)
+		memcpy(dst,r->in+8,n);
+	else if(lz4_decompress(r->in+8,n,dst,rawlen)!=rawlen)
+		bs_fail(BSDIFF_ERR_CORRUPT);
+
+	r->in+=8+n;
+	r->inlen-=8+n;
+	return rawlen;
+}
+
+static void lz4_read(bs_reader *r,u_char *buf,off_t len)
+{
+	off_t m;
+
+	while(len>0) {
+		if(r->curpos==r->curlen) {
+			/* Frames wholly wanted are decoded in place */
+			if((r->inlen>=8) && ((off_t)le32in(r->in)<=len)) {
+				m=lz4_frame(r,buf);
+				buf+=m;
+				len-=m;
+				continue;
+			};
+			r->curlen=lz4_frame(r,r->blk);
+			r->curpos=0;
+		};
+
+		m=r->curlen-r->curpos;
+		if(m>len) m=len;
+		memcpy(buf,r->blk+r->curpos,m);
+		r->curpos+=m;
+		buf+=m;
+		len-=m;
+	};
+}
+
+void bs_reader_read(bs_reader *r,u_char *buf,off_t len)
+{
+	if(r->codec==BSDIFF_CODEC_BZIP2)
+		bz_read(r,buf,len);
+	else
+		lz4_read(r,buf,len);
+}
+
+off_t bs_reader_readsome(bs_reader *r,u_char *buf,off_t len)
+{
+	off_t got;
+
+	if(r->codec==BSDIFF_CODEC_BZIP2) {
+		for(got=0;(got==0) && (len>0) && !r->eos;)
+			got=bz_some(r,buf,len);
+		return got;
+	};
+
+	if((r->curpos==r->curlen) && (len>0)) {
+		if(r->inlen==0)
+			return 0;
+		r->curlen=lz4_frame(r,r->blk);
+		r->curpos=0;
+	};
+	got=r->curlen-r->curpos;
+	if(got>len) got=len;
+	memcpy(buf,r->blk+r->curpos,got);
+	r->curpos+=got;
+	return got;
+}
+
+void bs_reader_close(bs_reader *r)
+{
+	if(r==NULL)
+		return;
+	if(r->codec==BSDIFF_CODEC_BZIP2)
+		BZ2_bzDecompressEnd(&r->strm);
+	free(r->blk);
+	free(r);
+}
@@ -30,9 +30,13 @@ __FBSDID("$FreeBSD: src/usr.bin/bsdiff/bsdiff/bsdiff.c,v 1.1 2005/08/06 01:59:05
 
 #include <sys/types.h>
 
-#include <bzlib.h>
+#include "Thread.h"
+#include "MappedFile.h"
+#include "bscodec.h"
+#include "bserror.h"
+#include "bskernels.h"
+#include "md5.hpp"
 #ifndef _WIN32
-#include <err.h>
 #include <unistd.h>
 #else
 // KevinJ - Windows compatibility
@@ -48,19 +52,17 @@ typedef long off_t;
 #define close _close
 #define read _read
 #define lseek _lseek
-static void err(int i, ...)
-{
-	exit(i);
-}
-static void errx(int i, ...)
-{
-	exit(i);
-}
 #endif
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include <string>
+
+#include "bsdiff.h"
 
 #ifndef MIN
 #define MIN(x,y) (((x)<(y)) ? (x) : (y))
@@ -73,9 +75,43 @@ static void errx(int i, ...)
 #define O_BINARY _O_BINARY 
 #endif
 
-static void split(off_t *I,off_t *V,off_t start,off_t len,off_t h)
+/* The largest old file whose suffixes can be indexed with 32-bit integers;
+   the sort routines need the sign bit and one extra slot for the empty
+   suffix. */
+#define BSDIFF_MAX32 ((off_t)INT32_MAX-1)
+
+/* The smallest slice of the new file worth a segment of its own */
+#define BSDIFF_MINSEG ((off_t)1<<16)
+
+/* The shortest known common prefix search() bothers to skip over; the
+   skip is exact, the patch is the same whatever the bound */
+#ifndef BSDIFF_LCPMIN
+#define BSDIFF_LCPMIN 64
+#endif
+
+/* How many new bytes the scan goes through between progress reports */
+#define BSDIFF_TICK ((off_t)1<<20)
+
+/* High-water bookkeeping of the buffers whose size depends on the input */
+struct memtrack {
+	size_t cur,peak;
+};
+
+static void mt_add(memtrack *mt,size_t n)
 {
-	off_t i,j,k,x,tmp,jj,kk;
+	mt->cur+=n;
+	if(mt->cur>mt->peak) mt->peak=mt->cur;
+}
+
+static void mt_sub(memtrack *mt,size_t n)
+{
+	mt->cur-=n;
+}
+
+template<class T>
+static void split(T *I,T *V,T start,T len,T h)
+{
+	T i,j,k,x,tmp,jj,kk;
 
 	if(len<16) {
 		for(k=start;k<start+len;k+=j) {
@@ -134,10 +170,11 @@ static void split(off_t *I,off_t *V,off_t start,off_t len,off_t h)
 	if(start+len>kk) split(I,V,kk,start+len-kk,h);
 }
 
-static void qsufsort(off_t *I,off_t *V,u_char *old,off_t oldsize)
+template<class T>
+static void qsufsort(T *I,T *V,u_char *old,off_t oldsize,bs_progress *pr)
 {
-	off_t buckets[256];
-	off_t i,h,len;
+	T buckets[256];
+	T i,h,len;
 
 	//for(i=0;i<256;i++) buckets[i]=0;
 	memset(buckets, 0, sizeof(buckets));
@@ -154,6 +191,7 @@ static void qsufsort(off_t *I,off_t *V,u_char *old,off_t oldsize)
 	I[0]=-1;
 
 	for(h=1;I[0]!=-(oldsize+1);h+=h) {
+		bs_advance(pr,0);
 		len=0;
 		for(i=0;i<oldsize+1;) {
 			if(I[i]<0) {
@@ -173,39 +211,358 @@ static void qsufsort(off_t *I,off_t *V,u_char *old,off_t oldsize)
 	for(i=0;i<oldsize+1;i++) I[V[i]]=i;
 }
 
-static off_t matchlen(u_char *old,off_t oldsize,u_char *_new,off_t newsize)
+/*
+ * Induced sorting suffix array construction (SA-IS) after Nong, Zhang and
+ * Chan, "Two Efficient Algorithms for Linear Time Suffix Array
+ * Construction". It produces the very same I[] as qsufsort() -- including
+ * I[0]==oldsize for the empty suffix -- without needing the V[] array.
+ *
+ * The old file is read through sais_bytes, which appends a virtual sentinel
+ * that is smaller than any byte, so no copy of the input is ever made.
+ * Reduced strings of the recursion are stored in the tail of I[] itself.
+ */
+struct sais_bytes {
+	const u_char *s;
+	off_t n;
+	off_t operator[](off_t i) const { return (i==n) ? 0 : (off_t)s[i]+1; }
+};
+
+template<class T>
+struct sais_ints {
+	const T *s;
+	off_t operator[](off_t i) const { return s[i]; }
+};
+
+static const u_char sais_mask[8]={0x80,0x40,0x20,0x10,0x08,0x04,0x02,0x01};
+#define tget(i) ((t[(i)/8]&sais_mask[(i)%8]) ? 1 : 0)
+#define tset(i,b) t[(i)/8]=(b) ? (sais_mask[(i)%8]|t[(i)/8]) : \
+	((~sais_mask[(i)%8])&t[(i)/8])
+#define isLMS(i) ((i)>0 && tget(i) && !tget((i)-1))
+
+template<class T,class S>
+static void sais_buckets(const S &s,T *bkt,T n,T K,bool end)
 {
-	off_t i;
+	T i,sum=0;
 
-	for(i=0;(i<oldsize)&&(i<newsize);i++)
-		if(old[i]!=_new[i]) break;
+	for(i=0;i<=K;i++) bkt[i]=0;
+	for(i=0;i<n;i++) bkt[s[i]]++;
+	for(i=0;i<=K;i++) { sum+=bkt[i]; bkt[i]=end ? sum : sum-bkt[i]; };
+}
 
-	return i;
+template<class T,class S>
+static void sais_induce(const u_char *t,T *SA,const S &s,T *bkt,T n,T K)
+{
+	T i,j;
+
+	/* L-type suffixes, scanning left to right from the bucket heads */
+	sais_buckets(s,bkt,n,K,false);
+	for(i=0;i<n;i++) {
+		j=SA[i]-1;
+		if(j>=0 && !tget(j)) SA[bkt[s[j]]++]=j;
+	};
+
+	/* S-type suffixes, scanning right to left from the bucket tails */
+	sais_buckets(s,bkt,n,K,true);
+	for(i=n-1;i>=0;i--) {
+		j=SA[i]-1;
+		if(j>=0 && tget(j)) SA[--bkt[s[j]]]=j;
+	};
 }
 
-static off_t search(off_t *I,u_char *old,off_t oldsize,
-		u_char *_new,off_t newsize,off_t st,off_t en,off_t *pos)
+template<class T,class S>
+static void sais(const S &s,T *SA,T n,T K,memtrack *mt)
+{
+	T i,j,d,n1,name,prev,pos;
+	T *bkt,*s1;
+	u_char *t;
+	bool diff;
+
+	if((t=(u_char*)calloc(n/8+1,1))==NULL)
+		bs_fail(BSDIFF_ERR_MEMORY);
+	if((bkt=(T*)malloc((K+1)*sizeof(T)))==NULL) {
+		free(t);
+		bs_fail(BSDIFF_ERR_MEMORY);
+	};
+	mt_add(mt,n/8+1+(K+1)*sizeof(T));
+
+	/* Classify the suffixes as S (1) or L (0); the sentinel is S */
+	tset(n-1,1);
+	if(n>1) tset(n-2,0);
+	for(i=n-3;i>=0;i--)
+		tset(i,((s[i]<s[i+1]) || ((s[i]==s[i+1]) && tget(i+1))) ? 1 : 0);
+
+	/* Stage 1: sort the LMS substrings */
+	sais_buckets(s,bkt,n,K,true);
+	for(i=0;i<n;i++) SA[i]=-1;
+	for(i=1;i<n;i++) if(isLMS(i)) SA[--bkt[s[i]]]=i;
+	sais_induce(t,SA,s,bkt,n,K);
+
+	/* Compact the sorted LMS substrings into the first n1 slots */
+	n1=0;
+	for(i=0;i<n;i++) if(isLMS(SA[i])) SA[n1++]=SA[i];
+
+	/* Name them; equal substrings share a name */
+	for(i=n1;i<n;i++) SA[i]=-1;
+	name=0;prev=-1;
+	for(i=0;i<n1;i++) {
+		pos=SA[i];diff=false;
+		for(d=0;d<n;d++) {
+			if((prev==-1) || (s[pos+d]!=s[prev+d]) ||
+				(tget(pos+d)!=tget(prev+d))) {
+				diff=true;
+				break;
+			} else if((d>0) && (isLMS(pos+d) || isLMS(prev+d))) break;
+		};
+		if(diff) { name++; prev=pos; };
+		SA[n1+pos/2]=name-1;
+	};
+	for(i=n-1,j=n-1;i>=n1;i--) if(SA[i]>=0) SA[j--]=SA[i];
+
+	/* Stage 2: sort the reduced string, recursing if names are not unique */
+	s1=SA+n-n1;
+	if(name<n1) {
+		sais_ints<T> r={s1};
+		free(bkt);
+		mt_sub(mt,(K+1)*sizeof(T));
+		try {
+			sais(r,SA,n1,(T)(name-1),mt);
+		} catch(...) {
+			free(t);
+			throw;
+		};
+		if((bkt=(T*)malloc((K+1)*sizeof(T)))==NULL) {
+			free(t);
+			bs_fail(BSDIFF_ERR_MEMORY);
+		};
+		mt_add(mt,(K+1)*sizeof(T));
+	} else {
+		for(i=0;i<n1;i++) SA[s1[i]]=i;
+	};
+
+	/* Stage 3: induce the full suffix array from the sorted LMS suffixes */
+	for(i=1,j=0;i<n;i++) if(isLMS(i)) s1[j++]=i;
+	for(i=0;i<n1;i++) SA[i]=s1[SA[i]];
+	for(i=n1;i<n;i++) SA[i]=-1;
+	sais_buckets(s,bkt,n,K,true);
+	for(i=n1-1;i>=0;i--) {
+		j=SA[i];SA[i]=-1;
+		SA[--bkt[s[j]]]=j;
+	};
+	sais_induce(t,SA,s,bkt,n,K);
+
+	free(bkt);
+	free(t);
+	mt_sub(mt,n/8+1+(K+1)*sizeof(T));
+}
+
+#undef tget
+#undef tset
+#undef isLMS
+
+template<class T>
+static void saisufsort(T *I,u_char *old,off_t oldsize,memtrack *mt)
 {
-	off_t x,y;
+	sais_bytes s={old,oldsize};
 
-	if(en-st<2) {
-		x=matchlen(old+I[st],oldsize-I[st],_new,newsize);
-		y=matchlen(old+I[en],oldsize-I[en],_new,newsize);
+	if(oldsize==0) { I[0]=0; return; };
 
-		if(x>y) {
-			*pos=I[st];
-			return x;
+	/* oldsize+1 suffixes over an alphabet of 256 bytes plus the sentinel */
+	sais(s,I,(T)(oldsize+1),(T)256,mt);
+}
+
+/*
+ * Parallel prefix doubling. The suffixes are bucketed by their leading two
+ * bytes, then every round sorts each group that is still ambiguous by the
+ * rank of the suffix h bytes further on, doubling h until all groups are
+ * singletons. Ranks follow the qsufsort() convention (the index of the last
+ * member of the group in I[]). Within a round ranks are only read while the
+ * groups are being sorted and only written once every worker is done, so
+ * the groups can be spread over any number of threads; the suffix array
+ * being unique, I[] comes out the same for every thread count.
+ */
+template<class T>
+struct psort_key {
+	T key,idx;
+	bool operator<(const psort_key &rhs) const { return key<rhs.key; }
+};
+
+template<class T>
+struct psort_group {
+	T start,len;
+};
+
+template<class T>
+struct psort_ctx {
+	T *I,*V;
+	psort_key<T> *P;
+	T h;
+	std::vector<psort_group<T> > groups;
+	/* groups [first[w],first[w+1]) are handled by worker w */
+	std::vector<size_t> first;
+	std::vector<std::vector<psort_group<T> > > next;
+};
+
+/* Sorts the groups of worker w by the rank h bytes further on */
+template<class T>
+static void psort_sort(void *data,int w)
+{
+	psort_ctx<T> *c=(psort_ctx<T>*)data;
+	T *I=c->I,*V=c->V;
+	psort_key<T> *P=c->P;
+	T j,k,end;
+	size_t g;
+
+	c->next[w].clear();
+	for(g=c->first[w];g<c->first[w+1];g++) {
+		end=c->groups[g].start+c->groups[g].len;
+		for(k=c->groups[g].start;k<end;k++) {
+			P[k].key=V[I[k]+c->h];
+			P[k].idx=I[k];
+		};
+		std::sort(P+c->groups[g].start,P+end);
+		for(k=c->groups[g].start;k<end;k++) I[k]=P[k].idx;
+
+		/* runs of equal keys stay ambiguous */
+		for(k=c->groups[g].start;k<end;k=j) {
+			for(j=k+1;(j<end) && (P[j].key==P[k].key);j++);
+			if(j-k>1) {
+				psort_group<T> r={k,j-k};
+				c->next[w].push_back(r);
+			};
+		};
+	};
+}
+
+/* Publishes the refined ranks of the groups of worker w */
+template<class T>
+static void psort_rank(void *data,int w)
+{
+	psort_ctx<T> *c=(psort_ctx<T>*)data;
+	T j,k,end;
+	size_t g;
+
+	for(g=c->first[w];g<c->first[w+1];g++) {
+		end=c->groups[g].start+c->groups[g].len;
+		for(k=c->groups[g].start;k<end;k=j) {
+			for(j=k+1;(j<end) && (c->P[j].key==c->P[k].key);j++);
+			for(;k<j;k++) c->V[c->I[k]]=j-1;
+		};
+	};
+}
+
+template<class T>
+static void psufsort(T *I,T *V,u_char *old,off_t oldsize,int threads,
+		memtrack *mt,bs_progress *pr)
+{
+	psort_ctx<T> c;
+	std::vector<T> buckets(256*257+1,0);
+	size_t g,total,share,acc;
+	T i,b;
+	int w;
+
+	/* Bucket the suffixes by their first two bytes, the end of the
+	   file sorting before any byte */
+	for(i=0;i<oldsize;i++)
+		buckets[old[i]*257+((i+1<oldsize) ? old[i+1]+1 : 0)+1]++;
+	for(b=1;b<(T)buckets.size();b++) buckets[b]+=buckets[b-1];
+
+	I[0]=oldsize;
+	V[oldsize]=0;
+	for(i=0;i<oldsize;i++) {
+		b=old[i]*257+((i+1<oldsize) ? old[i+1]+1 : 0);
+		I[1+buckets[b]++]=i;
+	};
+	for(b=buckets.size()-1;b>0;b--) buckets[b]=buckets[b-1];
+	buckets[0]=0;
+	for(b=0;b+1<(T)buckets.size();b++) {
+		if(buckets[b+1]==buckets[b]) continue;
+		for(i=buckets[b];i<buckets[b+1];i++) V[I[1+i]]=buckets[b+1];
+		if(buckets[b+1]-buckets[b]>1) {
+			psort_group<T> r={1+buckets[b],buckets[b+1]-buckets[b]};
+			c.groups.push_back(r);
+		};
+	};
+
+	if((c.P=(psort_key<T>*)malloc((oldsize+1)*sizeof(psort_key<T>)))==NULL)
+		bs_fail(BSDIFF_ERR_MEMORY);
+	mt_add(mt,(oldsize+1)*sizeof(psort_key<T>));
+
+	c.I=I;
+	c.V=V;
+	try {
+		c.next.resize(threads);
+		c.first.resize(threads+1);
+		for(c.h=2;!c.groups.empty();c.h+=c.h) {
+			bs_advance(pr,0);
+
+			/* Hand out the groups in contiguous runs of similar total size */
+			for(g=0,total=0;g<c.groups.size();g++) total+=c.groups[g].len;
+			share=total/threads+1;
+			c.first[0]=0;
+			for(w=1,g=0,acc=0;w<threads;w++) {
+				for(;(g<c.groups.size()) && (acc<share*w);g++)
+					acc+=c.groups[g].len;
+				c.first[w]=g;
+			};
+			c.first[threads]=c.groups.size();
+
+			bs_runall(threads,&psort_sort<T>,&c);
+			bs_runall(threads,&psort_rank<T>,&c);
+
+			c.groups.clear();
+			for(w=0;w<threads;w++)
+				c.groups.insert(c.groups.end(),c.next[w].begin(),c.next[w].end());
+		};
+	} catch(...) {
+		free(c.P);
+		throw;
+	};
+
+	free(c.P);
+	mt_sub(mt,(oldsize+1)*sizeof(psort_key<T>));
+}
+
+/*
+ * Binary search of _new in the suffix array. lo and hi are the lengths by
+ * which the suffixes at st and en match _new; every suffix sorted between
+ * the two shares at least the shorter of those prefixes with _new, so
+ * each probe resumes its comparison at that offset instead of byte 0.
+ *
+ * Probes are bound by cache misses more than by the comparison itself:
+ * the start of the suffix is prefetched as soon as its index is known,
+ * and short prefixes, which that line covers anyway, are compared again
+ * rather than making the load wait for the previous probe's result.
+ */
+template<class T>
+static off_t search(const T *I,u_char *old,off_t oldsize,
+		u_char *_new,off_t newsize,off_t st,off_t en,off_t *pos)
+{
+	off_t x,y,k,n,lo,hi;
+
+	lo=0;hi=0;
+	while(en-st>=2) {
+		x=st+(en-st)/2;
+		BS_PREFETCH(old+I[x]);
+		k=MIN(lo,hi);
+		if(k<BSDIFF_LCPMIN) k=0;
+		n=MIN(oldsize-I[x],newsize);
+		k+=bs_matchlen(old+I[x]+k,_new+k,n-k);
+		if((k<n) && (old[I[x]+k]<_new[k])) {
+			st=x;lo=k;
 		} else {
-			*pos=I[en];
-			return y;
-		}
+			en=x;hi=k;
+		};
 	};
 
-	x=st+(en-st)/2;
-	if(memcmp(old+I[x],_new,MIN(oldsize-I[x],newsize))<0) {
-		return search(I,old,oldsize,_new,newsize,x,en,pos);
+	x=lo+bs_matchlen(old+I[st]+lo,_new+lo,MIN(oldsize-I[st],newsize)-lo);
+	y=hi+bs_matchlen(old+I[en]+hi,_new+hi,MIN(oldsize-I[en],newsize)-hi);
+
+	if(x>y) {
+		*pos=I[st];
+		return x;
 	} else {
-		return search(I,old,oldsize,_new,newsize,st,x,pos);
+		*pos=I[en];
+		return y;
 	};
 }
 
@@ -239,98 +596,123 @@ static void offtout(off_t x,u_char *buf)
 	if(x<0) buf[7]|=0x80;
 }
 
-//int DIFF_main(int argc,char *argv[])
-int bsdiff(const char* inold, const char* innew, const char* indest)
+/* Allocates and fills the suffix array of old with the requested engine.
+   V[] is only needed by qsufsort() and is released before returning, that
+   is before the new file gets loaded. Counts oldsize units of progress. */
+template<class T>
+static T *sufsort(u_char *old,off_t oldsize,BSDIFF_SORT sort,int threads,
+		memtrack *mt,bs_progress *pr)
 {
-	int fd;
-	u_char *old,*_new;
-	off_t oldsize,newsize;
-	off_t *I,*V;
-	off_t scan,pos,len;
+	T *I,*V=NULL;
+	size_t len=(oldsize+1)*sizeof(T);
+
+	if((sort!=BSDIFF_SORT_QSUFSORT) && (sort!=BSDIFF_SORT_SAIS) &&
+		(sort!=BSDIFF_SORT_PARALLEL))
+		bs_fail(BSDIFF_ERR_ARGUMENT);
+	if((I=(T*)malloc(len))==NULL) bs_fail(BSDIFF_ERR_MEMORY);
+	mt_add(mt,len);
+
+	try {
+		if(sort!=BSDIFF_SORT_SAIS) {
+			if((V=(T*)malloc(len))==NULL) bs_fail(BSDIFF_ERR_MEMORY);
+			mt_add(mt,len);
+			if(sort==BSDIFF_SORT_PARALLEL)
+				psufsort(I,V,old,oldsize,threads,mt,pr);
+			else
+				qsufsort(I,V,old,oldsize,pr);
+			free(V);
+			mt_sub(mt,len);
+		} else {
+			saisufsort(I,old,oldsize,mt);
+		};
+		bs_advance(pr,oldsize);
+	} catch(...) {
+		free(V);
+		free(I);
+		throw;
+	};
+
+	return I;
+}
+
+/* The diff and extra blocks of a patch. db is written in place over _new:
+   dblen+eblen==lastscan holds after every step of the scan, and the scan
+   never looks at _new below lastscan again. eb grows on demand. */
+struct diffbuf {
+	u_char *db,*eb;
+	off_t dblen,eblen,ebcap;
+};
+
+static void eb_reserve(diffbuf *d,off_t len,off_t newsize,memtrack *mt)
+{
+	off_t cap;
+	u_char *eb;
+
+	if((d->eb!=NULL) && (d->eblen+len<=d->ebcap)) return;
+
+	for(cap=(d->ebcap<4096) ? 4096 : d->ebcap;cap<d->eblen+len;cap+=cap);
+	if(cap>newsize+1) cap=newsize+1;
+
+	if((eb=(u_char*)realloc(d->eb,cap))==NULL) bs_fail(BSDIFF_ERR_MEMORY);
+	mt_add(mt,cap-d->ebcap);
+	d->eb=eb;
+	d->ebcap=cap;
+}
+
+/* A run of bytes the pre-pass found in both files: the len bytes of the
+   new file at nstart are those of old at ostart, see runs_find() */
+struct diffrun {
+	off_t nstart,ostart,len;
+};
+
+/* Compute the differences, collecting the ctrl triples as we go; counts
+   newsize units of progress. _new starts at base in the new file the
+   runs, if any, refer to: inside a run the match it makes is taken as
+   is instead of being searched for, and without I nothing else is. */
+template<class T>
+static void diff(const T *I,u_char *old,off_t oldsize,
+		u_char *_new,off_t newsize,diffbuf *d,std::vector<off_t> *ctrl,
+		const std::vector<diffrun> *runs,off_t base,
+		memtrack *mt,bs_progress *pr)
+{
+	const diffrun *rn=NULL,*rend=NULL;
+	off_t scan,pos,len,tick;
 	off_t lastscan,lastpos,lastoffset;
 	off_t oldscore,scsc;
 	off_t s,Sf,lenf,Sb,lenb;
 	off_t overlap,Ss,lens;
-	off_t i;
-	off_t dblen,eblen;
-	u_char *db,*eb;
-	u_char buf[8];
-	u_char header[32];
-	FILE * pf;
-	BZFILE * pfbz2;
-	int bz2err;
-
-	int bytesWritten=0;
-
-	//if(argc!=4) errx(1,"usage: %s oldfile newfile patchfile\n",argv[0]);
-
-	/* Allocate oldsize+1 bytes instead of oldsize bytes to ensure
-	that we never try to malloc(0) and get a NULL pointer */
-	if(((fd=open(inold,O_RDONLY|O_BINARY,0))<0) ||
-		((oldsize=lseek(fd,0,SEEK_END))==-1) ||
-		((old=(u_char*)malloc(oldsize+1))==NULL) ||
-		(lseek(fd,0,SEEK_SET)!=0) ||
-		(read(fd,old,oldsize)!=oldsize) ||
-		(close(fd)==-1)) err(1,"%s",inold);
-
-	if(((I=(off_t*)malloc((oldsize+1)*sizeof(off_t)))==NULL) ||
-		((V=(off_t*)malloc((oldsize+1)*sizeof(off_t)))==NULL)) err(1,NULL);
-
-	qsufsort(I,V,old,oldsize);
-
-	free(V);
-
-	/* Allocate newsize+1 bytes instead of newsize bytes to ensure
-	that we never try to malloc(0) and get a NULL pointer */
-	if(((fd=open(innew,O_RDONLY|O_BINARY,0))<0) ||
-		((newsize=lseek(fd,0,SEEK_END))==-1) ||
-		((_new=(u_char*)malloc(newsize+1))==NULL) ||
-		(lseek(fd,0,SEEK_SET)!=0) ||
-		(read(fd,_new,newsize)!=newsize) ||
-		(close(fd)==-1)) err(1,"%s",innew);
-
-	if(((db=(u_char*)malloc(newsize+1))==NULL) ||
-		((eb=(u_char*)malloc(newsize+1))==NULL)) err(1,NULL);
-	dblen=0;
-	eblen=0;
-
-	/* Create the patch file */
-	if ((pf = fopen(indest, "wb")) == NULL)
-		err(1, "%s", indest);
-
-	/* Header is
-	0	8	 "BSDIFF40"
-	8	8	length of bzip2ed ctrl block
-	16	8	length of bzip2ed diff block
-	24	8	length of new file */
-	/* File is
-	0	32	Header
-	32	??	Bzip2ed ctrl block
-	??	??	Bzip2ed diff block
-	??	??	Bzip2ed extra block */
-	memcpy(header,"BSDIFF40",8);
-	offtout(0, header + 8);
-	offtout(0, header + 16);
-	offtout(newsize, header + 24);
-	if (fwrite(header, 32, 1, pf) != 1)
-		err(1, "fwrite(%s)", indest);
-
-	/* Compute the differences, writing ctrl as we go */
-	if ((pfbz2 = BZ2_bzWriteOpen(&bz2err, pf, 9, 0, 0)) == NULL)
-		errx(1, "BZ2_bzWriteOpen, bz2err = %d", bz2err);
-	scan=0;len=0;
+	off_t i,n,m;
+
+	if((runs!=NULL) && !runs->empty()) {
+		rn=&(*runs)[0];
+		rend=rn+runs->size();
+	};
+
+	scan=0;len=0;pos=0;tick=0;
 	lastscan=0;lastpos=0;lastoffset=0;
 	while(scan<newsize) {
+		if(scan-tick>=BSDIFF_TICK) {
+			bs_advance(pr,scan-tick);
+			tick=scan;
+		};
 		oldscore=0;
 
 		for(scsc=scan+=len;scan<newsize;scan++) {
-			len=search(I,old,oldsize,_new+scan,newsize-scan,
-				0,oldsize,&pos);
+			while((rn<rend) && (rn->nstart+rn->len<=base+scan)) rn++;
+			if((rn<rend) && (rn->nstart<=base+scan)) {
+				pos=rn->ostart+(base+scan-rn->nstart);
+				len=MIN(rn->nstart+rn->len-base,newsize)-scan;
+			} else if(I!=NULL)
+				len=search(I,old,oldsize,_new+scan,newsize-scan,
+					0,oldsize,&pos);
+			else
+				len=0;
 
-			for(;scsc<scan+len;scsc++)
-				if((scsc+lastoffset<oldsize) &&
-					(old[scsc+lastoffset] == _new[scsc]))
-					oldscore++;
+			n=MIN(scan+len,oldsize-lastoffset);
+			if(n>scsc)
+				oldscore+=bs_matchcount(old+scsc+lastoffset,
+					_new+scsc,n-scsc);
+			if(scsc<scan+len) scsc=scan+len;
 
 			if(((len==oldscore) && (len!=0)) || 
 				(len>oldscore+8)) break;
@@ -341,19 +723,30 @@ int bsdiff(const char* inold, const char* innew, const char* indest)
 		};
 
 		if((len!=oldscore) || (scan==newsize)) {
+			/*
+			 * The extension scores rise by one per matching byte and
+			 * fall by one per mismatch, so a new best can only be
+			 * reached at the end of a run of matches: step over whole
+			 * runs and test the score there only.
+			 */
 			s=0;Sf=0;lenf=0;
-			for(i=0;(lastscan+i<scan)&&(lastpos+i<oldsize);) {
-				if(old[lastpos+i]==_new[lastscan+i]) s++;
-				i++;
+			n=MIN(scan-lastscan,oldsize-lastpos);
+			for(i=0;i<n;) {
+				m=bs_matchlen(old+lastpos+i,_new+lastscan+i,n-i);
+				s+=m;i+=m;
 				if(s*2-i>Sf*2-lenf) { Sf=s; lenf=i; };
+				i+=bs_mismatchlen(old+lastpos+i,_new+lastscan+i,n-i);
 			};
 
 			lenb=0;
 			if(scan<newsize) {
 				s=0;Sb=0;
-				for(i=1;(scan>=lastscan+i)&&(pos>=i);i++) {
-					if(old[pos-i]==_new[scan-i]) s++;
+				n=MIN(scan-lastscan,pos);
+				for(i=0;i<n;) {
+					m=bs_rmatchlen(old+pos-i,_new+scan-i,n-i);
+					s+=m;i+=m;
 					if(s*2-i>Sb*2-lenb) { Sb=s; lenb=i; };
+					i+=bs_rmismatchlen(old+pos-i,_new+scan-i,n-i);
 				};
 			};
 
@@ -372,96 +765,1107 @@ int bsdiff(const char* inold, const char* innew, const char* indest)
 				lenb-=lens;
 			};
 
+			eb_reserve(d,(scan-lenb)-(lastscan+lenf),newsize,mt);
 			for(i=0;i<lenf;i++)
-				db[dblen+i]=_new[lastscan+i]-old[lastpos+i];
+				d->db[d->dblen+i]=_new[lastscan+i]-old[lastpos+i];
 			for(i=0;i<(scan-lenb)-(lastscan+lenf);i++)
-				eb[eblen+i]=_new[lastscan+lenf+i];
-
-			dblen+=lenf;
-			eblen+=(scan-lenb)-(lastscan+lenf);
-
-			offtout(lenf,buf);
-			BZ2_bzWrite(&bz2err, pfbz2, buf, 8);
-			if (bz2err != BZ_OK)
-				errx(1, "BZ2_bzWrite, bz2err = %d", bz2err);
-			bytesWritten+=8;
-		//	printf("bz2err 8 %i\n", bytesWritten);
-
-			offtout((scan-lenb)-(lastscan+lenf),buf);
-			BZ2_bzWrite(&bz2err, pfbz2, buf, 8);
-			if (bz2err != BZ_OK)
-				errx(1, "BZ2_bzWrite, bz2err = %d", bz2err);
-			bytesWritten+=8;
-		//	printf("bz2err 8 %i\n", bytesWritten);
-
-			offtout((pos-lenb)-(lastpos+lenf),buf);
-			BZ2_bzWrite(&bz2err, pfbz2, buf, 8);
-			if (bz2err != BZ_OK)
-				errx(1, "BZ2_bzWrite, bz2err = %d", bz2err);
-			bytesWritten+=8;
-		//	printf("bz2err 8 %i\n", bytesWritten);
+				d->eb[d->eblen+i]=_new[lastscan+lenf+i];
+
+			d->dblen+=lenf;
+			d->eblen+=(scan-lenb)-(lastscan+lenf);
+
+			ctrl->push_back(lenf);
+			ctrl->push_back((scan-lenb)-(lastscan+lenf));
+			ctrl->push_back((pos-lenb)-(lastpos+lenf));
 
 			lastscan=scan-lenb;
 			lastpos=pos-lenb;
 			lastoffset=pos-scan;
 		};
 	};
-	BZ2_bzWriteClose(&bz2err, pfbz2, 0, NULL, NULL);
-	if (bz2err != BZ_OK)
-		errx(1, "BZ2_bzWriteClose, bz2err = %d", bz2err);
-
-	/* Compute size of compressed ctrl data */
-	if ((len = ftello(pf)) == -1)
-		err(1, "ftello");
-	offtout(len-32, header + 8);
-
-	/* Write compressed diff data */
-	if ((pfbz2 = BZ2_bzWriteOpen(&bz2err, pf, 9, 0, 0)) == NULL)
-		errx(1, "BZ2_bzWriteOpen, bz2err = %d", bz2err);
-	BZ2_bzWrite(&bz2err, pfbz2, db, dblen);
-	bytesWritten+=dblen;
-//	printf("bz2err dblen %i %i\n", dblen, bytesWritten);
-	if (bz2err != BZ_OK)
-		errx(1, "BZ2_bzWrite, bz2err = %d", bz2err);
-	BZ2_bzWriteClose(&bz2err, pfbz2, 0, NULL, NULL);
-	if (bz2err != BZ_OK)
-		errx(1, "BZ2_bzWriteClose, bz2err = %d", bz2err);
-
-	/* Compute size of compressed diff data */
-	if ((newsize = ftello(pf)) == -1)
-		err(1, "ftello");
-	offtout(newsize - len, header + 16);
-
-	/* Write compressed extra data */
-	if ((pfbz2 = BZ2_bzWriteOpen(&bz2err, pf, 9, 0, 0)) == NULL)
-		errx(1, "BZ2_bzWriteOpen, bz2err = %d", bz2err);
-	BZ2_bzWrite(&bz2err, pfbz2, eb, eblen);
-	if (bz2err != BZ_OK)
-		errx(1, "BZ2_bzWrite, bz2err = %d", bz2err);
-	bytesWritten+=eblen;
-	//printf("bz2err eblen %i %i\n", eblen, bytesWritten);
-	BZ2_bzWriteClose(&bz2err, pfbz2, 0, NULL, NULL);
-	if (bz2err != BZ_OK)
-		errx(1, "BZ2_bzWriteClose, bz2err = %d", bz2err);
-
-	// REMOVEME
-//	if ((newsize = ftello(pf)) == -1)
-//		err(1, "ftello");
-
-	/* Seek to the beginning, write the header, and close the file */
-	if (fseeko(pf, 0, SEEK_SET))
-		err(1, "fseeko");
-	if (fwrite(header, 32, 1, pf) != 1)
-		err(1, "fwrite(%s)", indest);
-	if (fclose(pf))
-		err(1, "fclose");
-
-	/* Free the memory we used */
-	free(db);
-	free(eb);
+	bs_advance(pr,newsize-tick);
+}
+
+/*
+ * Segmented scan. The new file is cut into slices which are diffed
+ * independently against the whole old file, each as if it were a file of
+ * its own, and so can be scanned concurrently: a slice only ever reads and
+ * writes (db is still built in place) its own part of _new. The patches
+ * are then stitched by redirecting the final seek of every slice to the
+ * old position the next one assumes at its start, i.e. 0. The result is a
+ * regular BSDIFF40 patch, a few bytes larger than the serial one.
+ */
+struct diffseg {
+	off_t start,len;
+	diffbuf d;
+	std::vector<off_t> ctrl;
+	memtrack mt;
+};
+
+template<class T>
+struct diffjob {
+	const T *I;
+	u_char *old,*_new;
+	off_t oldsize;
+	std::vector<diffseg> *segs;
+	const std::vector<diffrun> *runs;
+	int threads;
+	bs_progress *pr;
+};
+
+template<class T>
+static void diff_worker(void *data,int w)
+{
+	diffjob<T> *j=(diffjob<T>*)data;
+	diffseg *sg;
+	size_t k;
+
+	for(k=w;k<j->segs->size();k+=j->threads) {
+		sg=&(*j->segs)[k];
+		diff(j->I,j->old,j->oldsize,j->_new+sg->start,sg->len,&sg->d,
+			&sg->ctrl,j->runs,sg->start,&sg->mt,j->pr);
+	};
+}
+
+template<class T>
+static void diff_segments(const T *I,u_char *old,off_t oldsize,
+		u_char *_new,std::vector<diffseg> *segs,
+		const std::vector<diffrun> *runs,int threads,memtrack *mt,
+		bs_progress *pr)
+{
+	diffjob<T> j={I,old,_new,oldsize,segs,runs,threads,pr};
+	off_t oldpos;
+	size_t k,i;
+	size_t peak=0,cur=0;
+
+	if(threads>(int)segs->size()) j.threads=threads=segs->size();
+	bs_runall(threads,&diff_worker<T>,&j);
+
+	for(k=0;k<segs->size();k++) {
+		peak+=(*segs)[k].mt.peak;
+		cur+=(*segs)[k].mt.cur;
+
+		if(k+1==segs->size()) break;
+		std::vector<off_t> &ctrl=(*segs)[k].ctrl;
+		for(i=0,oldpos=0;i<ctrl.size();i+=3) oldpos+=ctrl[i]+ctrl[i+2];
+		ctrl[ctrl.size()-1]-=oldpos;
+	};
+	mt_add(mt,peak);
+	mt_sub(mt,peak-cur);
+}
+
+/* Compresses n bytes at p, counting them in progress as they go */
+static void pack_bytes(bs_writer *w,const u_char *p,off_t n,bs_progress *pr)
+{
+	off_t m;
+
+	for(;n>0;p+=m,n-=m) {
+		m=MIN(n,BSDIFF_TICK);
+		bs_writer_write(w,p,m);
+		bs_advance(pr,m);
+	};
+}
+
+/* Feeds block b (0 ctrl, 1 diff, 2 extra) of all the segments to w and
+   closes it */
+static void pack_block(bs_writer *w,const std::vector<diffseg> &segs,int b,
+		bs_progress *pr)
+{
+	u_char buf[8];
+	size_t k,i;
+
+	try {
+		for(k=0;k<segs.size();k++)
+			switch(b) {
+			case 0:
+				for(i=0;i<segs[k].ctrl.size();i++) {
+					offtout(segs[k].ctrl[i],buf);
+					bs_writer_write(w,buf,8);
+				};
+				break;
+			case 1:
+				pack_bytes(w,segs[k].d.db,segs[k].d.dblen,pr);
+				break;
+			default:
+				pack_bytes(w,segs[k].d.eb,segs[k].d.eblen,pr);
+			};
+	} catch(...) {
+		bs_writer_discard(w);
+		throw;
+	};
+
+	bs_writer_close(w);
+}
+
+/*
+ * The blocks are complete in memory once the scan is over, so with more
+ * than one thread they are compressed side by side into buffers and only
+ * then written out, in header order. Each is still a single stream fed
+ * the same bytes, so the patch is the same as the serial one.
+ */
+struct packjob {
+	const std::vector<diffseg> *segs;
+	BSDIFF_CODEC codec;
+	int threads;
+	bs_progress *pr;
+	std::vector<u_char> out[3];
+};
+
+static void pack_worker(void *data,int w)
+{
+	packjob *j=(packjob*)data;
+	int b;
+
+	for(b=w;b<3;b+=j->threads)
+		pack_block(bs_writer_open(j->codec,&j->out[b]),*j->segs,b,j->pr);
+}
+
+/*
+ * Windowed diff, for inputs too large to be indexed whole within
+ * BSDiffOptions::MemoryBudget. The new file is cut into windows of wnew
+ * bytes, each diffed against wold = 2*wnew bytes of the old file, which
+ * are sorted on their own. The old window is placed where most of the
+ * new window's content was seen in the old file, according to an anchor
+ * index holding the rolling hash of every aligned ablk-byte block of the
+ * old file. Both files are memory-mapped, so only the current windows and
+ * the anchors are held on the heap.
+ *
+ * The patch is a series of self-contained windows, which bspatch applies
+ * and writes out one after the other:
+ *	0	8	"BSDIFF4W"
+ *	8	8	length of new file
+ *	16	8	largest number of new bytes in a window
+ *	24	1	codec of all blocks, see BSDIFF_CODEC
+ *	25	7	zero
+ * then for each window
+ *	0	8	old position the window's ctrl block starts from
+ *	8	8	number of new bytes the window produces
+ *	16	8	length of the compressed ctrl block
+ *	24	8	length of the compressed diff block
+ *	32	8	length of the compressed extra block
+ *	40	??	the three blocks
+ */
+#define BSDIFF_WINHDR 40
+
+/* The smallest new window, the budget is raised to fit it if need be */
+#define BSDIFF_MINWIN ((off_t)1<<20)
+
+/* The smallest anchor block, and how often one hash may occur before it
+   is too common to tell anything about where a window belongs */
+#define BSDIFF_MINANCHOR ((off_t)1<<10)
+#define BSDIFF_MAXDUPS 4
+
+/* The block of the pre-pass, see runs_find(), and the share of the new
+   file its runs may leave uncovered for the suffix sort to be skipped */
+#define BSDIFF_RUNBLK ((off_t)64)
+#define BSDIFF_SKIPSORT 128
+
+/* Multiplier of the polynomial rolling hash, mod 2^32 */
+#define BSDIFF_RHMUL 0x01000193u
+
+struct anchor {
+	uint32_t hash;
+	uint32_t blk;
+};
+
+struct anchors {
+	std::vector<anchor> a;		/* sorted by hash */
+	std::vector<uint32_t> first;	/* a[] index of each hash's top bits */
+	int bits;
+	off_t blk;
+	uint32_t pow;			/* BSDIFF_RHMUL^blk */
+};
+
+static bool anchor_less(const anchor &x,const anchor &y)
+{
+	return x.hash<y.hash;
+}
+
+static uint32_t rh_block(const u_char *p,off_t n)
+{
+	uint32_t h=0;
+	off_t i;
+
+	for(i=0;i<n;i++) h=h*BSDIFF_RHMUL+p[i];
+
+	return h;
+}
+
+static void anchors_build(anchors *ax,const u_char *old,off_t oldsize,
+		off_t blk,memtrack *mt)
+{
+	size_t n=(size_t)(oldsize/blk),i,j,k;
+	off_t e;
+
+	ax->blk=blk;
+	for(ax->pow=1,e=0;e<blk;e++) ax->pow*=BSDIFF_RHMUL;
+
+	ax->a.resize(n);
+	for(i=0;i<n;i++) {
+		ax->a[i].hash=rh_block(old+i*blk,blk);
+		ax->a[i].blk=(uint32_t)i;
+	};
+	std::sort(ax->a.begin(),ax->a.end(),anchor_less);
+
+	/* Drop the hashes of blocks repeated all over, e.g. runs of zeros */
+	for(i=0,k=0;i<n;i=j) {
+		for(j=i+1;(j<n) && (ax->a[j].hash==ax->a[i].hash);j++);
+		if(j-i<=BSDIFF_MAXDUPS)
+			for(;i<j;i++) ax->a[k++]=ax->a[i];
+	};
+	ax->a.resize(k);
+
+	/* Some four anchors per bucket keep the table at a quarter of a[] */
+	for(ax->bits=1;(ax->bits<24) && (((size_t)4<<ax->bits)<k);ax->bits++);
+	ax->first.assign(((size_t)1<<ax->bits)+1,0);
+	for(i=0;i<k;i++) ax->first[(ax->a[i].hash>>(32-ax->bits))+1]++;
+	for(i=1;i<ax->first.size();i++) ax->first[i]+=ax->first[i-1];
+
+	mt_add(mt,ax->a.capacity()*sizeof(anchor)+
+		ax->first.size()*sizeof(uint32_t));
+}
+
+/*
+ * Finds where the wold-byte old window for the nlen bytes at nw should
+ * start. Every anchor seen in nw projects the position the window start
+ * would have in the old file; the window goes where it covers most of
+ * them, or proportionally to ns if there are none.
+ */
+static off_t place_window(const anchors *ax,const u_char *old,off_t oldsize,
+		const u_char *nw,off_t ns,off_t nlen,off_t newsize,off_t wold,
+		std::vector<off_t> *v)
+{
+	const off_t blk=ax->blk;
+	const off_t slack=wold-nlen;
+	off_t p,start,best;
+	size_t i,j,b,k,bi,bj;
+	uint32_t h;
+
+	if(oldsize<=wold) return 0;
+
+	v->clear();
+	for(p=0;(p+blk<=nlen) && !ax->a.empty();) {
+		h=rh_block(nw+p,blk);
+		for(;;) {
+			b=h>>(32-ax->bits);
+			for(k=ax->first[b],i=v->size();k<ax->first[b+1];k++)
+				if((ax->a[k].hash==h) &&
+					(memcmp(old+(off_t)ax->a[k].blk*blk,nw+p,blk)==0))
+					v->push_back((off_t)ax->a[k].blk*blk-p);
+			/* Past a hit the rest of its block tells nothing new */
+			if(v->size()>i) { p+=blk; break; };
+			if(p+blk>=nlen) { p=nlen; break; };
+			h=h*BSDIFF_RHMUL-nw[p]*ax->pow+nw[p+blk];
+			p++;
+		};
+	};
+
+	if(v->empty()) {
+		start=(off_t)((double)ns/newsize*oldsize)-slack/2;
+	} else {
+		std::sort(v->begin(),v->end());
+		for(i=0,j=0,bi=0,bj=0;j<v->size();j++) {
+			while((*v)[j]-(*v)[i]>slack) i++;
+			if(j-i>bj-bi) { bi=i; bj=j; };
+		};
+		best=(*v)[bj]-(*v)[bi];
+		start=(*v)[bi]-(slack-best)/2;
+	};
+
+	if(start>oldsize-wold) start=oldsize-wold;
+	if(start<0) start=0;
+	return start;
+}
+
+/*
+ * Pre-pass of BSDiffOptions::Prepass. Looks the rolling hash of every
+ * BSDIFF_RUNBLK-byte window of _new up among the aligned blocks of old,
+ * and extends each hit both ways into a run the two files share byte for
+ * byte, for the scan to take as its matches when the old file is not worth
+ * sorting. Runs come out in order and apart; a run of twice the block is
+ * found unless its blocks are too common to be anchors.
+ */
+static void runs_find(std::vector<diffrun> *runs,const u_char *old,
+		off_t oldsize,const u_char *_new,off_t newsize,memtrack *mt)
+{
+	const off_t blk=BSDIFF_RUNBLK;
+	anchors ax;
+	diffrun r;
+	off_t p,o,f,b,end;
+	size_t k,bk,held;
+	uint32_t h;
+
+	runs->clear();
+	if((oldsize<blk) || (newsize<blk)) return;
+
+	anchors_build(&ax,old,oldsize,blk,mt);
+	held=ax.a.capacity()*sizeof(anchor)+ax.first.size()*sizeof(uint32_t);
+
+	for(p=0,end=0;p+blk<=newsize;p+=f) {
+		h=rh_block(_new+p,blk);
+		for(o=-1;;p++) {
+			bk=h>>(32-ax.bits);
+			for(k=ax.first[bk];(o<0) && (k<ax.first[bk+1]);k++)
+				if((ax.a[k].hash==h) && (memcmp(old+(off_t)ax.a[k].blk*blk,
+					_new+p,blk)==0))
+					o=(off_t)ax.a[k].blk*blk;
+			if((o>=0) || (p+blk>=newsize)) break;
+			h=h*BSDIFF_RHMUL-_new[p]*ax.pow+_new[p+blk];
+		};
+		if(o<0) break;
+
+		b=bs_rmatchlen(old+o,_new+p,MIN(o,p-end));
+		f=blk+bs_matchlen(old+o+blk,_new+p+blk,
+			MIN(oldsize-o,newsize-p)-blk);
+		r.nstart=p-b;
+		r.ostart=o-b;
+		r.len=b+f;
+		runs->push_back(r);
+		end=p+f;
+	};
+
+	mt_add(mt,runs->capacity()*sizeof(diffrun));
+	mt_sub(mt,held);
+}
+
+/* The heap a whole-file diff takes, i.e. the files, I[] and sort scratch */
+static off_t whole_estimate(off_t oldsize,off_t newsize,
+		const BSDiffOptions &opts)
+{
+	off_t idx;
+
+	idx=((opts.Index==BSDIFF_INDEX_64) || (oldsize>BSDIFF_MAX32)) ?
+		(off_t)sizeof(off_t) : (off_t)sizeof(int32_t);
+	return oldsize*(2+idx)+newsize*2;
+}
+
+/* Size of an input, without loading it */
+static off_t input_size(const BSInput &in)
+{
+	int fd;
+	off_t size;
+
+	if(in.Path==NULL) {
+		if((in.Data==NULL) && (in.Size>0))
+			bs_fail(BSDIFF_ERR_ARGUMENT);
+		return (off_t)in.Size;
+	};
+
+	if((fd=open(in.Path,O_RDONLY|O_BINARY,0))<0)
+		bs_fail(BSDIFF_ERR_IO);
+	size=lseek(fd,0,SEEK_END);
+	if((close(fd)==-1) || (size==-1))
+		bs_fail(BSDIFF_ERR_IO);
+
+	return size;
+}
+
+/*
+ * Loads an input whole. Files are mapped if asked to, privately when the
+ * bytes are to be written over, or else read into the heap; so are memory
+ * inputs that are to be written over, the others being used in place. A
+ * heap copy is returned in *heap as well, for the caller to free.
+ */
+static u_char *input_load(const BSInput &in,Pixy::MappedFile *map,
+		bool mapped,bool writable,off_t *size,u_char **heap)
+{
+	u_char *p;
+	off_t n,got;
+	ssize_t r;
+	int fd;
+
+	*heap=NULL;
+	n=input_size(in);
+
+	if((in.Path!=NULL) && mapped) {
+		if(!map->map(in.Path,writable))
+			bs_fail(BSDIFF_ERR_IO);
+		*size=(off_t)map->getSize();
+		return map->getWritableData();
+	};
+
+	if((in.Path==NULL) && !writable) {
+		*size=n;
+		return (u_char*)in.Data;
+	};
+
+	/* Allocate n+1 bytes instead of n bytes to ensure that we never
+	try to malloc(0) and get a NULL pointer */
+	if((p=(u_char*)malloc(n+1))==NULL)
+		bs_fail(BSDIFF_ERR_MEMORY);
+
+	if(in.Path==NULL) {
+		if(n>0) memcpy(p,in.Data,n);
+	} else {
+		if((fd=open(in.Path,O_RDONLY|O_BINARY,0))<0) {
+			free(p);
+			bs_fail(BSDIFF_ERR_IO);
+		};
+		for(got=0;got<n;got+=r)
+			if((r=read(fd,p+got,n-got))<=0) break;
+		if((close(fd)==-1) || (got<n)) {
+			free(p);
+			bs_fail(BSDIFF_ERR_IO);
+		};
+	};
+
+	*size=n;
+	*heap=p;
+	return p;
+}
+
+/*
+ * Opens a file output, written next to its path until output_close(), as
+ * the inputs may be that very file; the other kinds need no FILE, which
+ * is NULL
+ */
+static FILE *output_open(const BSOutput &out)
+{
+	FILE *f;
+
+	if(out.Path==NULL) {
+		if((out.Buffer==NULL) && (out.Sink==NULL))
+			bs_fail(BSDIFF_ERR_ARGUMENT);
+		return NULL;
+	};
+
+	if((f=fopen((std::string(out.Path)+".tmp").c_str(),"wb"))==NULL)
+		bs_fail(BSDIFF_ERR_IO);
+	return f;
+}
+
+static void output_write(const BSOutput &out,FILE *f,const u_char *p,
+		off_t n)
+{
+	if(n==0) return;
+
+	if(f!=NULL) {
+		if(fwrite(p,n,1,f)!=1)
+			bs_fail(BSDIFF_ERR_IO);
+	} else if(out.Buffer!=NULL)
+		out.Buffer->insert(out.Buffer->end(),p,p+n);
+	else if(!out.Sink(out.Opaque,p,(size_t)n))
+		bs_fail(BSDIFF_ERR_IO);
+}
+
+/*
+ * Closes a file output and renames it over its path, or removes it if the
+ * call failed; only Windows won't rename over an existing file
+ */
+static bool output_close(const BSOutput &out,FILE *f,bool ok)
+{
+	std::string tmp;
+
+	if(f==NULL) return ok;
+
+	tmp=std::string(out.Path)+".tmp";
+	if(fclose(f)) ok=false;
+#ifdef _WIN32
+	if(ok) remove(out.Path);
+#endif
+	if(ok && rename(tmp.c_str(),out.Path)) ok=false;
+	if(!ok) remove(tmp.c_str());
+	return ok;
+}
+
+template<class T>
+static void diff_window(u_char *old,off_t olen,u_char *nw,off_t nlen,
+		diffseg *sg,const BSDiffOptions &opts,int threads,memtrack *mt,
+		bs_progress *pr)
+{
+	T *I;
+
+	I=sufsort<T>(old,olen,opts.Sort,threads,mt,pr);
+	try {
+		diff(I,old,olen,nw,nlen,&sg->d,&sg->ctrl,NULL,0,mt,pr);
+	} catch(...) {
+		free(I);
+		throw;
+	};
 	free(I);
-	free(old);
-	free(_new);
+	mt_sub(mt,(olen+1)*sizeof(T));
+}
+
+static void bsdiff_windowed(const BSInput &inold,const BSInput &innew,
+	const BSOutput &out,const BSDiffOptions &opts,BSDiffStats *outStats,
+	bs_progress *pr)
+{
+	Pixy::MappedFile oldmap,newmap;
+	u_char *old,*_new,*nw,*heap;
+	off_t oldsize,newsize,budget,wnew,wold,ablk;
+	off_t ns,nlen,os,olen;
+	u_char header[BSDIFF_WINHDR];
+	FILE *pf;
+	anchors ax;
+	std::vector<off_t> votes;
+	std::vector<diffseg> segs(1);
+	diffseg &sg=segs[0];
+	packjob pk;
+	memtrack mt={0,0};
+	size_t packed;
+	int b,threads;
+	bool wide;
+
+	threads=Pixy::Thread::resolve(opts.Threads);
+
+	/* Files are mapped whatever opts.Mapped says; neither is written to */
+	old=input_load(inold,&oldmap,true,false,&oldsize,&heap);
+	_new=input_load(innew,&newmap,true,false,&newsize,&heap);
+	newmap.advise(Pixy::MappedFile::ADVISE_SEQUENTIAL);
+
+	/*
+	 * Per window: the new window and the extra block (2*wnew), I[] and
+	 * the sort scratch over the old window (5*wold), and the compressed
+	 * blocks (2*wnew) make 14*wnew; the anchors and their table take
+	 * 1.25*wnew at most, leaving some slack.
+	 */
+	budget=(off_t)opts.MemoryBudget;
+	wnew=budget/16;
+	if(wnew<BSDIFF_MINWIN) wnew=BSDIFF_MINWIN;
+	wold=2*wnew;
+	if(wold>BSDIFF_MAX32) wold=BSDIFF_MAX32;
+	ablk=oldsize/(wnew/(off_t)sizeof(anchor))+1;
+	if(ablk<BSDIFF_MINANCHOR) ablk=BSDIFF_MINANCHOR;
+	wide=(opts.Index==BSDIFF_INDEX_64);
+
+	/* Each window sorts its old window, then scans and packs its bytes */
+	pr->total=(uint64_t)((newsize+wnew-1)/wnew)*MIN(wold,oldsize)+
+		2*newsize;
+	if(pr->total==0) pr->total=1;
+
+	anchors_build(&ax,old,oldsize,ablk,&mt);
+
+	if((nw=(u_char*)malloc(wnew+1))==NULL) bs_fail(BSDIFF_ERR_MEMORY);
+	mt_add(&mt,wnew+1);
+	sg.d.eb=NULL;
+	pf=NULL;
+
+	try {
+		pf=output_open(out);
+		memset(header,0,sizeof(header));
+		memcpy(header,"BSDIFF4W",8);
+		offtout(newsize,header+8);
+		offtout(MIN(wnew,newsize),header+16);
+		header[24]=(u_char)opts.Codec;
+		output_write(out,pf,header,32);
+
+		pk.segs=&segs;
+		pk.codec=opts.Codec;
+		pk.threads=(threads<3) ? threads : 3;
+		pk.pr=pr;
+		for(ns=0;ns<newsize;ns+=nlen) {
+			nlen=MIN(wnew,newsize-ns);
+			memcpy(nw,_new+ns,nlen);
+			os=place_window(&ax,old,oldsize,nw,ns,nlen,newsize,wold,&votes);
+			olen=MIN(wold,oldsize-os);
+
+			/* The diff block is built in place over the window copy */
+			sg.start=0;
+			sg.len=nlen;
+			sg.d.db=nw;
+			sg.d.eb=NULL;
+			sg.d.dblen=0;
+			sg.d.eblen=0;
+			sg.d.ebcap=0;
+			sg.ctrl.clear();
+			eb_reserve(&sg.d,0,nlen,&mt);
+			if(wide)
+				diff_window<off_t>(old+os,olen,nw,nlen,&sg,opts,threads,
+					&mt,pr);
+			else
+				diff_window<int32_t>(old+os,olen,nw,nlen,&sg,opts,threads,
+					&mt,pr);
+
+			bs_runall(pk.threads,&pack_worker,&pk);
+			for(b=0,packed=0;b<3;b++) packed+=pk.out[b].capacity();
+			mt_add(&mt,packed);
+
+			offtout(os,header);
+			offtout(nlen,header+8);
+			for(b=0;b<3;b++)
+				offtout((off_t)pk.out[b].size(),header+16+8*b);
+			output_write(out,pf,header,BSDIFF_WINHDR);
+			for(b=0;b<3;b++)
+				if(!pk.out[b].empty())
+					output_write(out,pf,&pk.out[b][0],pk.out[b].size());
+
+			for(b=0;b<3;b++) std::vector<u_char>().swap(pk.out[b]);
+			mt_sub(&mt,packed);
+			free(sg.d.eb);
+			sg.d.eb=NULL;
+			mt_sub(&mt,sg.d.ebcap);
+		};
+	} catch(...) {
+		output_close(out,pf,false);
+		free(sg.d.eb);
+		free(nw);
+		throw;
+	};
+
+	free(nw);
+	if(!output_close(out,pf,true))
+		bs_fail(BSDIFF_ERR_IO);
+
+	if(outStats) {
+		outStats->PeakMemory=mt.peak;
+		outStats->IndexSize=wide ? sizeof(off_t) : sizeof(int32_t);
+	};
+}
+
+/*
+ * Suffix array cache files are named after the MD5 of the old file and the
+ * index size, e.g. <md5>.sa32, and laid out as
+	0	8	"BSDIFFSA"
+	8	8	size of the old file
+	16	4	size of an index (4 or 8)
+	20	4	0x01020304 in host byte order
+	24	16	MD5 of the old file
+	40	24	zero
+	64	??	I[0..oldsize]
+ */
+#define BSDIFF_SAHDR 64
+
+struct BSDiffIndex::Data {
+	u_char *old;
+	off_t oldsize;
+	u_char *heap;		/* old, when it was read into the heap */
+	const off_t *I64;
+	const int32_t *I32;
+	void *owned;
+	bool wide,cached;
+	Pixy::MappedFile cache;
+	Pixy::MappedFile map;
+	memtrack mt;
+	BSDIFF_STATUS status;
+};
+
+static void sa_header(u_char *hdr,off_t oldsize,uint32_t width,
+		const u_char *digest)
+{
+	uint32_t order=0x01020304;
+
+	memset(hdr,0,BSDIFF_SAHDR);
+	memcpy(hdr,"BSDIFFSA",8);
+	offtout(oldsize,hdr+8);
+	memcpy(hdr+16,&width,4);
+	memcpy(hdr+20,&order,4);
+	memcpy(hdr+24,digest,16);
+}
 
-	return 0;
-}
\ No newline at end of file
+/* Maps the cached suffix array at path if it matches the old file */
+template<class T>
+static const T *sa_load(Pixy::MappedFile *cache,const char *path,
+		off_t oldsize,const u_char *digest)
+{
+	u_char hdr[BSDIFF_SAHDR];
+	const T *I;
+	off_t i;
+
+	if(!cache->map(path)) return NULL;
+
+	sa_header(hdr,oldsize,sizeof(T),digest);
+	if((cache->getSize()!=BSDIFF_SAHDR+(uint64_t)(oldsize+1)*sizeof(T)) ||
+		(memcmp(cache->getData(),hdr,BSDIFF_SAHDR)!=0)) {
+		cache->unmap();
+		return NULL;
+	};
+
+	/* A damaged entry must not send search() out of bounds */
+	I=(const T*)(cache->getData()+BSDIFF_SAHDR);
+	for(i=0;i<oldsize+1;i++)
+		if((I[i]<0) || (I[i]>oldsize)) {
+			cache->unmap();
+			return NULL;
+		};
+
+	return I;
+}
+
+/* Writes the suffix array to path; failures only cost the cache entry */
+template<class T>
+static void sa_store(const char *path,const T *I,off_t oldsize,
+		const u_char *digest)
+{
+	u_char hdr[BSDIFF_SAHDR];
+	std::string tmp=std::string(path)+".tmp";
+	FILE *f;
+	bool ok;
+
+	if((f=fopen(tmp.c_str(),"wb"))==NULL) return;
+	sa_header(hdr,oldsize,sizeof(T),digest);
+	ok=(fwrite(hdr,BSDIFF_SAHDR,1,f)==1) &&
+		(fwrite(I,sizeof(T),oldsize+1,f)==(size_t)(oldsize+1));
+	if(fclose(f)) ok=false;
+
+	/* Publish the entry atomically so readers never see half of it;
+	   only Windows won't rename over an existing file */
+#ifdef _WIN32
+	if(ok) remove(path);
+#endif
+	if(!ok || rename(tmp.c_str(),path)) remove(tmp.c_str());
+}
+
+template<class T>
+static const T *sa_prepare(BSDiffIndex::Data *d,const char *cachedir,
+		const u_char *digest,const char *hex,const BSDiffOptions &o,
+		bs_progress *pr)
+{
+	std::string path;
+	const T *I;
+	T *sorted;
+
+	if(cachedir) {
+		path=std::string(cachedir)+"/"+hex+((sizeof(T)==4) ? ".sa32" : ".sa64");
+		if((I=sa_load<T>(&d->cache,path.c_str(),d->oldsize,digest))!=NULL) {
+			d->cached=true;
+			mt_add(&d->mt,(d->oldsize+1)*sizeof(T));
+			bs_advance(pr,d->oldsize);
+			return I;
+		};
+	};
+
+	sorted=sufsort<T>(d->old,d->oldsize,o.Sort,
+		Pixy::Thread::resolve(o.Threads),&d->mt,pr);
+	d->owned=sorted;
+	if(cachedir) sa_store(path.c_str(),sorted,d->oldsize,digest);
+
+	return sorted;
+}
+
+static void index_init(BSDiffIndex::Data *d)
+{
+	d->old=NULL;
+	d->oldsize=0;
+	d->heap=NULL;
+	d->I64=NULL;
+	d->I32=NULL;
+	d->owned=NULL;
+	d->wide=false;
+	d->cached=false;
+	d->mt.cur=0;
+	d->mt.peak=0;
+	d->status=BSDIFF_OK;
+}
+
+static void index_load(BSDiffIndex::Data *d,const BSInput &inold,
+		const BSDiffOptions &inOptions)
+{
+	/* Searched all over, so have it paged in as early as possible */
+	d->old=input_load(inold,&d->map,inOptions.Mapped,false,&d->oldsize,
+		&d->heap);
+	d->map.advise(Pixy::MappedFile::ADVISE_WILLNEED);
+	mt_add(&d->mt,d->oldsize+1);
+}
+
+static void index_sort(BSDiffIndex::Data *d,const char *incachedir,
+		const BSDiffOptions &inOptions,bs_progress *pr)
+{
+	off_t i;
+	MD5 md5;
+
+	/* The cache is keyed by content, so hash the old file first */
+	if(incachedir) {
+		for(i=0;i<d->oldsize;i+=1<<30)
+			md5.Update(d->old+i,(unsigned int)MIN(d->oldsize-i,1<<30));
+		md5.Final();
+	};
+
+	/* Half the index memory whenever 32-bit suffix indices will do */
+	d->wide=(inOptions.Index==BSDIFF_INDEX_64) || (d->oldsize>BSDIFF_MAX32);
+	if(d->wide)
+		d->I64=sa_prepare<off_t>(d,incachedir,md5.digestRaw,
+			md5.digestChars,inOptions,pr);
+	else
+		d->I32=sa_prepare<int32_t>(d,incachedir,md5.digestRaw,
+			md5.digestChars,inOptions,pr);
+}
+
+static void index_build(BSDiffIndex::Data *d,const BSInput &inold,
+		const char *incachedir,const BSDiffOptions &inOptions,
+		bs_progress *pr)
+{
+	index_load(d,inold,inOptions);
+	index_sort(d,incachedir,inOptions,pr);
+}
+
+static void index_free(BSDiffIndex::Data *d)
+{
+	free(d->owned);
+	free(d->heap);
+	d->owned=NULL;
+	d->heap=NULL;
+}
+
+BSDiffIndex::BSDiffIndex(const BSInput& inold, const char* incachedir,
+	const BSDiffOptions& inOptions)
+{
+	bs_progress pr;
+
+	if((mData=new(std::nothrow) Data())==NULL) return;
+	index_init(mData);
+
+	try {
+		bs_progress_init(&pr,inOptions.Progress,inOptions.ProgressData,
+			input_size(inold));
+		index_build(mData,inold,incachedir,inOptions,&pr);
+	} catch(...) {
+		mData->status=bs_caught();
+		index_free(mData);
+	};
+}
+
+BSDiffIndex::~BSDiffIndex()
+{
+	if(mData==NULL) return;
+	index_free(mData);
+	delete mData;
+}
+
+BSDIFF_STATUS BSDiffIndex::getStatus() const
+{
+	return mData ? mData->status : BSDIFF_ERR_MEMORY;
+}
+
+bool BSDiffIndex::isCached() const
+{
+	return mData && mData->cached;
+}
+
+static void diff_index(BSDiffIndex::Data *ix,const BSInput &innew,
+	const BSOutput &out,const BSDiffOptions &inOptions,BSDiffStats *outStats,
+	bs_progress *pr);
+
+//int DIFF_main(int argc,char *argv[])
+BSDIFF_STATUS bsdiff(const BSInput& inold, const BSInput& innew,
+	const BSOutput& out, const BSDiffOptions& inOptions,
+	BSDiffStats* outStats)
+{
+	BSDiffIndex::Data ix;
+	bs_progress pr;
+	off_t oldsize,newsize;
+	BSDIFF_STATUS status=BSDIFF_OK;
+
+	index_init(&ix);
+	try {
+		oldsize=input_size(inold);
+		newsize=input_size(innew);
+		bs_progress_init(&pr,inOptions.Progress,inOptions.ProgressData,
+			oldsize+2*newsize);
+
+		if((inOptions.MemoryBudget>0) &&
+			(whole_estimate(oldsize,newsize,inOptions)>
+				(off_t)inOptions.MemoryBudget))
+			bsdiff_windowed(inold,innew,out,inOptions,outStats,&pr);
+		else {
+			/* With the pre-pass, sorting waits for the new file */
+			if(inOptions.Prepass)
+				index_load(&ix,inold,inOptions);
+			else
+				index_build(&ix,inold,NULL,inOptions,&pr);
+			diff_index(&ix,innew,out,inOptions,outStats,&pr);
+		};
+	} catch(...) {
+		status=bs_caught();
+	};
+	index_free(&ix);
+
+	return status;
+}
+
+BSDIFF_STATUS bsdiff(const BSDiffIndex& inIndex, const BSInput& innew,
+	const BSOutput& out, const BSDiffOptions& inOptions,
+	BSDiffStats* outStats)
+{
+	bs_progress pr;
+	BSDIFF_STATUS status=BSDIFF_OK;
+
+	if(inIndex.getStatus()!=BSDIFF_OK)
+		return inIndex.getStatus();
+
+	try {
+		bs_progress_init(&pr,inOptions.Progress,inOptions.ProgressData,
+			2*input_size(innew));
+		diff_index(inIndex.mData,innew,out,inOptions,outStats,&pr);
+	} catch(...) {
+		status=bs_caught();
+	};
+
+	return status;
+}
+
+const char* bsdiff_strerror(BSDIFF_STATUS inStatus)
+{
+	switch(inStatus) {
+	case BSDIFF_OK: return "Success";
+	case BSDIFF_ERR_IO: return "Input/output error";
+	case BSDIFF_ERR_MEMORY: return "Out of memory";
+	case BSDIFF_ERR_CORRUPT: return "Corrupt patch";
+	case BSDIFF_ERR_ARGUMENT: return "Invalid argument";
+	case BSDIFF_ERR_CANCELLED: return "Cancelled";
+	case BSDIFF_ERR_INTERNAL: return "Internal error";
+	};
+	return "Unknown error";
+}
+
+/* The diff proper, counting 2*newsize units of progress */
+static void diff_index(BSDiffIndex::Data *ix,const BSInput &innew,
+	const BSOutput &out,const BSDiffOptions &inOptions,BSDiffStats *outStats,
+	bs_progress *pr)
+{
+	u_char *old=ix->old,*_new,*heap;
+	off_t oldsize=ix->oldsize,newsize;
+	off_t len,pos,blen[3];
+	u_char header[40];
+	size_t hdrlen,packed;
+	FILE * pf;
+	BSDIFF_CODEC codec=inOptions.Codec;
+	memtrack mt=ix->mt;
+	std::vector<diffseg> segs;
+	std::vector<diffrun> runs;
+	packjob pk;
+	size_t k;
+	int b,threads,nseg;
+	Pixy::MappedFile newmap;
+
+	threads=Pixy::Thread::resolve(inOptions.Threads);
+
+	/* Privately if mapped, as the diff block is built in place over _new */
+	_new=input_load(innew,&newmap,inOptions.Mapped,true,&newsize,&heap);
+	newmap.advise(Pixy::MappedFile::ADVISE_SEQUENTIAL);
+	mt_add(&mt,newsize+1);
+
+	pf=NULL;
+	packed=0;
+	try {
+		/* Cut the new file into slices of at least BSDIFF_MINSEG bytes */
+		nseg=(inOptions.Segments<=0) ? threads : inOptions.Segments;
+		if(nseg>newsize/BSDIFF_MINSEG) nseg=(int)(newsize/BSDIFF_MINSEG);
+		if(nseg<1) nseg=1;
+		segs.resize(nseg);
+		for(k=0;k<segs.size();k++) {
+			diffseg &sg=segs[k];
+			sg.start=newsize*k/nseg;
+			sg.len=newsize*(k+1)/nseg-sg.start;
+			sg.d.db=_new+sg.start;
+			sg.d.eb=NULL;
+			sg.d.dblen=0;
+			sg.d.eblen=0;
+			sg.d.ebcap=0;
+			sg.mt.cur=0;
+			sg.mt.peak=0;
+			eb_reserve(&sg.d,0,sg.len,&sg.mt);
+		};
+
+		/* An old file not sorted yet, see BSDiffOptions::Prepass, only
+		is if the runs it shares with the new one leave enough of the
+		latter to search; otherwise the runs are all the scan takes */
+		if((ix->I32==NULL) && (ix->I64==NULL)) {
+			runs_find(&runs,old,oldsize,_new,newsize,&mt);
+			for(k=0,len=newsize;k<runs.size();k++) len-=runs[k].len;
+			if(len>newsize/BSDIFF_SKIPSORT) {
+				mt_sub(&mt,runs.capacity()*sizeof(diffrun));
+				std::vector<diffrun>().swap(runs);
+				ix->mt=mt;
+				index_sort(ix,NULL,inOptions,pr);
+				mt=ix->mt;
+			} else
+				bs_advance(pr,oldsize);
+		};
+
+		/* Compute the differences */
+		if(ix->wide)
+			diff_segments(ix->I64,old,oldsize,_new,&segs,&runs,threads,
+				&mt,pr);
+		else
+			diff_segments(ix->I32,old,oldsize,_new,&segs,&runs,threads,
+				&mt,pr);
+		mt_sub(&mt,runs.capacity()*sizeof(diffrun));
+		std::vector<diffrun>().swap(runs);
+
+		/* Create the patch file */
+		pf=output_open(out);
+
+		/* Header is
+		0	8	 "BSDIFF40"
+		8	8	length of bzip2ed ctrl block
+		16	8	length of bzip2ed diff block
+		24	8	length of new file */
+		/* File is
+		0	32	Header
+		32	??	Bzip2ed ctrl block
+		??	??	Bzip2ed diff block
+		??	??	Bzip2ed extra block */
+		/* With another codec than bzip2 the magic is "BSDIFF4C" and
+		the header carries 8 more bytes, the blocks following at 40
+		32	1	codec of the ctrl block, see BSDIFF_CODEC
+		33	1	codec of the diff block
+		34	1	codec of the extra block
+		35	5	zero */
+		hdrlen=(codec==BSDIFF_CODEC_BZIP2) ? 32 : 40;
+		memset(header,0,sizeof(header));
+		memcpy(header,(hdrlen==32) ? "BSDIFF40" : "BSDIFF4C",8);
+		offtout(0, header + 8);
+		offtout(0, header + 16);
+		offtout(newsize, header + 24);
+		header[32]=header[33]=header[34]=(u_char)codec;
+
+		/* Write the compressed ctrl, diff and extra blocks. Only a file
+		can be streamed into and have its header fixed up afterwards */
+		if((threads>1) || (pf==NULL)) {
+			pk.segs=&segs;
+			pk.codec=codec;
+			pk.threads=(threads<3) ? threads : 3;
+			pk.pr=pr;
+			bs_runall(pk.threads,&pack_worker,&pk);
+			for(b=0;b<3;b++) {
+				packed+=pk.out[b].capacity();
+				blen[b]=(off_t)pk.out[b].size();
+			};
+			mt_add(&mt,packed);
+
+			offtout(blen[0], header + 8);
+			offtout(blen[1], header + 16);
+			output_write(out, pf, header, hdrlen);
+			for(b=0;b<3;b++)
+				if(blen[b]>0)
+					output_write(out, pf, &pk.out[b][0], blen[b]);
+		} else {
+			output_write(out, pf, header, hdrlen);
+			pos=hdrlen;
+			for(b=0;b<3;b++) {
+				pack_block(bs_writer_open(codec,pf),segs,b,pr);
+				if ((len = ftello(pf)) == -1)
+					bs_fail(BSDIFF_ERR_IO);
+				blen[b]=len-pos;
+				pos=len;
+			};
+			offtout(blen[0], header + 8);
+			offtout(blen[1], header + 16);
+
+			/* Seek to the beginning, write the header */
+			if (fseeko(pf, 0, SEEK_SET))
+				bs_fail(BSDIFF_ERR_IO);
+			output_write(out, pf, header, hdrlen);
+		};
+	} catch(...) {
+		output_close(out,pf,false);
+		for(k=0;k<segs.size();k++)
+			free(segs[k].d.eb);
+		free(heap);
+		throw;
+	};
+
+	/* Free the memory we used, and close the file */
+	for(k=0;k<segs.size();k++)
+		free(segs[k].d.eb);
+	mt_sub(&mt,packed);
+	free(heap);
+	if(!output_close(out,pf,true))
+		bs_fail(BSDIFF_ERR_IO);
+
+	if(outStats) {
+		outStats->PeakMemory=mt.peak;
+		outStats->IndexSize=ix->wide ? sizeof(off_t) :
+			(ix->I32!=NULL) ? sizeof(int32_t) : 0;
+	};
+}
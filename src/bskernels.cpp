@@ -0,0 +1,452 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#include "bskernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BS_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef _MSC_VER
+// MSVC emits any intrinsic without per-function target flags
+#define BS_TARGET(x)
+#else
+#define BS_TARGET(x) __attribute__((target(x)))
+#endif
+
+/* index of the lowest and the highest set bit of a non-zero mask */
+static inline int bs_ctz(unsigned int m)
+{
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward(&i,m);
+	return (int)i;
+#else
+	return __builtin_ctz(m);
+#endif
+}
+
+static inline int bs_msb(unsigned int m)
+{
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanReverse(&i,m);
+	return (int)i;
+#else
+	return 31-__builtin_clz(m);
+#endif
+}
+
+/*
+ * Scalar kernels; also used for the tails the vector loops leave behind.
+ */
+static off_t matchlen_c(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	off_t i;
+
+	for(i=0;i<n;i++)
+		if(a[i]!=b[i]) break;
+
+	return i;
+}
+
+static off_t mismatchlen_c(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	off_t i;
+
+	for(i=0;i<n;i++)
+		if(a[i]==b[i]) break;
+
+	return i;
+}
+
+static off_t rmatchlen_c(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	off_t i;
+
+	for(i=0;i<n;i++)
+		if(a[-1-i]!=b[-1-i]) break;
+
+	return i;
+}
+
+static off_t rmismatchlen_c(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	off_t i;
+
+	for(i=0;i<n;i++)
+		if(a[-1-i]==b[-1-i]) break;
+
+	return i;
+}
+
+static off_t matchcount_c(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	off_t i,c;
+
+	for(i=0,c=0;i<n;i++)
+		if(a[i]==b[i]) c++;
+
+	return c;
+}
+
+static void add_c(unsigned char *p,const unsigned char *o,off_t n)
+{
+	off_t i;
+
+	for(i=0;i<n;i++)
+		p[i]+=o[i];
+}
+
+#ifdef BS_X86
+/*
+ * SSE2 kernels, 16 bytes per step. _mm_movemask_epi8 of the byte-wise
+ * equality gives one bit per position; the first (or, walking backwards,
+ * last) bit that breaks the run is where the answer lies.
+ */
+BS_TARGET("sse2")
+static inline unsigned int eqmask_sse2(const unsigned char *a,const unsigned char *b)
+{
+	__m128i x=_mm_loadu_si128((const __m128i*)a);
+	__m128i y=_mm_loadu_si128((const __m128i*)b);
+	return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(x,y));
+}
+
+BS_TARGET("sse2")
+static off_t matchlen_sse2(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	off_t i;
+	unsigned int m;
+
+	for(i=0;i+16<=n;i+=16)
+		if((m=~eqmask_sse2(a+i,b+i)&0xFFFF)!=0)
+			return i+bs_ctz(m);
+
+	return i+matchlen_c(a+i,b+i,n-i);
+}
+
+BS_TARGET("sse2")
+static off_t mismatchlen_sse2(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	off_t i;
+	unsigned int m;
+
+	for(i=0;i+16<=n;i+=16)
+		if((m=eqmask_sse2(a+i,b+i))!=0)
+			return i+bs_ctz(m);
+
+	return i+mismatchlen_c(a+i,b+i,n-i);
+}
+
+BS_TARGET("sse2")
+static off_t rmatchlen_sse2(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	off_t i;
+	unsigned int m;
+
+	for(i=0;i+16<=n;i+=16)
+		if((m=~eqmask_sse2(a-i-16,b-i-16)&0xFFFF)!=0)
+			return i+15-bs_msb(m);
+
+	return i+rmatchlen_c(a-i,b-i,n-i);
+}
+
+BS_TARGET("sse2")
+static off_t rmismatchlen_sse2(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	off_t i;
+	unsigned int m;
+
+	for(i=0;i+16<=n;i+=16)
+		if((m=eqmask_sse2(a-i-16,b-i-16))!=0)
+			return i+15-bs_msb(m);
+
+	return i+rmismatchlen_c(a-i,b-i,n-i);
+}
+
+/*
+ * Equal lanes are -1, so subtracting the comparison counts them per lane;
+ * the lanes are folded with a SAD before they can wrap at 255 steps.
+ */
+BS_TARGET("sse2")
+static off_t matchcount_sse2(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	off_t i,c;
+	int k;
+	__m128i acc,sum,zero;
+
+	zero=_mm_setzero_si128();
+	sum=zero;
+	for(i=0;i+16<=n;) {
+		acc=zero;
+		for(k=0;(k<255)&&(i+16<=n);k++,i+=16)
+			acc=_mm_sub_epi8(acc,_mm_cmpeq_epi8(
+				_mm_loadu_si128((const __m128i*)(a+i)),
+				_mm_loadu_si128((const __m128i*)(b+i))));
+		sum=_mm_add_epi64(sum,_mm_sad_epu8(acc,zero));
+	};
+
+	c=(off_t)_mm_cvtsi128_si32(sum)+
+		(off_t)_mm_cvtsi128_si32(_mm_srli_si128(sum,8));
+	return c+matchcount_c(a+i,b+i,n-i);
+}
+
+BS_TARGET("sse2")
+static void add_sse2(unsigned char *p,const unsigned char *o,off_t n)
+{
+	off_t i;
+
+	for(i=0;i+16<=n;i+=16)
+		_mm_storeu_si128((__m128i*)(p+i),_mm_add_epi8(
+			_mm_loadu_si128((const __m128i*)(p+i)),
+			_mm_loadu_si128((const __m128i*)(o+i))));
+
+	add_c(p+i,o+i,n-i);
+}
+
+/*
+ * AVX2 kernels, 32 bytes per step, same scheme as above.
+ */
+BS_TARGET("avx2")
+static inline unsigned int eqmask_avx2(const unsigned char *a,const unsigned char *b)
+{
+	__m256i x=_mm256_loadu_si256((const __m256i*)a);
+	__m256i y=_mm256_loadu_si256((const __m256i*)b);
+	return (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x,y));
+}
+
+BS_TARGET("avx2")
+static off_t matchlen_avx2(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	off_t i;
+	unsigned int m;
+
+	for(i=0;i+32<=n;i+=32)
+		if((m=~eqmask_avx2(a+i,b+i))!=0)
+			return i+bs_ctz(m);
+
+	return i+matchlen_sse2(a+i,b+i,n-i);
+}
+
+BS_TARGET("avx2")
+static off_t mismatchlen_avx2(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	off_t i;
+	unsigned int m;
+
+	for(i=0;i+32<=n;i+=32)
+		if((m=eqmask_avx2(a+i,b+i))!=0)
+			return i+bs_ctz(m);
+
+	return i+mismatchlen_sse2(a+i,b+i,n-i);
+}
+
+BS_TARGET("avx2")
+static off_t rmatchlen_avx2(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	off_t i;
+	unsigned int m;
+
+	for(i=0;i+32<=n;i+=32)
+		if((m=~eqmask_avx2(a-i-32,b-i-32))!=0)
+			return i+31-bs_msb(m);
+
+	return i+rmatchlen_sse2(a-i,b-i,n-i);
+}
+
+BS_TARGET("avx2")
+static off_t rmismatchlen_avx2(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	off_t i;
+	unsigned int m;
+
+	for(i=0;i+32<=n;i+=32)
+		if((m=eqmask_avx2(a-i-32,b-i-32))!=0)
+			return i+31-bs_msb(m);
+
+	return i+rmismatchlen_sse2(a-i,b-i,n-i);
+}
+
+BS_TARGET("avx2")
+static off_t matchcount_avx2(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	off_t i,c;
+	int k;
+	__m256i acc,sum,zero;
+	__m128i s;
+
+	zero=_mm256_setzero_si256();
+	sum=zero;
+	for(i=0;i+32<=n;) {
+		acc=zero;
+		for(k=0;(k<255)&&(i+32<=n);k++,i+=32)
+			acc=_mm256_sub_epi8(acc,_mm256_cmpeq_epi8(
+				_mm256_loadu_si256((const __m256i*)(a+i)),
+				_mm256_loadu_si256((const __m256i*)(b+i))));
+		sum=_mm256_add_epi64(sum,_mm256_sad_epu8(acc,zero));
+	};
+
+	s=_mm_add_epi64(_mm256_castsi256_si128(sum),
+		_mm256_extracti128_si256(sum,1));
+	c=(off_t)_mm_cvtsi128_si32(s)+
+		(off_t)_mm_cvtsi128_si32(_mm_srli_si128(s,8));
+	return c+matchcount_sse2(a+i,b+i,n-i);
+}
+
+BS_TARGET("avx2")
+static void add_avx2(unsigned char *p,const unsigned char *o,off_t n)
+{
+	off_t i;
+
+	for(i=0;i+64<=n;i+=64) {
+		_mm256_storeu_si256((__m256i*)(p+i),_mm256_add_epi8(
+			_mm256_loadu_si256((const __m256i*)(p+i)),
+			_mm256_loadu_si256((const __m256i*)(o+i))));
+		_mm256_storeu_si256((__m256i*)(p+i+32),_mm256_add_epi8(
+			_mm256_loadu_si256((const __m256i*)(p+i+32)),
+			_mm256_loadu_si256((const __m256i*)(o+i+32))));
+	};
+
+	add_sse2(p+i,o+i,n-i);
+}
+#endif
+
+/*
+ * CPUID leaf 1 reports SSE2, AVX and OSXSAVE, leaf 7 AVX2 and AVX-512F;
+ * XGETBV confirms the OS saves the YMM, and for AVX-512 the ZMM and mask,
+ * state on a context switch.
+ */
+unsigned int bs_cpu()
+{
+	unsigned int flags=0;
+#ifdef BS_X86
+	unsigned int r[4];
+	unsigned long long xcr0;
+
+#ifdef _MSC_VER
+	__cpuid((int*)r,0);
+	if(r[0]<1) return 0;
+	__cpuid((int*)r,1);
+#else
+	if(!__get_cpuid(1,&r[0],&r[1],&r[2],&r[3])) return 0;
+#endif
+	if(r[3]&(1u<<26)) flags|=BS_CPU_SSE2;
+	if(!(r[2]&(1u<<27)) || !(r[2]&(1u<<28))) return flags;
+
+#ifdef _MSC_VER
+	xcr0=_xgetbv(0);
+	__cpuid((int*)r,0);
+	if(r[0]<7) return flags;
+	__cpuidex((int*)r,7,0);
+#else
+	unsigned int lo,hi;
+
+	__asm__ __volatile__(".byte 0x0f,0x01,0xd0" : "=a"(lo),"=d"(hi) : "c"(0));
+	xcr0=((unsigned long long)hi<<32)|lo;
+	if(__get_cpuid_max(0,0)<7) return flags;
+	__cpuid_count(7,0,r[0],r[1],r[2],r[3]);
+#endif
+
+	if(((xcr0&0x06)==0x06) && (r[1]&(1u<<5))) flags|=BS_CPU_AVX2;
+	if(((xcr0&0xe6)==0xe6) && (r[1]&(1u<<16))) flags|=BS_CPU_AVX512;
+#endif
+	return flags;
+}
+
+struct bs_kernel_set {
+	const char *name;
+	off_t (*matchlen)(const unsigned char*,const unsigned char*,off_t);
+	off_t (*mismatchlen)(const unsigned char*,const unsigned char*,off_t);
+	off_t (*rmatchlen)(const unsigned char*,const unsigned char*,off_t);
+	off_t (*rmismatchlen)(const unsigned char*,const unsigned char*,off_t);
+	off_t (*matchcount)(const unsigned char*,const unsigned char*,off_t);
+	void (*add)(unsigned char*,const unsigned char*,off_t);
+};
+
+static const bs_kernel_set bs_scalar={ "scalar",
+	matchlen_c,mismatchlen_c,rmatchlen_c,rmismatchlen_c,matchcount_c,
+	add_c };
+#ifdef BS_X86
+static const bs_kernel_set bs_sse2={ "sse2",
+	matchlen_sse2,mismatchlen_sse2,rmatchlen_sse2,rmismatchlen_sse2,
+	matchcount_sse2,add_sse2 };
+static const bs_kernel_set bs_avx2={ "avx2",
+	matchlen_avx2,mismatchlen_avx2,rmatchlen_avx2,rmismatchlen_avx2,
+	matchcount_avx2,add_avx2 };
+#endif
+
+static const bs_kernel_set *bs_pick()
+{
+#ifdef BS_X86
+	unsigned int cpu=bs_cpu();
+
+	if(cpu&BS_CPU_AVX2) return &bs_avx2;
+	if(cpu&BS_CPU_SSE2) return &bs_sse2;
+#endif
+	return &bs_scalar;
+}
+
+/* resolved once during static initialisation, before any thread exists */
+static const bs_kernel_set *K=bs_pick();
+
+off_t bs_matchlen(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	return K->matchlen(a,b,n);
+}
+
+off_t bs_mismatchlen(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	return K->mismatchlen(a,b,n);
+}
+
+off_t bs_rmatchlen(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	return K->rmatchlen(a,b,n);
+}
+
+off_t bs_rmismatchlen(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	return K->rmismatchlen(a,b,n);
+}
+
+off_t bs_matchcount(const unsigned char *a,const unsigned char *b,off_t n)
+{
+	return K->matchcount(a,b,n);
+}
+
+void bs_add(unsigned char *p,const unsigned char *o,off_t n)
+{
+	K->add(p,o,n);
+}
+
+const char *bs_kernels()
+{
+	return K->name;
+}
@@ -29,17 +29,22 @@
 __FBSDID("$FreeBSD: src/usr.bin/bsdiff/bspatch/bspatch.c,v 1.1 2005/08/06 01:59:06 cperciva Exp $");
 #endif
 
-#include <bzlib.h>
+#include "MappedFile.h"
+#include "Thread.h"
+#include "bscodec.h"
+#include "bserror.h"
+#include "bskernels.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <string>
 #ifdef  __APPLE_CC__
 #include <sys/types.h> // Ahmad Amireh - OS X Compatibility
 #endif
 #ifndef _WIN32
 // KevinJ - Windows compatibility
-#include <err.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #else
 typedef int ssize_t;
 #include <wchar.h>
@@ -50,17 +55,11 @@ typedef int ssize_t;
 #define close _close
 #define read _read
 #define lseek _lseek
-static void err(int i, ...)
-{
-	exit(i);
-}
-static void errx(int i, ...)
-{
-	exit(i);
-}
 #endif
 #include <fcntl.h>
 
+#include "bsdiff.h"
+
 #ifndef _O_BINARY
 #define _O_BINARY 0
 #endif
@@ -68,8 +67,12 @@ static void errx(int i, ...)
 #define O_BINARY _O_BINARY 
 #endif
 
+#ifndef MIN
+#define MIN(x,y) (((x)<(y)) ? (x) : (y))
+#endif
+
 
-static off_t offtin(u_char *buf)
+static off_t offtin(const u_char *buf)
 {
 	off_t y;
 
@@ -87,124 +90,289 @@ static off_t offtin(u_char *buf)
 	return y;
 }
 
-//int PATCH_main(int argc,char * argv[])
-int bspatch(const char* src, const char* dest, const char* diff)
+/*
+ * Maps or reads a whole input file, see BSPatchOptions::Mapped; memory
+ * inputs are used in place. A heap copy is returned in *heap as well.
+ */
+static u_char *load(const BSInput &in,Pixy::MappedFile *map,bool mapped,
+		Pixy::MappedFile::ADVICE advice,off_t *size,u_char **heap)
 {
-	FILE * f, * cpf, * dpf, * epf;
-	BZFILE * cpfbz2, * dpfbz2, * epfbz2;
-	int cbz2err, dbz2err, ebz2err;
 	int fd;
-	ssize_t oldsize,newsize;
-	ssize_t bzctrllen,bzdatalen;
-	u_char header[32],buf[8];
-	u_char *old, *_new;
-	off_t oldpos,newpos;
-	off_t ctrl[3];
-	off_t lenread;
-	off_t i;
+	u_char *buf;
+	off_t got;
+	ssize_t r;
 
-	unsigned bytesRead=0;
+	*heap=NULL;
+	if(in.Path==NULL) {
+		if((in.Data==NULL) && (in.Size>0))
+			bs_fail(BSDIFF_ERR_ARGUMENT);
+		*size=(off_t)in.Size;
+		return (u_char*)in.Data;
+	};
 
-	//if(argc!=4) errx(1,"usage: %s oldfile newfile patchfile\n",argv[0]);
+	if(mapped) {
+		if(!map->map(in.Path)) bs_fail(BSDIFF_ERR_IO);
+		map->advise(advice);
+		*size=(off_t)map->getSize();
+		return map->getWritableData();
+	};
+
+	if(((fd=open(in.Path,O_RDONLY|O_BINARY,0))<0))
+		bs_fail(BSDIFF_ERR_IO);
+	if(((*size=lseek(fd,0,SEEK_END))==-1) || (lseek(fd,0,SEEK_SET)!=0)) {
+		close(fd);
+		bs_fail(BSDIFF_ERR_IO);
+	};
+
+	/* Allocate size+1 bytes to never malloc(0) */
+	if((buf=(u_char*)malloc(*size+1))==NULL) {
+		close(fd);
+		bs_fail(BSDIFF_ERR_MEMORY);
+	};
+	for(got=0;got<*size;got+=r)
+		if((r=read(fd,buf+got,*size-got))<=0) break;
+	if((close(fd)==-1) || (got<*size)) {
+		free(buf);
+		bs_fail(BSDIFF_ERR_IO);
+	};
+
+	*heap=buf;
+	return buf;
+}
+
+/*
+ * The new file is produced through a fixed buffer which is written out
+ * whenever it fills, and unless it is mapped the old file is read through
+ * a direct-mapped cache of its pages of the same size, so that memory
+ * depends on BSPatchOptions::BufferSize and not on the size of either
+ * file. Pages are small because patches of dissimilar files seek all
+ * over the old one for a few bytes at a time.
+ */
+#define BS_PAGE 4096
+
+struct outbuf {
+	const BSOutput *dst;
+	int fd;			/* when dst is a file */
+	u_char *buf;
+	off_t cap,len;
+	bs_progress *pr;
+};
+
+static void out_flush(outbuf *out)
+{
+	const BSOutput *dst=out->dst;
+	off_t done;
+	ssize_t r;
+
+	if(out->len==0) return;
+
+	if(out->fd>=0) {
+		for(done=0;done<out->len;done+=r)
+			if((r=write(out->fd,out->buf+done,out->len-done))<=0)
+				bs_fail(BSDIFF_ERR_IO);
+	} else if(dst->Buffer!=NULL)
+		dst->Buffer->insert(dst->Buffer->end(),out->buf,out->buf+out->len);
+	else if(!dst->Sink(dst->Opaque,out->buf,(size_t)out->len))
+		bs_fail(BSDIFF_ERR_IO);
+
+	done=out->len;
+	out->len=0;
+	bs_advance(out->pr,done);
+}
+
+struct oldfile {
+	const u_char *data;	/* the whole file when mapped or in memory */
+	int fd;
+	off_t size;
+	u_char *buf;		/* else a cache of its pages */
+	off_t *tag;		/* the page held in each slot, -1 for none */
+	off_t slots;
+};
+
+/* Returns the old bytes at pos, *len cut to what is contiguous there */
+static const u_char *old_bytes(oldfile *old,off_t pos,off_t *len)
+{
+	off_t page,slot,off,n,got;
+	u_char *p;
+
+	if(old->data)
+		return old->data+pos;
+
+	page=pos/BS_PAGE;
+	slot=page%old->slots;
+	p=old->buf+slot*BS_PAGE;
+	if(old->tag[slot]!=page) {
+		n=MIN(BS_PAGE,old->size-page*BS_PAGE);
+#ifdef _WIN32
+		if((lseek(old->fd,page*BS_PAGE,SEEK_SET)!=page*BS_PAGE) ||
+			(read(old->fd,p,(unsigned int)n)!=n))
+			bs_fail(BSDIFF_ERR_IO);
+#else
+		for(off=0;off<n;off+=got)
+			if((got=pread(old->fd,p+off,n-off,page*BS_PAGE+off))<=0)
+				bs_fail(BSDIFF_ERR_IO);
+#endif
+		old->tag[slot]=page;
+	};
+
+	off=pos-page*BS_PAGE;
+	if(*len>BS_PAGE-off) *len=BS_PAGE-off;
+	return p+off;
+}
+
+/*
+ * Adds the old bytes at oldpos to the n at p, where there are any. The
+ * span inside the old file is clamped once, so the add kernel sees only
+ * whole runs with no per-byte bounds checks.
+ */
+static void add_old(oldfile *old,off_t oldpos,u_char *p,off_t n)
+{
+	const u_char *o;
+	off_t lo,hi,m;
+
+	lo=(oldpos<0) ? -oldpos : 0;
+	hi=(oldpos+n>old->size) ? old->size-oldpos : n;
+	for(;lo<hi;lo+=m) {
+		m=hi-lo;
+		o=old_bytes(old,oldpos+lo,&m);
+		bs_add(p+lo,o,m);
+	};
+}
+
+/*
+ * The diff and extra blocks are read through a source. With threads to
+ * spare, each is decoded ahead on a thread of its own into a ring buffer,
+ * so that the two decoders and the ctrl loop run side by side; otherwise
+ * (buf is NULL) the reads go straight to the decoder. Either side only
+ * wakes the other once it is waiting and a whole step can be made, as
+ * patches of dissimilar files read a few bytes at a time. A decoder that
+ * fails ends its block early with the status the reader then fails with.
+ */
+#define BS_RINGSTEP 65536
+
+struct source {
+	bs_reader *r;
+	u_char *buf;
+	off_t cap,step;
+	off_t head,tail;	/* bytes decoded and consumed so far */
+	bool eof,stop;
+	bool pwait,cwait;	/* the producer or the consumer is asleep */
+	BSDIFF_STATUS status;
+	Pixy::Mutex lock;
+	Pixy::Condition cond;
+};
+
+/* Decodes the block into the ring until it ends or the reader stops */
+static void source_fill(void *data,int)
+{
+	source *s=(source*)data;
+	BSDIFF_STATUS status=BSDIFF_OK;
+	off_t off,n;
+
+	s->lock.lock();
+	for(;;) {
+		while(!s->stop && (s->cap-(s->head-s->tail)<s->step)) {
+			s->pwait=true;
+			s->cond.wait(s->lock);
+		};
+		s->pwait=false;
+		if(s->stop)
+			break;
+
+		/* Only the producer writes between head and tail+cap */
+		off=s->head%s->cap;
+		n=MIN(s->cap-(s->head-s->tail),s->cap-off);
+		s->lock.unlock();
+		try {
+			n=bs_reader_readsome(s->r,s->buf+off,MIN(n,s->step));
+		} catch(...) {
+			status=bs_caught();
+			n=0;
+		};
+		s->lock.lock();
+
+		if(n==0) {
+			s->eof=true;
+			s->status=status;
+		} else
+			s->head+=n;
+		if(s->cwait)
+			s->cond.notifyAll();
+		if(s->eof)
+			break;
+	};
+	s->lock.unlock();
+}
+
+static void source_read(source *s,u_char *buf,off_t len)
+{
+	off_t off,n;
+
+	if(s->buf==NULL) {
+		bs_reader_read(s->r,buf,len);
+		return;
+	};
+
+	s->lock.lock();
+	while(len>0) {
+		while((s->head==s->tail) && !s->eof) {
+			s->cwait=true;
+			s->cond.wait(s->lock);
+		};
+		s->cwait=false;
+		if(s->head==s->tail) {
+			s->lock.unlock();
+			bs_fail((s->status!=BSDIFF_OK) ? s->status : BSDIFF_ERR_CORRUPT);
+		};
+
+		off=s->tail%s->cap;
+		n=MIN(MIN(len,s->head-s->tail),s->cap-off);
+		s->lock.unlock();
+		memcpy(buf,s->buf+off,n);
+		s->lock.lock();
+
+		s->tail+=n;
+		buf+=n;
+		len-=n;
+		if(s->pwait && (s->cap-(s->head-s->tail)>=s->step))
+			s->cond.notifyAll();
+	};
+	s->lock.unlock();
+}
+
+/*
+ * Runs the ctrl triples until newsize bytes are produced, reading old
+ * from oldpos on.
+ */
+static void apply(bs_reader *cbz2,source *dsrc,source *esrc,
+		oldfile *old,off_t oldpos,outbuf *out,off_t newsize)
+{
+	u_char buf[8];
+	u_char *p;
+	off_t newpos,done,n;
+	off_t ctrl[3];
+	int i;
 
-	/* Open patch file */
-	if ((f = fopen(diff, "rb")) == NULL)
-		err(1, "fopen(%s)", diff);
-
-	/*
-	File format:
-	0	8	"BSDIFF40"
-	8	8	X
-	16	8	Y
-	24	8	sizeof(newfile)
-	32	X	bzip2(control block)
-	32+X	Y	bzip2(diff block)
-	32+X+Y	???	bzip2(extra block)
-	with control block a set of triples (x,y,z) meaning "add x bytes
-	from oldfile to x bytes from the diff block; copy y bytes from the
-	extra block; seek forwards in oldfile by z bytes".
-	*/
-
-	/* Read header */
-	if (fread(header, 1, 32, f) < 32) {
-		if (feof(f))
-			errx(1, "Corrupt patch\n");
-		err(1, "fread(%s)", diff);
-	}
-
-	/* Check for appropriate magic */
-	if (memcmp(header, "BSDIFF40", 8) != 0)
-		errx(1, "Corrupt patch\n");
-
-	/* Read lengths from header */
-	bzctrllen=offtin(header+8);
-	bzdatalen=offtin(header+16);
-	newsize=offtin(header+24);
-	if((bzctrllen<0) || (bzdatalen<0) || (newsize<0))
-		errx(1,"Corrupt patch\n");
-
-	/* Close patch file and re-open it via libbzip2 at the right places */
-	if (fclose(f))
-		err(1, "fclose(%s)", diff);
-	if ((cpf = fopen(diff, "rb")) == NULL)
-		err(1, "fopen(%s)", diff);
-	if (fseeko(cpf, 32, SEEK_SET))
-		err(1, "fseeko(%s, %lld)", diff,
-		(long long)32);
-	if ((cpfbz2 = BZ2_bzReadOpen(&cbz2err, cpf, 0, 0, NULL, 0)) == NULL)
-		errx(1, "BZ2_bzReadOpen, bz2err = %d", cbz2err);
-	if ((dpf = fopen(diff, "rb")) == NULL)
-		err(1, "fopen(%s)", diff);
-	if (fseeko(dpf, 32 + bzctrllen, SEEK_SET))
-		err(1, "fseeko(%s, %lld)", diff,
-		(long long)(32 + bzctrllen));
-	if ((dpfbz2 = BZ2_bzReadOpen(&dbz2err, dpf, 0, 0, NULL, 0)) == NULL)
-		errx(1, "BZ2_bzReadOpen, bz2err = %d", dbz2err);
-	if ((epf = fopen(diff, "rb")) == NULL)
-		err(1, "fopen(%s)", diff);
-	if (fseeko(epf, 32 + bzctrllen + bzdatalen, SEEK_SET))
-		err(1, "fseeko(%s, %lld)", diff,
-		(long long)(32 + bzctrllen + bzdatalen));
-	if ((epfbz2 = BZ2_bzReadOpen(&ebz2err, epf, 0, 0, NULL, 0)) == NULL)
-		errx(1, "BZ2_bzReadOpen, bz2err = %d", ebz2err);
-
-	if(((fd=open(src,O_RDONLY|O_BINARY,0))<0) ||
-		((oldsize=lseek(fd,0,SEEK_END))==-1) ||
-		((old=(u_char*)malloc(oldsize+1))==NULL) ||
-		(lseek(fd,0,SEEK_SET)!=0) ||
-		(read(fd,old,oldsize)!=oldsize) ||
-		(close(fd)==-1)) err(1,"%s",src);
-	if((_new=(u_char*)malloc(newsize+1))==NULL) err(1,NULL);
-
-	oldpos=0;newpos=0;
+	newpos=0;
 	while(newpos<newsize) {
 		/* Read control data */
 		for(i=0;i<=2;i++) {
-			lenread = BZ2_bzRead(&cbz2err, cpfbz2, buf, 8);
-			if ((lenread < 8) || ((cbz2err != BZ_OK) &&
-				(cbz2err != BZ_STREAM_END)))
-				errx(1, "Corrupt patch\n");
-			bytesRead+=8;
-			//printf("cbz2err cpfbz2 %i %i\n", 8, bytesRead);
+			bs_reader_read(cbz2, buf, 8);
 			ctrl[i]=offtin(buf);
 		};
 
 		/* Sanity-check */
-		if(newpos+ctrl[0]>newsize)
-			errx(1,"Corrupt patch\n");
-
-		/* Read diff string */
-		lenread = BZ2_bzRead(&dbz2err, dpfbz2, _new + newpos, ctrl[0]);
-		bytesRead+=8;
-//		printf("dbz2err dpfbz2 %i %i\n", ctrl[0], bytesRead);
-		if ((lenread < ctrl[0]) ||
-			((dbz2err != BZ_OK) && (dbz2err != BZ_STREAM_END)))
-			errx(1, "Corrupt patch\n");
-
-		/* Add old data to diff string */
-		for(i=0;i<ctrl[0];i++)
-			if((oldpos+i>=0) && (oldpos+i<oldsize))
-				_new[newpos+i]+=old[oldpos+i];
+		if((ctrl[0]<0) || (ctrl[1]<0) || (newpos+ctrl[0]>newsize))
+			bs_fail(BSDIFF_ERR_CORRUPT);
+
+		/* Read diff string and add old data to it */
+		for(done=0;done<ctrl[0];done+=n) {
+			n=MIN(ctrl[0]-done,out->cap-out->len);
+			p=out->buf+out->len;
+			source_read(dsrc, p, n);
+			add_old(old, oldpos+done, p, n);
+			if((out->len+=n)==out->cap) out_flush(out);
+		};
 
 		/* Adjust pointers */
 		newpos+=ctrl[0];
@@ -212,35 +380,298 @@ int bspatch(const char* src, const char* dest, const char* diff)
 
 		/* Sanity-check */
 		if(newpos+ctrl[1]>newsize)
-			errx(1,"Corrupt patch\n");
+			bs_fail(BSDIFF_ERR_CORRUPT);
 
 		/* Read extra string */
-		lenread = BZ2_bzRead(&ebz2err, epfbz2, _new + newpos, ctrl[1]);
-		bytesRead+=8;
-//		printf("ebz2err epfbz2 %i %i\n", ctrl[1], bytesRead);
-		if ((lenread < ctrl[1]) ||
-			((ebz2err != BZ_OK) && (ebz2err != BZ_STREAM_END)))
-			errx(1, "Corrupt patch\n");
+		for(done=0;done<ctrl[1];done+=n) {
+			n=MIN(ctrl[1]-done,out->cap-out->len);
+			source_read(esrc, out->buf+out->len, n);
+			if((out->len+=n)==out->cap) out_flush(out);
+		};
 
 		/* Adjust pointers */
 		newpos+=ctrl[1];
 		oldpos+=ctrl[2];
 	};
+}
+
+/*
+ * Stops the decoders, which may still be ahead on unused trailing data or
+ * left behind by a failed apply, and releases their rings.
+ */
+static void apply_stop(source *src,Pixy::Thread *worker)
+{
+	int i;
+
+	for(i=0;i<=1;i++) {
+		src[i].lock.lock();
+		src[i].stop=true;
+		src[i].cond.notifyAll();
+		src[i].lock.unlock();
+		worker[i].join();
+		free(src[i].buf);
+	};
+}
+
+/*
+ * Applies one triple of blocks, decoding the diff and extra blocks ahead
+ * on two more threads when threads allows.
+ */
+static void apply_blocks(bs_reader *cbz2,bs_reader *dbz2,bs_reader *ebz2,
+		oldfile *old,off_t oldpos,outbuf *out,off_t newsize,int threads)
+{
+	source src[2];
+	Pixy::Thread worker[2];
+	int i;
+
+	src[0].r=dbz2;
+	src[1].r=ebz2;
+	for(i=0;i<=1;i++) {
+		src[i].cap=out->cap;
+		src[i].step=MIN(src[i].cap/2,BS_RINGSTEP);
+		src[i].head=src[i].tail=0;
+		src[i].eof=src[i].stop=false;
+		src[i].pwait=src[i].cwait=false;
+		src[i].status=BSDIFF_OK;
+		src[i].buf=NULL;
+		if((threads>1) &&
+			((src[i].buf=(u_char*)malloc(src[i].cap))!=NULL) &&
+			!worker[i].start(&source_fill,&src[i])) {
+			free(src[i].buf);
+			src[i].buf=NULL;
+		};
+	};
+
+	try {
+		apply(cbz2,&src[0],&src[1],old,oldpos,out,newsize);
+	} catch(...) {
+		apply_stop(src,worker);
+		throw;
+	};
+	apply_stop(src,worker);
+}
+
+/*
+ * Sets up a decompressor at the start of each of three consecutive
+ * blocks and applies them, closing the decompressors either way.
+ */
+static void apply_readers(BSDIFF_CODEC ccodec,
+		BSDIFF_CODEC dcodec,BSDIFF_CODEC ecodec,const u_char *p,
+		off_t clen,off_t dlen,off_t elen,
+		oldfile *old,off_t oldpos,outbuf *out,off_t newsize,int threads)
+{
+	bs_reader *r[3];
+	int i;
+
+	r[0]=r[1]=r[2]=NULL;
+	try {
+		r[0]=bs_reader_open(ccodec,p,clen);
+		r[1]=bs_reader_open(dcodec,p+clen,dlen);
+		r[2]=bs_reader_open(ecodec,p+clen+dlen,elen);
+		apply_blocks(r[0],r[1],r[2],old,oldpos,out,newsize,threads);
+	} catch(...) {
+		for(i=0;i<=2;i++) bs_reader_close(r[i]);
+		throw;
+	};
+	for(i=0;i<=2;i++) bs_reader_close(r[i]);
+}
+
+/*
+ * Applies the windows of a "BSDIFF4W" patch, see bsdiff.cpp for the
+ * layout, one after the other.
+ */
+static void apply_windows(const u_char *patch,off_t patchsize,
+		oldfile *old,outbuf *out,int threads)
+{
+	BSDIFF_CODEC codec;
+	off_t newsize,wmax,newpos,pos;
+	off_t base,wlen,clen,dlen,elen;
+
+	newsize=offtin(patch+8);
+	wmax=offtin(patch+16);
+	if((newsize<0) || (wmax<0) || (patch[24]>BSDIFF_CODEC_LZ4))
+		bs_fail(BSDIFF_ERR_CORRUPT);
+	codec=(BSDIFF_CODEC)patch[24];
+
+	pos=32;
+	for(newpos=0;newpos<newsize;newpos+=wlen) {
+		if(patchsize-pos<40)
+			bs_fail(BSDIFF_ERR_CORRUPT);
+		base=offtin(patch+pos);
+		wlen=offtin(patch+pos+8);
+		clen=offtin(patch+pos+16);
+		dlen=offtin(patch+pos+24);
+		elen=offtin(patch+pos+32);
+		pos+=40;
+		if((wlen<=0) || (wlen>wmax) || (wlen>newsize-newpos) ||
+			(clen<0) || (dlen<0) || (elen<0) ||
+			(clen>patchsize-pos) || (dlen>patchsize-pos-clen) ||
+			(elen>patchsize-pos-clen-dlen))
+			bs_fail(BSDIFF_ERR_CORRUPT);
+
+		apply_readers(codec,codec,codec,patch+pos,clen,dlen,elen,
+			old,base,out,wlen,threads);
+		pos+=clen+dlen+elen;
+	};
+}
+
+//int PATCH_main(int argc,char * argv[])
+BSDIFF_STATUS bspatch(const BSInput& inOld, const BSOutput& outNew,
+	const BSInput& inPatch, const BSPatchOptions& inOptions)
+{
+	BSDIFF_CODEC codec[3];
+	Pixy::MappedFile oldmap, patchmap;
+	bs_progress pr;
+	oldfile old;
+	outbuf out;
+	off_t newsize,patchsize,bufsize;
+	off_t bzctrllen,bzdatalen,hdrlen;
+	u_char *patch,*heap;
+	std::string tmp;
+	int i,threads;
+	BSDIFF_STATUS status;
+
+	//if(argc!=4) errx(1,"usage: %s oldfile newfile patchfile\n",argv[0]);
+
+	heap=NULL;
+	memset(&old,0,sizeof(old));
+	old.fd=-1;
+	memset(&out,0,sizeof(out));
+	out.fd=-1;
+	status=BSDIFF_OK;
+	try {
+		/* Load the patch file, it's decompressed straight from memory */
+		patch=load(inPatch,&patchmap,inOptions.Mapped,
+			Pixy::MappedFile::ADVISE_SEQUENTIAL,&patchsize,&heap);
+
+		/*
+		File format:
+		0	8	"BSDIFF40"
+		8	8	X
+		16	8	Y
+		24	8	sizeof(newfile)
+		32	X	bzip2(control block)
+		32+X	Y	bzip2(diff block)
+		32+X+Y	???	bzip2(extra block)
+		with control block a set of triples (x,y,z) meaning "add x bytes
+		from oldfile to x bytes from the diff block; copy y bytes from the
+		extra block; seek forwards in oldfile by z bytes".
+
+		A "BSDIFF4C" patch has the codec of the three blocks in bytes 32,
+		33 and 34 of a 40-byte header, see BSDIFF_CODEC. A "BSDIFF4W"
+		patch is a series of such triples of blocks, see bsdiff.cpp.
+		*/
+
+		/* Check for appropriate magic */
+		hdrlen=0;
+		bzctrllen=bzdatalen=newsize=0;
+		if ((patchsize >= 32) && (memcmp(patch, "BSDIFF40", 8) == 0)) {
+			hdrlen=32;
+			codec[0]=codec[1]=codec[2]=BSDIFF_CODEC_BZIP2;
+		} else if ((patchsize >= 40) && (memcmp(patch, "BSDIFF4C", 8) == 0)) {
+			hdrlen=40;
+			for(i=0;i<=2;i++) {
+				if(patch[32+i]>BSDIFF_CODEC_LZ4)
+					bs_fail(BSDIFF_ERR_CORRUPT);
+				codec[i]=(BSDIFF_CODEC)patch[32+i];
+			};
+		} else if ((patchsize < 32) || (memcmp(patch, "BSDIFF4W", 8) != 0))
+			bs_fail(BSDIFF_ERR_CORRUPT);
+
+		/* Read lengths from header */
+		if(hdrlen>0) {
+			bzctrllen=offtin(patch+8);
+			bzdatalen=offtin(patch+16);
+			newsize=offtin(patch+24);
+			if((bzctrllen<0) || (bzdatalen<0) || (newsize<0) ||
+				(bzctrllen>patchsize-hdrlen) ||
+				(bzdatalen>patchsize-hdrlen-bzctrllen))
+				bs_fail(BSDIFF_ERR_CORRUPT);
+		} else
+			newsize=offtin(patch+8);
+		bs_progress_init(&pr,inOptions.Progress,inOptions.ProgressData,newsize);
+
+		/* The old file is read at the offsets the patch dictates */
+		bufsize=(inOptions.BufferSize<4096) ? 4096 : (off_t)inOptions.BufferSize;
+		if(inOld.Path==NULL) {
+			if((inOld.Data==NULL) && (inOld.Size>0))
+				bs_fail(BSDIFF_ERR_ARGUMENT);
+			old.data=(const u_char*)inOld.Data;
+			old.size=(off_t)inOld.Size;
+		} else if(inOptions.Mapped) {
+			if(!oldmap.map(inOld.Path)) bs_fail(BSDIFF_ERR_IO);
+			oldmap.advise(Pixy::MappedFile::ADVISE_WILLNEED);
+			old.data=oldmap.getData();
+			old.size=(off_t)oldmap.getSize();
+		} else {
+			old.slots=bufsize/BS_PAGE;
+			if(((old.fd=open(inOld.Path,O_RDONLY|O_BINARY,0))<0) ||
+				((old.size=lseek(old.fd,0,SEEK_END))==-1))
+				bs_fail(BSDIFF_ERR_IO);
+			if(((old.buf=(u_char*)malloc(old.slots*BS_PAGE))==NULL) ||
+				((old.tag=(off_t*)malloc(old.slots*sizeof(off_t)))==NULL))
+				bs_fail(BSDIFF_ERR_MEMORY);
+			for(i=0;i<old.slots;i++) old.tag[i]=-1;
+		};
+
+		threads=Pixy::Thread::resolve(inOptions.Threads);
+		out.dst=&outNew;
+		out.pr=&pr;
+		out.cap=bufsize;
+		if((outNew.Path==NULL) && (outNew.Buffer==NULL) && (outNew.Sink==NULL))
+			bs_fail(BSDIFF_ERR_ARGUMENT);
+		if((out.buf=(u_char*)malloc(bufsize))==NULL)
+			bs_fail(BSDIFF_ERR_MEMORY);
+		/* A new file is written next to its path and renamed over it
+		   once whole: the old file or the patch may be that very file,
+		   and they're read as the new one is written */
+		if(outNew.Path!=NULL) {
+			tmp=std::string(outNew.Path)+".tmp";
+			if((out.fd=open(tmp.c_str(),
+				O_CREAT|O_TRUNC|O_WRONLY|O_BINARY,0666))<0)
+				bs_fail(BSDIFF_ERR_IO);
+#ifndef _WIN32
+			/* as a file patched in place keeps its mode */
+			struct stat st;
+			if(stat(outNew.Path,&st)==0)
+				fchmod(out.fd,st.st_mode&07777);
+#endif
+		};
+
+		if(hdrlen==0)
+			apply_windows(patch,patchsize,&old,&out,threads);
+		else
+			apply_readers(codec[0],codec[1],codec[2],patch+hdrlen,
+				bzctrllen,bzdatalen,patchsize-hdrlen-bzctrllen-bzdatalen,
+				&old,0,&out,newsize,threads);
+
+		/* Write what is left of the new file */
+		out_flush(&out);
+	} catch(...) {
+		status=bs_caught();
+	};
 
-	/* Clean up the bzip2 reads */
-	BZ2_bzReadClose(&cbz2err, cpfbz2);
-	BZ2_bzReadClose(&dbz2err, dpfbz2);
-	BZ2_bzReadClose(&ebz2err, epfbz2);
-	if (fclose(cpf) || fclose(dpf) || fclose(epf))
-		err(1, "fclose(%s)", diff);
+	if((out.fd>=0) && (close(out.fd)==-1) && (status==BSDIFF_OK))
+		status=BSDIFF_ERR_IO;
 
-	/* Write the new file */
-	if(((fd=open(dest,O_CREAT|O_TRUNC|O_WRONLY|O_BINARY,0666))<0) ||
-		(write(fd,_new,newsize)!=newsize) || (close(fd)==-1))
-		err(1,"%s",dest);
+	free(out.buf);
+	free(old.buf);
+	free(old.tag);
+	if(old.fd>=0) close(old.fd);
+	oldmap.unmap();
+	patchmap.unmap();
+	free(heap);
 
-	free(_new);
-	free(old);
+	/* Only a whole new file replaces the target, a partial one is
+	   dropped; only Windows won't rename over an existing file */
+	if(out.fd>=0) {
+#ifdef _WIN32
+		if(status==BSDIFF_OK) remove(outNew.Path);
+#endif
+		if((status==BSDIFF_OK) && rename(tmp.c_str(),outNew.Path))
+			status=BSDIFF_ERR_IO;
+		if(status!=BSDIFF_OK) remove(tmp.c_str());
+	};
 
-	return 0;
-}
\ No newline at end of file
+	return status;
+}
@@ -0,0 +1,148 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#include "checksum.h"
+#include "md5batch.h"
+#include "xxh3.h"
+#include "MappedFile.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Read buffer for the files that can't be mapped */
+#define CHECKSUM_BUFSIZE (1 << 20)
+
+const char* checksum_name(CHECKSUM_ALGO inAlgo)
+{
+	switch(inAlgo) {
+	case CHECKSUM_XXH3: return "xxh3";
+	default: return "md5";
+	};
+}
+
+bool checksum_algo(const std::string& inName, CHECKSUM_ALGO* outAlgo)
+{
+	if(inName=="md5") *outAlgo=CHECKSUM_MD5;
+	else if(inName=="xxh3") *outAlgo=CHECKSUM_XXH3;
+	else return false;
+	return true;
+}
+
+size_t checksum_size(CHECKSUM_ALGO inAlgo)
+{
+	return (inAlgo==CHECKSUM_XXH3) ? 8 : 16;
+}
+
+std::string checksum_hex(CHECKSUM_ALGO inAlgo, const unsigned char* inDigest)
+{
+	static const char xd[]="0123456789abcdef";
+	std::string hex(checksum_size(inAlgo)*2,'0');
+	size_t k;
+
+	for(k=0;k<checksum_size(inAlgo);k++) {
+		hex[k*2]=xd[inDigest[k]>>4];
+		hex[k*2+1]=xd[inDigest[k]&15];
+	};
+	return hex;
+}
+
+/* XXH3 digests are kept big endian, as xxhsum prints them */
+static void xxh3_bytes(uint64_t h,unsigned char *digest)
+{
+	int k;
+
+	for(k=0;k<8;k++)
+		digest[k]=(unsigned char)(h>>(56-8*k));
+}
+
+void checksum_buffers(CHECKSUM_ALGO inAlgo,
+	const unsigned char* const* inData,
+	const size_t* inSizes, size_t inCount,
+	unsigned char (*outDigests)[CHECKSUM_MAXSIZE])
+{
+	size_t i;
+
+	if(inAlgo==CHECKSUM_MD5) {
+		md5_buffers(inData,inSizes,inCount,outDigests);
+		return;
+	};
+	for(i=0;i<inCount;i++)
+		xxh3_bytes(xxh3_64(inData[i],inSizes[i]),outDigests[i]);
+}
+
+/*
+ * XXH3 keeps up with the page cache, so a file is hashed straight off its
+ * mapping. Pipes and the like, which map empty, are read instead.
+ */
+static bool xxh3_file(const std::string &path,uint64_t *h)
+{
+	Pixy::MappedFile map;
+	xxh3_state *s;
+	unsigned char *buf;
+	size_t n;
+	FILE *f;
+	bool ok;
+
+	if(map.map(path.c_str()) && (map.getSize()>0) &&
+			(map.getSize()==(size_t)map.getSize())) {
+		map.advise(Pixy::MappedFile::ADVISE_SEQUENTIAL);
+		*h=xxh3_64(map.getData(),(size_t)map.getSize());
+		return true;
+	};
+	map.unmap();
+
+	if((f=fopen(path.c_str(),"rb"))==NULL) return false;
+	s=(xxh3_state*)malloc(sizeof(xxh3_state));
+	buf=(unsigned char*)malloc(CHECKSUM_BUFSIZE);
+	if((s==NULL) || (buf==NULL)) {
+		free(s); free(buf); fclose(f);
+		return false;
+	};
+	xxh3_reset(s);
+	while((n=fread(buf,1,CHECKSUM_BUFSIZE,f))>0)
+		xxh3_update(s,buf,n);
+	ok=!ferror(f);
+	*h=xxh3_digest(s);
+	free(s); free(buf); fclose(f);
+	return ok;
+}
+
+size_t checksum_files(CHECKSUM_ALGO inAlgo,
+	const std::vector<std::string>& inPaths,
+	std::vector<std::string>* outDigests)
+{
+	unsigned char digest[CHECKSUM_MAXSIZE];
+	uint64_t h;
+	size_t i,done=0;
+
+	if(inAlgo==CHECKSUM_MD5)
+		return md5_files(inPaths,outDigests);
+
+	outDigests->assign(inPaths.size(),std::string());
+	for(i=0;i<inPaths.size();i++) {
+		if(!xxh3_file(inPaths[i],&h)) continue;
+		xxh3_bytes(h,digest);
+		(*outDigests)[i]=checksum_hex(CHECKSUM_XXH3,digest);
+		done++;
+	};
+	return done;
+}
@@ -0,0 +1,364 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#include "checksumcache.h"
+#include "chunkhash.h"
+#include "MappedFile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#define CACHE_MAGIC "KIWICSUM"
+#define CACHE_VERSION 3
+
+/* Files whose mtime is this close to the time they're hashed aren't cached */
+#define CACHE_RACY 2
+
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;		/* records */
+	uint64_t strings;	/* bytes of paths and manifests after the records */
+};
+
+struct cache_record {
+	uint64_t hash;		/* of the path, the records are sorted by it */
+	uint64_t size;
+	int64_t mtime;
+	uint64_t ino;
+	uint32_t mtime_ns;
+	uint32_t path;		/* offset within the paths */
+	uint32_t pathlen;
+	uint32_t algo;		/* CHECKSUM_ALGO of the digest */
+	uint32_t chunk;		/* chunk size of a tree hash, 0 for a whole file's */
+	uint32_t manifest;	/* bytes of the tree hash's manifest, after the path */
+	unsigned char digest[CHECKSUM_MAXSIZE];	/* or the root hash */
+};
+
+/* A record as it's written out: dropped ones only replace an older record */
+struct cache_entry {
+	cache_record r;
+	std::string path;
+	std::string manifest;
+	bool drop;
+};
+
+static bool entry_less(const cache_entry &a,const cache_entry &b)
+{
+	if(a.r.hash!=b.r.hash) return a.r.hash<b.r.hash;
+	return a.path<b.path;
+}
+
+static bool entry_same(const cache_entry &a,const cache_entry &b)
+{
+	return (a.r.hash==b.r.hash) && (a.path==b.path);
+}
+
+/* FNV-1a */
+static uint64_t path_hash(const std::string &path)
+{
+	uint64_t h=14695981039346656037ULL;
+	size_t i;
+
+	for(i=0;i<path.size();i++)
+		h=(h^(unsigned char)path[i])*1099511628211ULL;
+	return h;
+}
+
+static bool file_key(const std::string &path,cache_record *r)
+{
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+	struct _stat64 st;
+
+	if(_stat64(path.c_str(),&st)!=0) return false;
+	if(!(st.st_mode&_S_IFREG)) return false;
+	r->ino=0;
+	r->mtime_ns=0;
+#else
+	struct stat st;
+
+	if(stat(path.c_str(),&st)!=0) return false;
+	if(!S_ISREG(st.st_mode)) return false;
+	r->ino=(uint64_t)st.st_ino;
+#if defined(__APPLE__)
+	r->mtime_ns=(uint32_t)st.st_mtimespec.tv_nsec;
+#else
+	r->mtime_ns=(uint32_t)st.st_mtim.tv_nsec;
+#endif
+#endif
+	r->size=(uint64_t)st.st_size;
+	r->mtime=(int64_t)st.st_mtime;
+	return true;
+}
+
+/* Maps the cache in, returns its records or NULL if it's unusable */
+static const cache_record *cache_load(Pixy::MappedFile *map,
+	const std::string &file,uint32_t *count,const char **paths)
+{
+	cache_header h;
+	uint64_t need;
+
+	if(!map->map(file.c_str()) || (map->getSize()<sizeof(h)))
+		return NULL;
+	memcpy(&h,map->getData(),sizeof(h));
+	if(memcmp(h.magic,CACHE_MAGIC,8) || (h.version!=CACHE_VERSION))
+		return NULL;
+	need=sizeof(h)+(uint64_t)h.count*sizeof(cache_record)+h.strings;
+	if(need!=map->getSize())
+		return NULL;
+
+	*count=h.count;
+	*paths=(const char*)map->getData()+need-h.strings;
+	map->advise(Pixy::MappedFile::ADVISE_RANDOM);
+	return (const cache_record*)(map->getData()+sizeof(h));
+}
+
+static const cache_record *cache_find(const cache_record *rec,uint32_t count,
+	const char *paths,uint64_t strings,uint64_t hash,const std::string &path)
+{
+	uint32_t lo=0,hi=count,mid;
+
+	while(lo<hi) {
+		mid=lo+(hi-lo)/2;
+		if(rec[mid].hash<hash) lo=mid+1; else hi=mid;
+	};
+	for(;(lo<count) && (rec[lo].hash==hash);lo++)
+		if((rec[lo].pathlen==path.size()) &&
+				((uint64_t)rec[lo].path+rec[lo].pathlen+rec[lo].manifest<=strings) &&
+				!memcmp(paths+rec[lo].path,path.data(),path.size()))
+			return &rec[lo];
+	return NULL;
+}
+
+/* Writes the cache out to a temporary that is then renamed over it */
+static bool cache_save(const std::string &file,std::vector<cache_entry> &e)
+{
+	std::string tmp=file+".tmp";
+	cache_header h;
+	size_t i,n=0;
+	uint64_t off=0;
+	FILE *f;
+	bool ok;
+
+	for(i=0;i<e.size();i++) {
+		if(e[i].drop) continue;
+		e[i].r.path=(uint32_t)off;
+		e[i].r.pathlen=(uint32_t)e[i].path.size();
+		e[i].r.manifest=(uint32_t)e[i].manifest.size();
+		off+=e[i].path.size()+e[i].manifest.size();
+		n++;
+	};
+	if((off>UINT32_MAX) || (n>UINT32_MAX)) return false;
+
+	memset(&h,0,sizeof(h));
+	memcpy(h.magic,CACHE_MAGIC,8);
+	h.version=CACHE_VERSION;
+	h.count=(uint32_t)n;
+	h.strings=off;
+
+	if((f=fopen(tmp.c_str(),"wb"))==NULL) return false;
+	ok=(fwrite(&h,sizeof(h),1,f)==1);
+	for(i=0;ok && (i<e.size());i++)
+		if(!e[i].drop)
+			ok=(fwrite(&e[i].r,sizeof(cache_record),1,f)==1);
+	for(i=0;ok && (i<e.size());i++) {
+		if(e[i].drop) continue;
+		if(!e[i].path.empty())
+			ok=(fwrite(e[i].path.data(),e[i].path.size(),1,f)==1);
+		if(ok && !e[i].manifest.empty())
+			ok=(fwrite(e[i].manifest.data(),e[i].manifest.size(),1,f)==1);
+	};
+	if(fclose(f)!=0) ok=false;
+
+#if PIXY_PLATFORM == PIXY_PLATFORM_WIN32
+	if(ok) remove(file.c_str());
+#endif
+	if(!ok || (rename(tmp.c_str(),file.c_str())!=0)) {
+		remove(tmp.c_str());
+		return false;
+	};
+	return true;
+}
+
+static bool hex_parse(const std::string &hex,size_t n,unsigned char *digest)
+{
+	size_t k;
+	int hi,lo;
+
+	if(hex.size()!=n*2) return false;
+	for(k=0;k<n*2;k++)
+		if(!isxdigit((unsigned char)hex[k])) return false;
+	for(k=0;k<n;k++) {
+		hi=hex[k*2]; lo=hex[k*2+1];
+		hi=isdigit(hi) ? hi-'0' : (hi|0x20)-'a'+10;
+		lo=isdigit(lo) ? lo-'0' : (lo|0x20)-'a'+10;
+		digest[k]=(unsigned char)((hi<<4)|lo);
+	};
+	return true;
+}
+
+/*
+ * Both lookups: digests of whole files when chunk is 0, otherwise tree
+ * hashes over chunk-byte chunks, whose manifests go to outManifests.
+ */
+static size_t cache_run(CHECKSUM_ALGO inAlgo,size_t chunk,int threads,
+	const std::string& inRoot,
+	const std::vector<std::string>& inPaths,
+	std::vector<std::string>* outDigests,
+	std::vector<std::string>* outManifests)
+{
+	std::string file=inRoot+"/"+CHECKSUM_CACHEFILE;
+	std::vector<cache_entry> e;
+	std::vector<std::string> miss,missdigests;
+	std::vector<size_t> missidx;
+	Pixy::MappedFile map;
+	const cache_record *rec,*hit;
+	const char *paths=NULL;
+	uint32_t count=0;
+	uint64_t strings=0;
+	size_t i,j,done=0,size=checksum_size(inAlgo);
+	time_t now;
+
+	outDigests->assign(inPaths.size(),std::string());
+	if(outManifests) outManifests->assign(inPaths.size(),std::string());
+	if(chunk>UINT32_MAX) chunk=0;
+	rec=cache_load(&map,file,&count,&paths);
+	if(rec!=NULL)
+		strings=((const cache_header*)map.getData())->strings;
+
+	/* what changed is hashed in one batch, and remembered for the write */
+	e.resize(inPaths.size());
+	for(i=0;i<inPaths.size();i++) {
+		cache_entry &n=e[i];
+		memset(&n.r,0,sizeof(n.r));
+		n.path=inPaths[i];
+		if((n.path.compare(0,inRoot.size(),inRoot)==0) &&
+				(n.path.size()>inRoot.size()))
+			n.path.erase(0,inRoot.size());
+		n.r.hash=path_hash(n.path);
+		n.r.algo=(uint32_t)inAlgo;
+		n.r.chunk=(uint32_t)chunk;
+		n.drop=!file_key(inPaths[i],&n.r);
+
+		hit=(rec==NULL) ? NULL :
+			cache_find(rec,count,paths,strings,n.r.hash,n.path);
+		if(n.drop && (hit==NULL)) {
+			n.path.clear();
+			continue;
+		};
+		if(!n.drop && (hit!=NULL) && (hit->size==n.r.size) && (hit->mtime==n.r.mtime) &&
+				(hit->mtime_ns==n.r.mtime_ns) && (hit->ino==n.r.ino) && (hit->algo==n.r.algo) &&
+				(hit->chunk==n.r.chunk)) {
+			(*outDigests)[i]=checksum_hex(inAlgo,hit->digest);
+			if(outManifests)
+				(*outManifests)[i].assign(paths+hit->path+hit->pathlen,hit->manifest);
+			n.path.clear();
+			done++;
+			continue;
+		};
+		if(!n.drop) {
+			miss.push_back(inPaths[i]);
+			missidx.push_back(i);
+		};
+	};
+
+	/* nothing new and nothing gone, the cache stays as it is */
+	for(i=0;i<e.size();i++)
+		if(!e[i].path.empty()) break;
+	if(i==e.size())
+		return done;
+
+	if(chunk==0)
+		done+=checksum_files(inAlgo,miss,&missdigests);
+	else {
+		missdigests.assign(miss.size(),std::string());
+		for(j=0;j<miss.size();j++) {
+			cache_entry &n=e[missidx[j]];
+			if(chunkhash_file(inAlgo,miss[j],chunk,threads,
+					&missdigests[j],&n.manifest))
+				done++;
+			else {
+				missdigests[j].clear();
+				n.manifest.clear();
+			};
+			(*outManifests)[missidx[j]]=n.manifest;
+		};
+	};
+	now=time(NULL);
+	for(j=0;j<miss.size();j++) {
+		cache_entry &n=e[missidx[j]];
+		(*outDigests)[missidx[j]]=missdigests[j];
+		if(!hex_parse(missdigests[j],size,n.r.digest) ||
+				(n.r.mtime+CACHE_RACY>(int64_t)now))
+			n.drop=true;
+	};
+
+	/*
+	 * The entries hashed just now come ahead of the older records, so that
+	 * where both have a path the one kept by the stable sort is the new one.
+	 */
+	for(i=0,j=0;i<e.size();i++)
+		if(!e[i].path.empty()) e[j++]=e[i];
+	e.resize(j);
+	for(i=0;i<count;i++) {
+		cache_entry o;
+		if((uint64_t)rec[i].path+rec[i].pathlen+rec[i].manifest>strings)
+			continue;
+		o.r=rec[i];
+		o.path.assign(paths+rec[i].path,rec[i].pathlen);
+		o.manifest.assign(paths+rec[i].path+rec[i].pathlen,rec[i].manifest);
+		o.drop=false;
+		e.push_back(o);
+	};
+	map.unmap();
+
+	std::stable_sort(e.begin(),e.end(),entry_less);
+	e.erase(std::unique(e.begin(),e.end(),entry_same),e.end());
+	cache_save(file,e);
+
+	return done;
+}
+
+size_t checksum_cached(CHECKSUM_ALGO inAlgo,
+	const std::string& inRoot,
+	const std::vector<std::string>& inPaths,
+	std::vector<std::string>* outDigests)
+{
+	return cache_run(inAlgo,0,1,inRoot,inPaths,outDigests,NULL);
+}
+
+size_t checksum_cached_tree(CHECKSUM_ALGO inAlgo,
+	const std::string& inRoot,
+	const std::vector<std::string>& inPaths,
+	size_t inChunk, int inThreads,
+	std::vector<std::string>* outRoots,
+	std::vector<std::string>* outManifests)
+{
+	return cache_run(inAlgo,inChunk,inThreads,inRoot,inPaths,outRoots,outManifests);
+}
@@ -0,0 +1,187 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#include "chunkhash.h"
+#include "MappedFile.h"
+#include "Thread.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <sstream>
+#include <stdexcept>
+
+struct chunk_job {
+	CHECKSUM_ALGO algo;
+	const unsigned char *data;
+	uint64_t size;
+	size_t chunk;
+	size_t count;		/* chunks to hash, the last may be short */
+	int threads;
+	unsigned char (*digests)[CHECKSUM_MAXSIZE];
+};
+
+/* Each thread hashes a run of consecutive chunks, all in one batch */
+static void chunk_run(void *data,int idx)
+{
+	chunk_job *j=(chunk_job*)data;
+	size_t from=j->count*idx/j->threads,to=j->count*(idx+1)/j->threads,i;
+	std::vector<const unsigned char*> p(to-from);
+	std::vector<size_t> n(to-from);
+	uint64_t off;
+
+	for(i=from;i<to;i++) {
+		off=(uint64_t)i*j->chunk;
+		p[i-from]=j->data+off;
+		n[i-from]=(size_t)((j->size-off<j->chunk) ? j->size-off : j->chunk);
+	};
+	if(to>from)
+		checksum_buffers(j->algo,&p[0],&n[0],to-from,j->digests+from);
+}
+
+static void chunk_hash(chunk_job *j,int threads)
+{
+	j->threads=Pixy::Thread::resolve(threads);
+	if((size_t)j->threads>j->count)
+		j->threads=(j->count>0) ? (int)j->count : 1;
+	Pixy::Thread::runAll(j->threads,&chunk_run,j);
+}
+
+/* digest of the chunk digests, each checksum_size() bytes, back to back */
+static std::string chunk_root(CHECKSUM_ALGO algo,
+	const std::vector<unsigned char> &digests)
+{
+	unsigned char root[1][CHECKSUM_MAXSIZE];
+	const unsigned char *p=digests.empty() ? (const unsigned char*)"" : &digests[0];
+	size_t n=digests.size();
+
+	checksum_buffers(algo,&p,&n,1,root);
+	return checksum_hex(algo,root[0]);
+}
+
+static bool hex_byte(const char *s,unsigned char *b)
+{
+	unsigned int v;
+
+	if(!isxdigit((unsigned char)s[0]) || !isxdigit((unsigned char)s[1]))
+		return false;
+	sscanf(s,"%2x",&v);
+	*b=(unsigned char)v;
+	return true;
+}
+
+bool chunkhash_file(CHECKSUM_ALGO inAlgo, const std::string& inPath,
+	size_t inChunk, int inThreads,
+	std::string* outRoot, std::string* outManifest)
+{
+	Pixy::MappedFile map;
+	std::vector<unsigned char> flat;
+	std::ostringstream m;
+	chunk_job j;
+	size_t i,size=checksum_size(inAlgo);
+
+	if(!map.map(inPath.c_str()) || (map.getSize()!=(size_t)map.getSize()))
+		return false;
+	map.advise(Pixy::MappedFile::ADVISE_WILLNEED);
+
+	j.algo=inAlgo;
+	j.data=map.getData();
+	j.size=map.getSize();
+	j.chunk=inChunk;
+	j.count=(size_t)(j.size/inChunk+(j.size%inChunk!=0));
+	std::vector<unsigned char> digests(j.count*CHECKSUM_MAXSIZE+1);
+	j.digests=(unsigned char (*)[CHECKSUM_MAXSIZE])&digests[0];
+	chunk_hash(&j,inThreads);
+
+	m << "CHUNKS " << checksum_name(inAlgo) << " " << inChunk << " "
+		<< j.size << " " << j.count << "\n";
+	for(i=0;i<j.count;i++) {
+		m << checksum_hex(inAlgo,j.digests[i]) << "\n";
+		flat.insert(flat.end(),j.digests[i],j.digests[i]+size);
+	};
+	*outRoot=chunk_root(inAlgo,flat);
+	*outManifest=m.str();
+	return true;
+}
+
+bool chunkhash_verify(const std::string& inManifest, const std::string& inRoot,
+	const std::string& inPath, int inThreads,
+	std::vector<size_t>* outBad)
+{
+	std::istringstream m(inManifest);
+	std::string tag,name,line;
+	std::vector<unsigned char> flat;
+	Pixy::MappedFile map;
+	CHECKSUM_ALGO algo;
+	uint64_t size,have=0;
+	size_t chunk,count,i,k,dsize;
+	chunk_job j;
+
+	outBad->clear();
+	if(!(m >> tag >> name >> chunk >> size >> count) || (tag!="CHUNKS") ||
+			!checksum_algo(name,&algo) || (chunk==0) ||
+			(count!=size/chunk+(size%chunk!=0)))
+		return false;
+
+	/* the manifest comes with the download: it can't list more chunks
+	   than it has lines for, and it is only trusted once it hashes to
+	   the root */
+	dsize=checksum_size(algo);
+	if(count>inManifest.size()/(dsize*2+1))
+		return false;
+	try {
+		flat.resize(count*dsize);
+		for(i=0;i<count;i++) {
+			if(!(m >> line) || (line.size()!=dsize*2)) return false;
+			for(k=0;k<dsize;k++)
+				if(!hex_byte(line.c_str()+k*2,&flat[i*dsize+k])) return false;
+		};
+		if(chunk_root(algo,flat)!=inRoot)
+			return false;
+
+		/* only the chunks the file holds whole can be checked */
+		if(map.map(inPath.c_str()) && (map.getSize()==(size_t)map.getSize())) {
+			have=(map.getSize()<size) ? map.getSize() : size;
+			map.advise(Pixy::MappedFile::ADVISE_WILLNEED);
+		};
+
+		j.algo=algo;
+		j.data=map.getData();
+		j.size=have;
+		j.chunk=chunk;
+		j.count=(have==size) ? count : (size_t)(have/chunk);
+		std::vector<unsigned char> digests(j.count*CHECKSUM_MAXSIZE+1);
+		j.digests=(unsigned char (*)[CHECKSUM_MAXSIZE])&digests[0];
+		chunk_hash(&j,inThreads);
+
+		for(i=0;i<count;i++)
+			if((i>=j.count) || memcmp(j.digests[i],&flat[i*dsize],dsize))
+				outBad->push_back(i);
+	} catch(const std::bad_alloc &) {
+		outBad->clear();
+		return false;
+	} catch(const std::length_error &) {
+		outBad->clear();
+		return false;
+	};
+	return true;
+}
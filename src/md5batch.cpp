@@ -0,0 +1,505 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#include "md5batch.h"
+#include "bskernels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MD5_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#define MD5_TARGET(x)
+#else
+#define MD5_TARGET(x) __attribute__((target(x)))
+#endif
+
+/* Read buffer of each lane that hashes a file */
+#define MD5_BUFSIZE (64*1024)
+
+/* The most lanes any kernel has */
+#define MD5_MAXLANES 16
+
+/*
+ * The 64 steps of MD5, RFC 1321, written once against the V_ macros which
+ * each kernel below defines for its vector type; F and G are the usual
+ * rewrites that save the complement. (MD5_H is md5.hpp's include guard.)
+ */
+#define MD5_RF(b,c,d) V_XOR(d,V_AND(b,V_XOR(c,d)))
+#define MD5_RG(b,c,d) V_XOR(c,V_AND(d,V_XOR(b,c)))
+#define MD5_RH(b,c,d) V_XOR(V_XOR(b,c),d)
+#define MD5_RI(b,c,d) V_XOR(c,V_OR(b,V_NOT(d)))
+
+#define MD5_STEP(f,a,b,c,d,k,s,t) { \
+	a=V_ADD(a,V_ADD(f(b,c,d),V_ADD(x[k],V_SET1(t)))); \
+	a=V_ADD(V_ROL(a,s),b); \
+}
+
+#define MD5_ROUNDS \
+	MD5_STEP(MD5_RF,a,b,c,d, 0, 7,0xd76aa478) \
+	MD5_STEP(MD5_RF,d,a,b,c, 1,12,0xe8c7b756) \
+	MD5_STEP(MD5_RF,c,d,a,b, 2,17,0x242070db) \
+	MD5_STEP(MD5_RF,b,c,d,a, 3,22,0xc1bdceee) \
+	MD5_STEP(MD5_RF,a,b,c,d, 4, 7,0xf57c0faf) \
+	MD5_STEP(MD5_RF,d,a,b,c, 5,12,0x4787c62a) \
+	MD5_STEP(MD5_RF,c,d,a,b, 6,17,0xa8304613) \
+	MD5_STEP(MD5_RF,b,c,d,a, 7,22,0xfd469501) \
+	MD5_STEP(MD5_RF,a,b,c,d, 8, 7,0x698098d8) \
+	MD5_STEP(MD5_RF,d,a,b,c, 9,12,0x8b44f7af) \
+	MD5_STEP(MD5_RF,c,d,a,b,10,17,0xffff5bb1) \
+	MD5_STEP(MD5_RF,b,c,d,a,11,22,0x895cd7be) \
+	MD5_STEP(MD5_RF,a,b,c,d,12, 7,0x6b901122) \
+	MD5_STEP(MD5_RF,d,a,b,c,13,12,0xfd987193) \
+	MD5_STEP(MD5_RF,c,d,a,b,14,17,0xa679438e) \
+	MD5_STEP(MD5_RF,b,c,d,a,15,22,0x49b40821) \
+	MD5_STEP(MD5_RG,a,b,c,d, 1, 5,0xf61e2562) \
+	MD5_STEP(MD5_RG,d,a,b,c, 6, 9,0xc040b340) \
+	MD5_STEP(MD5_RG,c,d,a,b,11,14,0x265e5a51) \
+	MD5_STEP(MD5_RG,b,c,d,a, 0,20,0xe9b6c7aa) \
+	MD5_STEP(MD5_RG,a,b,c,d, 5, 5,0xd62f105d) \
+	MD5_STEP(MD5_RG,d,a,b,c,10, 9,0x02441453) \
+	MD5_STEP(MD5_RG,c,d,a,b,15,14,0xd8a1e681) \
+	MD5_STEP(MD5_RG,b,c,d,a, 4,20,0xe7d3fbc8) \
+	MD5_STEP(MD5_RG,a,b,c,d, 9, 5,0x21e1cde6) \
+	MD5_STEP(MD5_RG,d,a,b,c,14, 9,0xc33707d6) \
+	MD5_STEP(MD5_RG,c,d,a,b, 3,14,0xf4d50d87) \
+	MD5_STEP(MD5_RG,b,c,d,a, 8,20,0x455a14ed) \
+	MD5_STEP(MD5_RG,a,b,c,d,13, 5,0xa9e3e905) \
+	MD5_STEP(MD5_RG,d,a,b,c, 2, 9,0xfcefa3f8) \
+	MD5_STEP(MD5_RG,c,d,a,b, 7,14,0x676f02d9) \
+	MD5_STEP(MD5_RG,b,c,d,a,12,20,0x8d2a4c8a) \
+	MD5_STEP(MD5_RH,a,b,c,d, 5, 4,0xfffa3942) \
+	MD5_STEP(MD5_RH,d,a,b,c, 8,11,0x8771f681) \
+	MD5_STEP(MD5_RH,c,d,a,b,11,16,0x6d9d6122) \
+	MD5_STEP(MD5_RH,b,c,d,a,14,23,0xfde5380c) \
+	MD5_STEP(MD5_RH,a,b,c,d, 1, 4,0xa4beea44) \
+	MD5_STEP(MD5_RH,d,a,b,c, 4,11,0x4bdecfa9) \
+	MD5_STEP(MD5_RH,c,d,a,b, 7,16,0xf6bb4b60) \
+	MD5_STEP(MD5_RH,b,c,d,a,10,23,0xbebfbc70) \
+	MD5_STEP(MD5_RH,a,b,c,d,13, 4,0x289b7ec6) \
+	MD5_STEP(MD5_RH,d,a,b,c, 0,11,0xeaa127fa) \
+	MD5_STEP(MD5_RH,c,d,a,b, 3,16,0xd4ef3085) \
+	MD5_STEP(MD5_RH,b,c,d,a, 6,23,0x04881d05) \
+	MD5_STEP(MD5_RH,a,b,c,d, 9, 4,0xd9d4d039) \
+	MD5_STEP(MD5_RH,d,a,b,c,12,11,0xe6db99e5) \
+	MD5_STEP(MD5_RH,c,d,a,b,15,16,0x1fa27cf8) \
+	MD5_STEP(MD5_RH,b,c,d,a, 2,23,0xc4ac5665) \
+	MD5_STEP(MD5_RI,a,b,c,d, 0, 6,0xf4292244) \
+	MD5_STEP(MD5_RI,d,a,b,c, 7,10,0x432aff97) \
+	MD5_STEP(MD5_RI,c,d,a,b,14,15,0xab9423a7) \
+	MD5_STEP(MD5_RI,b,c,d,a, 5,21,0xfc93a039) \
+	MD5_STEP(MD5_RI,a,b,c,d,12, 6,0x655b59c3) \
+	MD5_STEP(MD5_RI,d,a,b,c, 3,10,0x8f0ccc92) \
+	MD5_STEP(MD5_RI,c,d,a,b,10,15,0xffeff47d) \
+	MD5_STEP(MD5_RI,b,c,d,a, 1,21,0x85845dd1) \
+	MD5_STEP(MD5_RI,a,b,c,d, 8, 6,0x6fa87e4f) \
+	MD5_STEP(MD5_RI,d,a,b,c,15,10,0xfe2ce6e0) \
+	MD5_STEP(MD5_RI,c,d,a,b, 6,15,0xa3014314) \
+	MD5_STEP(MD5_RI,b,c,d,a,13,21,0x4e0811a1) \
+	MD5_STEP(MD5_RI,a,b,c,d, 4, 6,0xf7537e82) \
+	MD5_STEP(MD5_RI,d,a,b,c,11,10,0xbd3af235) \
+	MD5_STEP(MD5_RI,c,d,a,b, 2,15,0x2ad7d2bb) \
+	MD5_STEP(MD5_RI,b,c,d,a, 9,21,0xeb86d391)
+
+/*
+ * Kernels: one 64-byte block for each of L lanes. The states are held
+ * word by word, st[r*L+lane] being word r of a lane's state, and so are
+ * the blocks, blk[k*L+lane] being word k of a lane's block.
+ */
+#define MD5_BODY(L) \
+	a=a0=V_LOAD(st); \
+	b=b0=V_LOAD(st+L); \
+	c=c0=V_LOAD(st+2*L); \
+	d=d0=V_LOAD(st+3*L); \
+	for(k=0;k<16;k++) x[k]=V_LOAD(blk+k*L); \
+	MD5_ROUNDS \
+	V_STORE(st,V_ADD(a,a0)); \
+	V_STORE(st+L,V_ADD(b,b0)); \
+	V_STORE(st+2*L,V_ADD(c,c0)); \
+	V_STORE(st+3*L,V_ADD(d,d0));
+
+#define V_ADD(a,b) ((a)+(b))
+#define V_AND(a,b) ((a)&(b))
+#define V_OR(a,b) ((a)|(b))
+#define V_XOR(a,b) ((a)^(b))
+#define V_NOT(a) (~(a))
+#define V_ROL(a,s) (((a)<<(s))|((a)>>(32-(s))))
+#define V_SET1(t) ((uint32_t)(t))
+#define V_LOAD(p) (*(p))
+#define V_STORE(p,v) (*(p)=(v))
+static void md5_x1(uint32_t *st,const uint32_t *blk)
+{
+	uint32_t a,b,c,d,a0,b0,c0,d0,x[16];
+	int k;
+
+	MD5_BODY(1)
+}
+#undef V_ADD
+#undef V_AND
+#undef V_OR
+#undef V_XOR
+#undef V_NOT
+#undef V_ROL
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+
+#ifdef MD5_X86
+#define V_ADD(a,b) _mm_add_epi32(a,b)
+#define V_AND(a,b) _mm_and_si128(a,b)
+#define V_OR(a,b) _mm_or_si128(a,b)
+#define V_XOR(a,b) _mm_xor_si128(a,b)
+#define V_NOT(a) _mm_xor_si128(a,_mm_set1_epi32(-1))
+#define V_ROL(a,s) _mm_or_si128(_mm_slli_epi32(a,s),_mm_srli_epi32(a,32-(s)))
+#define V_SET1(t) _mm_set1_epi32((int)(t))
+#define V_LOAD(p) _mm_loadu_si128((const __m128i*)(p))
+#define V_STORE(p,v) _mm_storeu_si128((__m128i*)(p),v)
+MD5_TARGET("sse2")
+static void md5_x4(uint32_t *st,const uint32_t *blk)
+{
+	__m128i a,b,c,d,a0,b0,c0,d0,x[16];
+	int k;
+
+	MD5_BODY(4)
+}
+#undef V_ADD
+#undef V_AND
+#undef V_OR
+#undef V_XOR
+#undef V_NOT
+#undef V_ROL
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+
+#define V_ADD(a,b) _mm256_add_epi32(a,b)
+#define V_AND(a,b) _mm256_and_si256(a,b)
+#define V_OR(a,b) _mm256_or_si256(a,b)
+#define V_XOR(a,b) _mm256_xor_si256(a,b)
+#define V_NOT(a) _mm256_xor_si256(a,_mm256_set1_epi32(-1))
+#define V_ROL(a,s) _mm256_or_si256(_mm256_slli_epi32(a,s), \
+	_mm256_srli_epi32(a,32-(s)))
+#define V_SET1(t) _mm256_set1_epi32((int)(t))
+#define V_LOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+#define V_STORE(p,v) _mm256_storeu_si256((__m256i*)(p),v)
+MD5_TARGET("avx2")
+static void md5_x8(uint32_t *st,const uint32_t *blk)
+{
+	__m256i a,b,c,d,a0,b0,c0,d0,x[16];
+	int k;
+
+	MD5_BODY(8)
+}
+#undef V_ADD
+#undef V_AND
+#undef V_OR
+#undef V_XOR
+#undef V_NOT
+#undef V_ROL
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+
+/* AVX-512F has a rotate, and complements with a single ternary op */
+#define V_ADD(a,b) _mm512_add_epi32(a,b)
+#define V_AND(a,b) _mm512_and_si512(a,b)
+#define V_OR(a,b) _mm512_or_si512(a,b)
+#define V_XOR(a,b) _mm512_xor_si512(a,b)
+#define V_NOT(a) _mm512_ternarylogic_epi32(a,a,a,0x55)
+#define V_ROL(a,s) _mm512_maskz_rol_epi32(0xffff,a,s)
+#define V_SET1(t) _mm512_set1_epi32((int)(t))
+#define V_LOAD(p) _mm512_loadu_si512((const void*)(p))
+#define V_STORE(p,v) _mm512_storeu_si512((void*)(p),v)
+MD5_TARGET("avx512f")
+static void md5_x16(uint32_t *st,const uint32_t *blk)
+{
+	__m512i a,b,c,d,a0,b0,c0,d0,x[16];
+	int k;
+
+	MD5_BODY(16)
+}
+#undef V_ADD
+#undef V_AND
+#undef V_OR
+#undef V_XOR
+#undef V_NOT
+#undef V_ROL
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#endif
+
+struct md5_kernel_set {
+	const char *name;
+	int lanes;
+	void (*blocks)(uint32_t*,const uint32_t*);
+};
+
+static const md5_kernel_set md5_scalar={ "scalar",1,md5_x1 };
+#ifdef MD5_X86
+static const md5_kernel_set md5_sse2={ "sse2",4,md5_x4 };
+static const md5_kernel_set md5_avx2={ "avx2",8,md5_x8 };
+static const md5_kernel_set md5_avx512={ "avx512",16,md5_x16 };
+#endif
+
+static const md5_kernel_set *md5_pick()
+{
+#ifdef MD5_X86
+	unsigned int cpu=bs_cpu();
+
+	if(cpu&BS_CPU_AVX512) return &md5_avx512;
+	if(cpu&BS_CPU_AVX2) return &md5_avx2;
+	if(cpu&BS_CPU_SSE2) return &md5_sse2;
+#endif
+	return &md5_scalar;
+}
+
+/* resolved once during static initialisation, before any thread exists */
+static const md5_kernel_set *MK=md5_pick();
+
+/*
+ * A message being hashed in a lane, handed out 64-byte block by block.
+ * Files are read into buf; memory is hashed in place. Once the bytes run
+ * out the padding and length make up the last one or two blocks.
+ */
+struct md5_stream {
+	FILE *f;
+	const unsigned char *p;	/* bytes not handed out yet */
+	size_t n;
+	unsigned char *buf;
+	uint64_t len;		/* bytes handed out so far */
+	int pads,tail;		/* padding blocks, and how many are left; -1 before */
+	unsigned char pad[128];
+	bool failed;
+};
+
+/* Starts input i in a stream; false if it can't be */
+typedef bool (*md5_start)(md5_stream *s,size_t i,void *ctx);
+
+/* Receives the digest of input i, NULL if it failed */
+typedef void (*md5_finish)(size_t i,const unsigned char *digest,void *ctx);
+
+static const unsigned char *stream_block(md5_stream *s)
+{
+	const unsigned char *p;
+	size_t r;
+	uint64_t bits;
+	int k;
+
+	if(s->tail<0) {
+		while((s->n<64) && (s->f!=NULL)) {
+			memmove(s->buf,s->p,s->n);
+			s->p=s->buf;
+			r=fread(s->buf+s->n,1,MD5_BUFSIZE-s->n,s->f);
+			s->n+=r;
+			if(r==0) {
+				if(ferror(s->f)) s->failed=true;
+				fclose(s->f);
+				s->f=NULL;
+			};
+		};
+
+		if(s->n>=64) {
+			p=s->p;
+			s->p+=64;
+			s->n-=64;
+			s->len+=64;
+			return p;
+		};
+
+		memset(s->pad,0,sizeof(s->pad));
+		memcpy(s->pad,s->p,s->n);
+		s->pad[s->n]=0x80;
+		s->pads=s->tail=(s->n<56) ? 1 : 2;
+		s->len+=s->n;
+		s->n=0;
+		for(bits=s->len<<3,k=0;k<8;k++,bits>>=8)
+			s->pad[s->pads*64-8+k]=(unsigned char)bits;
+	};
+
+	return s->pad+64*(s->pads-s->tail--);
+}
+
+static void lane_reset(uint32_t *st,int L,int l)
+{
+	st[l]=0x67452301;
+	st[L+l]=0xefcdab89;
+	st[2*L+l]=0x98badcfe;
+	st[3*L+l]=0x10325476;
+}
+
+/* Gives the lane the next input that can be started, if any */
+static bool lane_start(md5_stream *s,size_t *next,size_t count,
+		size_t *which,md5_start start,md5_finish finish,void *ctx)
+{
+	for(;*next<count;(*next)++) {
+		s->f=NULL;
+		s->p=NULL;
+		s->n=0;
+		s->len=0;
+		s->pads=s->tail=-1;
+		s->failed=false;
+		if(start(s,*next,ctx)) {
+			*which=(*next)++;
+			return true;
+		};
+		finish(*next,NULL,ctx);
+	};
+
+	return false;
+}
+
+/*
+ * Hashes count inputs in the lanes of the kernel, each lane taking the
+ * next input as soon as it is done with one. Lanes left without input
+ * hash whatever their block holds, which is then thrown away.
+ */
+static void md5_lanes(size_t count,md5_start start,md5_finish finish,
+		void *ctx)
+{
+	const int L=MK->lanes;
+	md5_stream s[MD5_MAXLANES];
+	size_t which[MD5_MAXLANES],next=0;
+	bool busy[MD5_MAXLANES];
+	uint32_t st[4*MD5_MAXLANES],blk[16*MD5_MAXLANES];
+	unsigned char digest[16];
+	const unsigned char *p;
+	int l,k,r,active=0;
+
+	memset(blk,0,sizeof(blk));
+	for(l=0;l<L;l++) {
+		s[l].buf=NULL;
+		busy[l]=lane_start(&s[l],&next,count,&which[l],start,finish,ctx);
+		if(busy[l]) active++;
+		lane_reset(st,L,l);
+	};
+
+	while(active>0) {
+		for(l=0;l<L;l++) {
+			if(!busy[l]) continue;
+			p=stream_block(&s[l]);
+			for(k=0;k<16;k++,p+=4)
+				blk[k*L+l]=(uint32_t)p[0]|((uint32_t)p[1]<<8)|
+					((uint32_t)p[2]<<16)|((uint32_t)p[3]<<24);
+		};
+
+		MK->blocks(st,blk);
+
+		for(l=0;l<L;l++) {
+			if(!busy[l] || (s[l].tail!=0)) continue;
+			for(r=0;r<4;r++)
+				for(k=0;k<4;k++)
+					digest[r*4+k]=(unsigned char)(st[r*L+l]>>(8*k));
+			finish(which[l],s[l].failed ? NULL : digest,ctx);
+
+			lane_reset(st,L,l);
+			busy[l]=lane_start(&s[l],&next,count,&which[l],start,finish,ctx);
+			if(!busy[l]) active--;
+		};
+	};
+
+	for(l=0;l<L;l++) free(s[l].buf);
+}
+
+struct md5_filejob {
+	const std::vector<std::string> *paths;
+	std::vector<std::string> *digests;
+	size_t done;
+};
+
+static bool file_start(md5_stream *s,size_t i,void *ctx)
+{
+	md5_filejob *j=(md5_filejob*)ctx;
+
+	if((s->buf==NULL) && ((s->buf=(unsigned char*)malloc(MD5_BUFSIZE))==NULL))
+		return false;
+	if((s->f=fopen((*j->paths)[i].c_str(),"rb"))==NULL)
+		return false;
+	s->p=s->buf;
+	return true;
+}
+
+static void file_finish(size_t i,const unsigned char *digest,void *ctx)
+{
+	md5_filejob *j=(md5_filejob*)ctx;
+	char hex[33];
+	int k;
+
+	if(digest==NULL) return;
+	for(k=0;k<16;k++)
+		sprintf(hex+k*2,"%02x",digest[k]);
+	(*j->digests)[i]=hex;
+	j->done++;
+}
+
+size_t md5_files(const std::vector<std::string>& inPaths,
+	std::vector<std::string>* outDigests)
+{
+	md5_filejob j={&inPaths,outDigests,0};
+
+	outDigests->assign(inPaths.size(),std::string());
+	md5_lanes(inPaths.size(),&file_start,&file_finish,&j);
+
+	return j.done;
+}
+
+struct md5_memjob {
+	const unsigned char* const *data;
+	const size_t *sizes;
+	unsigned char (*digests)[16];
+};
+
+static bool mem_start(md5_stream *s,size_t i,void *ctx)
+{
+	md5_memjob *j=(md5_memjob*)ctx;
+
+	s->p=j->data[i];
+	s->n=j->sizes[i];
+	return true;
+}
+
+static void mem_finish(size_t i,const unsigned char *digest,void *ctx)
+{
+	md5_memjob *j=(md5_memjob*)ctx;
+
+	memcpy(j->digests[i],digest,16);
+}
+
+void md5_buffers(const unsigned char* const* inData, const size_t* inSizes,
+	size_t inCount, unsigned char (*outDigests)[16])
+{
+	md5_memjob j={inData,inSizes,outDigests};
+
+	md5_lanes(inCount,&mem_start,&mem_finish,&j);
+}
+
+const char* md5_kernels()
+{
+	return MK->name;
+}
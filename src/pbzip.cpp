@@ -0,0 +1,217 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#include "pbzip.h"
+#include "bserror.h"
+#include "Thread.h"
+#include <stdlib.h>
+#include <string.h>
+#include <bzlib.h>
+
+/* Sized for a level 9 stream to hold it in one block; runs that bzip2's
+   initial run-length coding expands can still spill into a second one,
+   which is as valid a stream */
+#define PBZ_CHUNK (9*100000-19)
+
+/* Room for the compressed chunk, as libbzip2 documents it */
+#define PBZ_BOUND (PBZ_CHUNK+PBZ_CHUNK/100+600)
+
+typedef enum { PBZ_FREE, PBZ_PENDING, PBZ_WORKING, PBZ_DONE, PBZ_FAILED } PBZ_STATE;
+
+struct pbz_slot {
+	PBZ_STATE state;
+	char *in,*out;
+	unsigned int inlen,outlen;
+};
+
+/*
+ * Chunk n is filled and written from slot n%nslots, by the caller, and
+ * compressed there by whichever worker takes it; the caller only reuses a
+ * slot once it has written it out, so that the output stays in order.
+ */
+struct pbz_writer {
+	FILE *f;
+	int nthreads,nslots;
+	Pixy::Thread *workers;
+	pbz_slot *slots;
+	uint64_t filled;	/* chunks handed to the workers */
+	uint64_t taken;		/* of them, taken up by a worker */
+	uint64_t written;	/* of them, written out */
+	bool stop;
+	Pixy::Mutex lock;
+	Pixy::Condition cond;
+};
+
+static void pbz_work(void *data,int)
+{
+	pbz_writer *w=(pbz_writer*)data;
+	pbz_slot *s;
+	int r;
+
+	w->lock.lock();
+	for(;;) {
+		while(!w->stop && (w->taken==w->filled))
+			w->cond.wait(w->lock);
+		if(w->stop) break;
+
+		s=&w->slots[w->taken%w->nslots];
+		w->taken++;
+		s->state=PBZ_WORKING;
+		w->lock.unlock();
+
+		s->outlen=PBZ_BOUND;
+		r=BZ2_bzBuffToBuffCompress(s->out,&s->outlen,s->in,s->inlen,9,0,0);
+
+		w->lock.lock();
+		s->state=(r==BZ_OK) ? PBZ_DONE : PBZ_FAILED;
+		w->cond.notifyAll();
+	};
+	w->lock.unlock();
+}
+
+static void pbz_stop(pbz_writer *w)
+{
+	int i;
+
+	w->lock.lock();
+	w->stop=true;
+	w->cond.notifyAll();
+	w->lock.unlock();
+	for(i=0;i<w->nthreads;i++)
+		w->workers[i].join();
+}
+
+/* Waits for the oldest chunk not written yet and writes it */
+static void pbz_drain(pbz_writer *w)
+{
+	pbz_slot *s=&w->slots[w->written%w->nslots];
+
+	w->lock.lock();
+	while((s->state==PBZ_PENDING) || (s->state==PBZ_WORKING))
+		w->cond.wait(w->lock);
+	w->lock.unlock();
+
+	if(s->state==PBZ_FAILED)
+		bs_fail(BSDIFF_ERR_MEMORY);
+	if(fwrite(s->out,1,s->outlen,w->f)!=s->outlen)
+		bs_fail(BSDIFF_ERR_IO);
+	s->state=PBZ_FREE;
+	s->inlen=0;
+	w->written++;
+}
+
+/* Hands the chunk being filled to the workers */
+static void pbz_submit(pbz_writer *w)
+{
+	w->lock.lock();
+	w->slots[w->filled%w->nslots].state=PBZ_PENDING;
+	w->filled++;
+	w->cond.notifyAll();
+	w->lock.unlock();
+}
+
+pbz_writer *pbz_writer_open(FILE *f,int inThreads)
+{
+	pbz_writer *w=new pbz_writer;
+	int i;
+
+	w->f=f;
+	w->nthreads=Pixy::Thread::resolve(inThreads);
+	w->nslots=2*w->nthreads;
+	w->filled=w->taken=w->written=0;
+	w->stop=false;
+	w->workers=new Pixy::Thread[w->nthreads];
+	w->slots=new pbz_slot[w->nslots];
+	for(i=0;i<w->nslots;i++) {
+		w->slots[i].state=PBZ_FREE;
+		w->slots[i].inlen=0;
+		w->slots[i].in=(char*)malloc(PBZ_CHUNK);
+		w->slots[i].out=(char*)malloc(PBZ_BOUND);
+	};
+
+	for(i=0;i<w->nslots;i++)
+		if((w->slots[i].in==NULL) || (w->slots[i].out==NULL)) {
+			pbz_writer_discard(w);
+			bs_fail(BSDIFF_ERR_MEMORY);
+		};
+	for(i=0;i<w->nthreads;i++)
+		if(!w->workers[i].start(&pbz_work,w,i)) {
+			pbz_writer_discard(w);
+			bs_fail(BSDIFF_ERR_MEMORY);
+		};
+	return w;
+}
+
+void pbz_writer_write(pbz_writer *w,const unsigned char *buf,size_t len)
+{
+	pbz_slot *s;
+	size_t n;
+
+	while(len>0) {
+		/* the slot to fill may still hold a chunk to write out */
+		s=&w->slots[w->filled%w->nslots];
+		if(w->filled-w->written==(uint64_t)w->nslots)
+			pbz_drain(w);
+
+		n=PBZ_CHUNK-s->inlen;
+		if(n>len) n=len;
+		memcpy(s->in+s->inlen,buf,n);
+		s->inlen+=(unsigned int)n;
+		buf+=n;
+		len-=n;
+		if(s->inlen==PBZ_CHUNK)
+			pbz_submit(w);
+	};
+}
+
+void pbz_writer_close(pbz_writer *w)
+{
+	try {
+		/* an empty input still makes one, empty, stream */
+		if((w->slots[w->filled%w->nslots].inlen>0) || (w->filled==0)) {
+			if(w->filled-w->written==(uint64_t)w->nslots)
+				pbz_drain(w);
+			pbz_submit(w);
+		};
+		while(w->written<w->filled)
+			pbz_drain(w);
+	} catch(...) {
+		pbz_writer_discard(w);
+		throw;
+	};
+	pbz_writer_discard(w);
+}
+
+void pbz_writer_discard(pbz_writer *w)
+{
+	int i;
+
+	pbz_stop(w);
+	for(i=0;i<w->nslots;i++) {
+		free(w->slots[i].in);
+		free(w->slots[i].out);
+	};
+	delete[] w->slots;
+	delete[] w->workers;
+	delete w;
+}
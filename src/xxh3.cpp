@@ -0,0 +1,453 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#include "xxh3.h"
+#include "bskernels.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define XXH3_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define XXH3_TARGET(x)
+#else
+#define XXH3_TARGET(x) __attribute__((target(x)))
+#endif
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME32_2 0x85EBCA77U
+#define PRIME32_3 0xC2B2AE3DU
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+#define PRIME_MX1 0x165667919E3779F9ULL
+#define PRIME_MX2 0x9FB21C651E98DF25ULL
+
+/* A block is 16 stripes of 64 bytes, each read against the secret 8 bytes on */
+#define XXH3_STRIPE 64
+#define XXH3_BLOCK 1024
+#define XXH3_SCRAMBLE 128	/* offset of the secret the blocks end with */
+#define XXH3_LASTSTRIPE 121	/* and of the one of the input's last stripe */
+#define XXH3_MERGE 11		/* and of the one the state is folded with */
+
+static const unsigned char kSecret[192]={
+	0xb8,0xfe,0x6c,0x39,0x23,0xa4,0x4b,0xbe,0x7c,0x01,0x81,0x2c,0xf7,0x21,0xad,0x1c,
+	0xde,0xd4,0x6d,0xe9,0x83,0x90,0x97,0xdb,0x72,0x40,0xa4,0xa4,0xb7,0xb3,0x67,0x1f,
+	0xcb,0x79,0xe6,0x4e,0xcc,0xc0,0xe5,0x78,0x82,0x5a,0xd0,0x7d,0xcc,0xff,0x72,0x21,
+	0xb8,0x08,0x46,0x74,0xf7,0x43,0x24,0x8e,0xe0,0x35,0x90,0xe6,0x81,0x3a,0x26,0x4c,
+	0x3c,0x28,0x52,0xbb,0x91,0xc3,0x00,0xcb,0x88,0xd0,0x65,0x8b,0x1b,0x53,0x2e,0xa3,
+	0x71,0x64,0x48,0x97,0xa2,0x0d,0xf9,0x4e,0x38,0x19,0xef,0x46,0xa9,0xde,0xac,0xd8,
+	0xa8,0xfa,0x76,0x3f,0xe3,0x9c,0x34,0x3f,0xf9,0xdc,0xbb,0xc7,0xc7,0x0b,0x4f,0x1d,
+	0x8a,0x51,0xe0,0x4b,0xcd,0xb4,0x59,0x31,0xc8,0x9f,0x7e,0xc9,0xd9,0x78,0x73,0x64,
+	0xea,0xc5,0xac,0x83,0x34,0xd3,0xeb,0xc3,0xc5,0x81,0xa0,0xff,0xfa,0x13,0x63,0xeb,
+	0x17,0x0d,0xdd,0x51,0xb7,0xf0,0xda,0x49,0xd3,0x16,0x55,0x26,0x29,0xd4,0x68,0x9e,
+	0x2b,0x16,0xbe,0x58,0x7d,0x47,0xa1,0xfc,0x8f,0xf8,0xb8,0xd1,0x7a,0xd0,0x31,0xce,
+	0x45,0xcb,0x3a,0x8f,0x95,0x16,0x04,0x28,0xaf,0xd7,0xfb,0xca,0xbb,0x4b,0x40,0x7e
+};
+
+/* little endian loads, whatever the host */
+static inline uint32_t rd32(const unsigned char *p)
+{
+	return (uint32_t)p[0]|((uint32_t)p[1]<<8)|((uint32_t)p[2]<<16)|
+		((uint32_t)p[3]<<24);
+}
+
+static inline uint64_t rd64(const unsigned char *p)
+{
+	return (uint64_t)rd32(p)|((uint64_t)rd32(p+4)<<32);
+}
+
+static inline uint64_t rotl64(uint64_t x,int r)
+{
+	return (x<<r)|(x>>(64-r));
+}
+
+static inline uint64_t swap64(uint64_t x)
+{
+	x=((x&0x00ff00ff00ff00ffULL)<<8)|((x>>8)&0x00ff00ff00ff00ffULL);
+	x=((x&0x0000ffff0000ffffULL)<<16)|((x>>16)&0x0000ffff0000ffffULL);
+	return (x<<32)|(x>>32);
+}
+
+/* low and high halves of the 128-bit product, xored */
+static inline uint64_t mulfold(uint64_t a,uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+	unsigned __int128 r=(unsigned __int128)a*b;
+	return (uint64_t)r^(uint64_t)(r>>64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	uint64_t hi,lo=_umul128(a,b,&hi);
+	return lo^hi;
+#else
+	uint64_t ll=(a&0xffffffff)*(b&0xffffffff),lh=(a&0xffffffff)*(b>>32),
+		hl=(a>>32)*(b&0xffffffff),hh=(a>>32)*(b>>32);
+	uint64_t mid=(ll>>32)+(lh&0xffffffff)+(hl&0xffffffff);
+	return ((mid<<32)|(ll&0xffffffff))^(hh+(lh>>32)+(hl>>32)+(mid>>32));
+#endif
+}
+
+static inline uint64_t avalanche(uint64_t h)
+{
+	h^=h>>37;
+	h*=PRIME_MX1;
+	return h^(h>>32);
+}
+
+static inline uint64_t avalanche64(uint64_t h)
+{
+	h^=h>>33;
+	h*=PRIME64_2;
+	h^=h>>29;
+	h*=PRIME64_3;
+	return h^(h>>32);
+}
+
+static inline uint64_t mix16(const unsigned char *p,const unsigned char *secret)
+{
+	return mulfold(rd64(p)^rd64(secret),rd64(p+8)^rd64(secret+8));
+}
+
+/* Inputs of up to 240 bytes, each size range mixed its own way */
+static uint64_t hash_short(const unsigned char *p,size_t n)
+{
+	uint64_t h,lo,hi;
+	size_t i;
+
+	if(n==0)
+		return avalanche64(rd64(kSecret+56)^rd64(kSecret+64));
+	if(n<=3) {
+		h=((uint32_t)p[0]<<16)|((uint32_t)p[n>>1]<<24)|p[n-1]|((uint32_t)n<<8);
+		return avalanche64(h^(rd32(kSecret)^rd32(kSecret+4)));
+	};
+	if(n<=8) {
+		h=(rd32(p+n-4)+((uint64_t)rd32(p)<<32))^(rd64(kSecret+8)^rd64(kSecret+16));
+		h^=rotl64(h,49)^rotl64(h,24);
+		h*=PRIME_MX2;
+		h^=(h>>35)+n;
+		h*=PRIME_MX2;
+		return h^(h>>28);
+	};
+	if(n<=16) {
+		lo=rd64(p)^(rd64(kSecret+24)^rd64(kSecret+32));
+		hi=rd64(p+n-8)^(rd64(kSecret+40)^rd64(kSecret+48));
+		return avalanche(n+swap64(lo)+hi+mulfold(lo,hi));
+	};
+
+	h=n*PRIME64_1;
+	if(n<=128) {
+		if(n>32) {
+			if(n>64) {
+				if(n>96) {
+					h+=mix16(p+48,kSecret+96);
+					h+=mix16(p+n-64,kSecret+112);
+				};
+				h+=mix16(p+32,kSecret+64);
+				h+=mix16(p+n-48,kSecret+80);
+			};
+			h+=mix16(p+16,kSecret+32);
+			h+=mix16(p+n-32,kSecret+48);
+		};
+		h+=mix16(p,kSecret);
+		h+=mix16(p+n-16,kSecret+16);
+		return avalanche(h);
+	};
+
+	for(i=0;i<8;i++)
+		h+=mix16(p+16*i,kSecret+16*i);
+	h=avalanche(h);
+	for(i=8;i<n/16;i++)
+		h+=mix16(p+16*i,kSecret+16*(i-8)+3);
+	h+=mix16(p+n-16,kSecret+136-17);
+	return avalanche(h);
+}
+
+/*
+ * The kernels: stripes() folds n stripes into the 8 accumulators, reading
+ * the secret from the given offset on, and blocks() hashes n whole blocks,
+ * scrambling the accumulators after each.
+ */
+static void stripes_x1(uint64_t *acc,const unsigned char *in,
+	const unsigned char *secret,size_t n)
+{
+	uint64_t v,k;
+	int i;
+
+	for(;n>0;n--,in+=XXH3_STRIPE,secret+=8)
+		for(i=0;i<8;i++) {
+			v=rd64(in+8*i);
+			k=v^rd64(secret+8*i);
+			acc[i^1]+=v;
+			acc[i]+=(k&0xffffffff)*(k>>32);
+		};
+}
+
+static void blocks_x1(uint64_t *acc,const unsigned char *in,size_t n)
+{
+	int i;
+
+	for(;n>0;n--,in+=XXH3_BLOCK) {
+		stripes_x1(acc,in,kSecret,XXH3_BLOCK/XXH3_STRIPE);
+		for(i=0;i<8;i++) {
+			acc[i]^=acc[i]>>47;
+			acc[i]^=rd64(kSecret+XXH3_SCRAMBLE+8*i);
+			acc[i]*=PRIME32_1;
+		};
+	};
+}
+
+#ifdef XXH3_X86
+XXH3_TARGET("sse2")
+static inline void stripe_sse2(__m128i *a,const unsigned char *in,
+	const unsigned char *secret)
+{
+	__m128i d,k;
+	int j;
+
+	for(j=0;j<4;j++) {
+		d=_mm_loadu_si128((const __m128i*)(in+16*j));
+		k=_mm_xor_si128(d,_mm_loadu_si128((const __m128i*)(secret+16*j)));
+		k=_mm_mul_epu32(k,_mm_shuffle_epi32(k,_MM_SHUFFLE(0,3,0,1)));
+		d=_mm_shuffle_epi32(d,_MM_SHUFFLE(1,0,3,2));
+		a[j]=_mm_add_epi64(a[j],_mm_add_epi64(d,k));
+	};
+}
+
+XXH3_TARGET("sse2")
+static void stripes_sse2(uint64_t *acc,const unsigned char *in,
+	const unsigned char *secret,size_t n)
+{
+	__m128i a[4];
+	int j;
+
+	for(j=0;j<4;j++) a[j]=_mm_loadu_si128((const __m128i*)(acc+2*j));
+	for(;n>0;n--,in+=XXH3_STRIPE,secret+=8)
+		stripe_sse2(a,in,secret);
+	for(j=0;j<4;j++) _mm_storeu_si128((__m128i*)(acc+2*j),a[j]);
+}
+
+XXH3_TARGET("sse2")
+static void blocks_sse2(uint64_t *acc,const unsigned char *in,size_t n)
+{
+	const __m128i prime=_mm_set1_epi32((int)PRIME32_1);
+	__m128i a[4],k;
+	int s,j;
+
+	for(j=0;j<4;j++) a[j]=_mm_loadu_si128((const __m128i*)(acc+2*j));
+	for(;n>0;n--) {
+		for(s=0;s<XXH3_BLOCK/XXH3_STRIPE;s++,in+=XXH3_STRIPE)
+			stripe_sse2(a,in,kSecret+8*s);
+		for(j=0;j<4;j++) {
+			k=_mm_xor_si128(a[j],_mm_srli_epi64(a[j],47));
+			k=_mm_xor_si128(k,_mm_loadu_si128(
+				(const __m128i*)(kSecret+XXH3_SCRAMBLE+16*j)));
+			a[j]=_mm_add_epi64(_mm_mul_epu32(k,prime),_mm_slli_epi64(
+				_mm_mul_epu32(_mm_shuffle_epi32(k,_MM_SHUFFLE(0,3,0,1)),prime),32));
+		};
+	};
+	for(j=0;j<4;j++) _mm_storeu_si128((__m128i*)(acc+2*j),a[j]);
+}
+
+XXH3_TARGET("avx2")
+static inline void stripe_avx2(__m256i *a,const unsigned char *in,
+	const unsigned char *secret)
+{
+	__m256i d,k;
+	int j;
+
+	for(j=0;j<2;j++) {
+		d=_mm256_loadu_si256((const __m256i*)(in+32*j));
+		k=_mm256_xor_si256(d,_mm256_loadu_si256((const __m256i*)(secret+32*j)));
+		k=_mm256_mul_epu32(k,_mm256_shuffle_epi32(k,_MM_SHUFFLE(0,3,0,1)));
+		d=_mm256_shuffle_epi32(d,_MM_SHUFFLE(1,0,3,2));
+		a[j]=_mm256_add_epi64(a[j],_mm256_add_epi64(d,k));
+	};
+}
+
+XXH3_TARGET("avx2")
+static void stripes_avx2(uint64_t *acc,const unsigned char *in,
+	const unsigned char *secret,size_t n)
+{
+	__m256i a[2];
+	int j;
+
+	for(j=0;j<2;j++) a[j]=_mm256_loadu_si256((const __m256i*)(acc+4*j));
+	for(;n>0;n--,in+=XXH3_STRIPE,secret+=8)
+		stripe_avx2(a,in,secret);
+	for(j=0;j<2;j++) _mm256_storeu_si256((__m256i*)(acc+4*j),a[j]);
+}
+
+XXH3_TARGET("avx2")
+static void blocks_avx2(uint64_t *acc,const unsigned char *in,size_t n)
+{
+	const __m256i prime=_mm256_set1_epi32((int)PRIME32_1);
+	__m256i a[2],k;
+	int s,j;
+
+	for(j=0;j<2;j++) a[j]=_mm256_loadu_si256((const __m256i*)(acc+4*j));
+	for(;n>0;n--) {
+		for(s=0;s<XXH3_BLOCK/XXH3_STRIPE;s++,in+=XXH3_STRIPE)
+			stripe_avx2(a,in,kSecret+8*s);
+		for(j=0;j<2;j++) {
+			k=_mm256_xor_si256(a[j],_mm256_srli_epi64(a[j],47));
+			k=_mm256_xor_si256(k,_mm256_loadu_si256(
+				(const __m256i*)(kSecret+XXH3_SCRAMBLE+32*j)));
+			a[j]=_mm256_add_epi64(_mm256_mul_epu32(k,prime),_mm256_slli_epi64(
+				_mm256_mul_epu32(_mm256_shuffle_epi32(k,_MM_SHUFFLE(0,3,0,1)),prime),32));
+		};
+	};
+	for(j=0;j<2;j++) _mm256_storeu_si256((__m256i*)(acc+4*j),a[j]);
+}
+#endif
+
+struct xxh3_kernel_set {
+	const char *name;
+	void (*stripes)(uint64_t*,const unsigned char*,const unsigned char*,size_t);
+	void (*blocks)(uint64_t*,const unsigned char*,size_t);
+};
+
+static const xxh3_kernel_set xxh3_scalar={ "scalar",stripes_x1,blocks_x1 };
+#ifdef XXH3_X86
+static const xxh3_kernel_set xxh3_sse2={ "sse2",stripes_sse2,blocks_sse2 };
+static const xxh3_kernel_set xxh3_avx2={ "avx2",stripes_avx2,blocks_avx2 };
+#endif
+
+static const xxh3_kernel_set *xxh3_pick()
+{
+#ifdef XXH3_X86
+	unsigned int cpu=bs_cpu();
+
+	if(cpu&BS_CPU_AVX2) return &xxh3_avx2;
+	if(cpu&BS_CPU_SSE2) return &xxh3_sse2;
+#endif
+	return &xxh3_scalar;
+}
+
+/* resolved once during static initialisation, before any thread exists */
+static const xxh3_kernel_set *XK=xxh3_pick();
+
+static void acc_init(uint64_t *acc)
+{
+	acc[0]=PRIME32_3; acc[1]=PRIME64_1; acc[2]=PRIME64_2; acc[3]=PRIME64_3;
+	acc[4]=PRIME64_4; acc[5]=PRIME32_2; acc[6]=PRIME64_5; acc[7]=PRIME32_1;
+}
+
+/* Folds the accumulators after the input's last stripe at p */
+static uint64_t acc_merge(uint64_t *acc,const unsigned char *p,uint64_t n)
+{
+	uint64_t h=n*PRIME64_1;
+	int i;
+
+	XK->stripes(acc,p,kSecret+XXH3_LASTSTRIPE,1);
+	for(i=0;i<4;i++)
+		h+=mulfold(acc[2*i]^rd64(kSecret+XXH3_MERGE+16*i),
+			acc[2*i+1]^rd64(kSecret+XXH3_MERGE+16*i+8));
+	return avalanche(h);
+}
+
+void xxh3_reset(xxh3_state *s)
+{
+	acc_init(s->acc);
+	s->total=0;
+	s->buffered=0;
+}
+
+/*
+ * A block is only hashed once some input is known to follow it, as the
+ * last one, whole or not, is hashed stripe by stripe instead.
+ */
+void xxh3_update(xxh3_state *s,const void *data,size_t n)
+{
+	const unsigned char *p=(const unsigned char*)data;
+	size_t k;
+
+	s->total+=n;
+	if(s->buffered+n<=XXH3_BLOCK) {
+		memcpy(s->buf+s->buffered,p,n);
+		s->buffered+=n;
+		return;
+	};
+
+	if(s->buffered>0) {
+		k=XXH3_BLOCK-s->buffered;
+		memcpy(s->buf+s->buffered,p,k);
+		p+=k; n-=k;
+		XK->blocks(s->acc,s->buf,1);
+		memcpy(s->last,s->buf+XXH3_BLOCK-XXH3_STRIPE,XXH3_STRIPE);
+	};
+	if(n>XXH3_BLOCK) {
+		k=(n-1)/XXH3_BLOCK;
+		XK->blocks(s->acc,p,k);
+		p+=k*XXH3_BLOCK; n-=k*XXH3_BLOCK;
+		memcpy(s->last,p-XXH3_STRIPE,XXH3_STRIPE);
+	};
+	memcpy(s->buf,p,n);
+	s->buffered=n;
+}
+
+uint64_t xxh3_digest(const xxh3_state *s)
+{
+	unsigned char tail[XXH3_STRIPE];
+	uint64_t acc[8];
+	size_t k;
+
+	if(s->total<=240)
+		return hash_short(s->buf,(size_t)s->total);
+
+	memcpy(acc,s->acc,sizeof(acc));
+	XK->stripes(acc,s->buf,kSecret,(s->buffered-1)/XXH3_STRIPE);
+	if(s->buffered>=XXH3_STRIPE)
+		return acc_merge(acc,s->buf+s->buffered-XXH3_STRIPE,s->total);
+
+	/* the last stripe starts in the block before */
+	k=XXH3_STRIPE-s->buffered;
+	memcpy(tail,s->last+s->buffered,k);
+	memcpy(tail+k,s->buf,s->buffered);
+	return acc_merge(acc,tail,s->total);
+}
+
+uint64_t xxh3_64(const void *data,size_t n)
+{
+	const unsigned char *p=(const unsigned char*)data;
+	uint64_t acc[8];
+	size_t k;
+
+	if(n<=240)
+		return hash_short(p,n);
+
+	acc_init(acc);
+	k=(n-1)/XXH3_BLOCK;
+	XK->blocks(acc,p,k);
+	XK->stripes(acc,p+k*XXH3_BLOCK,kSecret,(n-1-k*XXH3_BLOCK)/XXH3_STRIPE);
+	return acc_merge(acc,p+n-XXH3_STRIPE,n);
+}
+
+const char *xxh3_kernels()
+{
+	return XK->name;
+}
@@ -0,0 +1,180 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+/*
+ * bspatch() writing its new file over the old file it reads, or over the
+ * patch, with the old file both read and mapped: the new file must come
+ * out whole, keep the old one's mode and leave no temporary file behind.
+ * Should it fail, as should bsdiff() writing over its old file, that file
+ * must be left as it was. Whatever a caller's sink or progress callback
+ * throws must come back as BSDIFF_ERR_INTERNAL.
+ */
+
+#include "bsdiff.h"
+#include "corpus.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int failures=0;
+
+static void check(bool cond,const char *what,const char *name)
+{
+	if(cond) return;
+	fprintf(stderr,"FAIL: %s: %s\n",name,what);
+	failures++;
+}
+
+/* Cancels the call three quarters in, as bsdiff() writes the patch */
+static bool late(void *,double done)
+{
+	return done<0.75;
+}
+
+/* Throws out of the call, from whichever of its threads */
+static bool throws(void *,double done)
+{
+	if(done>0.25) throw std::runtime_error("progress");
+	return true;
+}
+
+static bool sink_throws(void *,const unsigned char *,size_t)
+{
+	throw std::runtime_error("sink");
+}
+
+static bool save(const std::string& path,const std::vector<unsigned char>& data)
+{
+	FILE *f=fopen(path.c_str(),"wb");
+	bool ok=(f!=NULL) && (data.empty() || (fwrite(&data[0],1,data.size(),f)==data.size()));
+	return (f!=NULL) && (fclose(f)==0) && ok;
+}
+
+static bool same(const std::string& path,const std::vector<unsigned char>& data)
+{
+	std::vector<unsigned char> got(data.size()+1);
+	FILE *f=fopen(path.c_str(),"rb");
+	size_t n;
+
+	if(f==NULL) return false;
+	n=fread(got.empty() ? NULL : &got[0],1,got.size(),f);
+	fclose(f);
+	return (n==data.size()) && ((n==0) || !memcmp(&got[0],&data[0],n));
+}
+
+int main()
+{
+	char dirbuf[]="/tmp/kiwi_bspatch_test.XXXXXX";
+	std::vector<unsigned char> o,n,patch,cut;
+	std::string dir,old,pf;
+	BSPatchOptions opts;
+	struct stat st;
+	int mapped;
+
+	if(mkdtemp(dirbuf)==NULL) {
+		perror("mkdtemp");
+		return 1;
+	};
+	dir=dirbuf;
+	old=dir+"/old";
+	pf=dir+"/patch";
+
+	corpus_asset(9,1<<20,&o);
+	corpus_edit(10,o,4096,&n);
+	if((bsdiff(BSInput(&o[0],o.size()),BSInput(&n[0],n.size()),
+			BSOutput(&patch))!=BSDIFF_OK) || !save(pf,patch)) {
+		fprintf(stderr,"FAIL: cannot make the patch\n");
+		return 1;
+	};
+
+	/* the smallest cache, for the old file to be read all along */
+	opts.BufferSize=4096;
+	for(mapped=0;mapped<=1;mapped++) {
+		const char *name=mapped ? "in place, mapped" : "in place";
+		opts.Mapped=(mapped!=0);
+		check(save(old,o) && (chmod(old.c_str(),0751)==0),"cannot write the old file",name);
+		check(bspatch(BSInput(old.c_str()),BSOutput(old.c_str()),
+			BSInput(pf.c_str()),opts)==BSDIFF_OK,"failed",name);
+		check(same(old,n),"the new file is wrong",name);
+		check((stat(old.c_str(),&st)==0) && ((st.st_mode&07777)==0751),"lost the mode",name);
+		check(access((old+".tmp").c_str(),F_OK)!=0,"left the temporary file",name);
+
+		name=mapped ? "over the patch, mapped" : "over the patch";
+		check(save(old,o) && save(pf+"2",patch),"cannot write the inputs",name);
+		check(bspatch(BSInput(old.c_str()),BSOutput((pf+"2").c_str()),
+			BSInput((pf+"2").c_str()),opts)==BSDIFF_OK,"failed",name);
+		check(same(pf+"2",n),"the new file is wrong",name);
+
+		/* a patch cut short fails once the new file is under way */
+		name=mapped ? "failed in place, mapped" : "failed in place";
+		cut.assign(patch.begin(),patch.begin()+patch.size()*3/4);
+		check(save(old,o) && save(pf+"2",cut),"cannot write the inputs",name);
+		check(bspatch(BSInput(old.c_str()),BSOutput(old.c_str()),
+			BSInput((pf+"2").c_str()),opts)!=BSDIFF_OK,"succeeded",name);
+		check(same(old,o),"the old file was touched",name);
+		check(access((old+".tmp").c_str(),F_OK)!=0,"left the temporary file",name);
+	};
+
+	{
+		const char *name="bsdiff cancelled over its old file";
+		BSDiffOptions dopts;
+		dopts.Progress=&late;
+		check(save(old,o) && save(pf+"2",n),"cannot write the inputs",name);
+		check(bsdiff(BSInput(old.c_str()),BSInput((pf+"2").c_str()),
+			BSOutput(old.c_str()),dopts)==BSDIFF_ERR_CANCELLED,"not cancelled",name);
+		check(same(old,o),"the old file was touched",name);
+		check(access((old+".tmp").c_str(),F_OK)!=0,"left the temporary file",name);
+	}
+
+	{
+		const char *name="sink throwing";
+		check(bsdiff(BSInput(&o[0],o.size()),BSInput(&n[0],n.size()),
+			BSOutput(&sink_throws,NULL))==BSDIFF_ERR_INTERNAL,"not reported",name);
+		check(bspatch(BSInput(&o[0],o.size()),BSOutput(&sink_throws,NULL),
+			BSInput(&patch[0],patch.size()))==BSDIFF_ERR_INTERNAL,"not reported",name);
+	}
+	{
+		const char *name="progress throwing";
+		BSDiffOptions dopts;
+		dopts.Progress=&throws;
+		dopts.Threads=4;
+		opts.Progress=&throws;
+		opts.Threads=3;
+		opts.Mapped=false;
+		check(bsdiff(BSInput(&o[0],o.size()),BSInput(&n[0],n.size()),
+			BSOutput(&cut),dopts)==BSDIFF_ERR_INTERNAL,"not reported by bsdiff",name);
+		check(save(old,o),"cannot write the old file",name);
+		check(bspatch(BSInput(old.c_str()),BSOutput(old.c_str()),
+			BSInput(pf.c_str()),opts)==BSDIFF_ERR_INTERNAL,"not reported by bspatch",name);
+		check(same(old,o),"the old file was touched",name);
+	}
+
+	remove(old.c_str());
+	remove(pf.c_str());
+	remove((pf+"2").c_str());
+	rmdir(dir.c_str());
+	return (failures==0) ? 0 : 1;
+}
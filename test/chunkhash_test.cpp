@@ -0,0 +1,113 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+/*
+ * chunkhash_verify() against manifests of a file it wrote, with chunks
+ * of the file damaged or missing, and against damaged or hostile ones,
+ * which must be refused rather than throw or be believed: they come with
+ * the downloaded tarball.
+ */
+
+#include "chunkhash.h"
+#include "corpus.h"
+#include <stdio.h>
+#include <string>
+#include <unistd.h>
+
+#define CHUNK 4096
+
+static int failures=0;
+
+static void check(bool cond,const char *what,const char *name)
+{
+	if(cond) return;
+	fprintf(stderr,"FAIL: %s: %s\n",name,what);
+	failures++;
+}
+
+static bool save(const std::string& path,const std::vector<unsigned char>& data,size_t n)
+{
+	FILE *f=fopen(path.c_str(),"wb");
+	bool ok=(f!=NULL) && ((n==0) || (fwrite(&data[0],1,n,f)==n));
+	return (f!=NULL) && (fclose(f)==0) && ok;
+}
+
+int main()
+{
+	char dirbuf[]="/tmp/kiwi_chunkhash_test.XXXXXX";
+	std::vector<unsigned char> data;
+	std::vector<size_t> bad;
+	std::string path,root,manifest,m;
+	int a;
+
+	if(mkdtemp(dirbuf)==NULL) {
+		perror("mkdtemp");
+		return 1;
+	};
+	path=std::string(dirbuf)+"/file";
+	corpus_random(11,10*CHUNK+100,&data);
+
+	for(a=0;a<=1;a++) {
+		CHECKSUM_ALGO algo=a ? CHECKSUM_XXH3 : CHECKSUM_MD5;
+		const char *name=checksum_name(algo);
+
+		check(save(path,data,data.size()) &&
+			chunkhash_file(algo,path,CHUNK,0,&root,&manifest),"cannot hash",name);
+		check(chunkhash_verify(manifest,root,path,0,&bad) && bad.empty(),
+			"the file doesn't match its own manifest",name);
+
+		/* a damaged chunk, then a file cut short within the 4th chunk */
+		data[5*CHUNK+7]^=1;
+		check(save(path,data,data.size()) &&
+			chunkhash_verify(manifest,root,path,0,&bad) &&
+			(bad.size()==1) && (bad[0]==5),"the damaged chunk isn't found",name);
+		data[5*CHUNK+7]^=1;
+		check(save(path,data,3*CHUNK+10) &&
+			chunkhash_verify(manifest,root,path,0,&bad) &&
+			(bad.size()==8) && (bad[0]==3),"the missing chunks aren't found",name);
+
+		/* a digest changed, or a line dropped, and the root is wrong */
+		m=manifest;
+		m[m.find('\n')+1]^=1;
+		check(!chunkhash_verify(m,root,path,0,&bad),"a changed digest is believed",name);
+		m=manifest.substr(0,manifest.size()-checksum_size(algo)*2-1);
+		check(!chunkhash_verify(m,root,path,0,&bad),"a missing digest is believed",name);
+		check(!chunkhash_verify(manifest,root.substr(1)+"0",path,0,&bad),
+			"a wrong root is believed",name);
+	};
+
+	/* headers whose counts agree but that couldn't be held, or that
+	   would have wrapped around */
+	check(!chunkhash_verify("CHUNKS md5 1 288230376151711744 288230376151711744\n",
+		root,path,0,&bad),"a huge count is accepted","hostile");
+	check(!chunkhash_verify("CHUNKS md5 9223372036854775808 18446744073709551615 2\n",
+		root,path,0,&bad),"a count past the end is accepted","hostile");
+	check(!chunkhash_verify("CHUNKS md5 0 0 0\n",root,path,0,&bad),
+		"a chunk size of 0 is accepted","hostile");
+	check(!chunkhash_verify("CHUNKS sha1 4096 1 1\n",root,path,0,&bad),
+		"an unknown algorithm is accepted","hostile");
+
+	remove(path.c_str());
+	rmdir(dirbuf);
+	return (failures==0) ? 0 : 1;
+}
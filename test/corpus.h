@@ -0,0 +1,160 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef H_Corpus_H
+#define H_Corpus_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+/*
+ * Deterministic inputs for the tests and benchmarks: the same seed gives
+ * the same bytes on every platform, so patches made of them can be
+ * compared against digests recorded once.
+ */
+
+/* xorshift64* */
+static inline uint64_t corpus_next(uint64_t *s)
+{
+	*s^=*s>>12;
+	*s^=*s<<25;
+	*s^=*s>>27;
+	return *s*2685821657736338717ULL;
+}
+
+static inline void corpus_random(uint64_t seed,size_t n,
+		std::vector<unsigned char> *out)
+{
+	uint64_t s=seed|1;
+	size_t i;
+
+	out->resize(n);
+	for(i=0;i<n;i++) (*out)[i]=(unsigned char)(corpus_next(&s)>>56);
+}
+
+/*
+ * The Fibonacci word "abaababaabaab...", whose suffixes share the longest
+ * prefixes a two letter text can have, the hard case of suffix sorting.
+ */
+static inline void corpus_fibonacci(size_t n,std::vector<unsigned char> *out)
+{
+	std::vector<unsigned char> a(1,'a'),b,c;
+
+	b.push_back('a');
+	b.push_back('b');
+	while(b.size()<n) {
+		c=b;
+		c.insert(c.end(),a.begin(),a.end());
+		a.swap(b);
+		b.swap(c);
+	};
+	out->assign(b.begin(),b.begin()+n);
+}
+
+/*
+ * Something like a game data pack: text drawn from a small vocabulary,
+ * tables of records whose fields change slowly, and compressed-looking
+ * noise, in blocks of a few KB.
+ */
+static inline void corpus_asset(uint64_t seed,size_t n,
+		std::vector<unsigned char> *out)
+{
+	static const char *words[]={"mesh ","texture ","vertex ","normal ",
+		"material ","shader ","bone ","frame ","light ","sound ",
+		"level ","entity ","0.000 ","1.000 ","-1.000 ","\n"};
+	uint64_t s=seed|1,r;
+	uint32_t field[4]={0,0,0,0};
+	size_t len,k;
+
+	out->clear();
+	out->reserve(n);
+	while(out->size()<n) {
+		r=corpus_next(&s);
+		len=1024+(size_t)(r>>54);
+		switch(r&3) {
+		case 0:
+		case 1:
+			while(len-->0) {
+				const char *w=words[corpus_next(&s)>>60];
+				out->insert(out->end(),w,w+strlen(w));
+			};
+			break;
+		case 2:
+			for(;len>=16;len-=16)
+				for(k=0;k<4;k++) {
+					field[k]+=(uint32_t)(corpus_next(&s)>>61);
+					out->push_back((unsigned char)field[k]);
+					out->push_back((unsigned char)(field[k]>>8));
+					out->push_back((unsigned char)(field[k]>>16));
+					out->push_back((unsigned char)(field[k]>>24));
+				};
+			break;
+		default:
+			while(len-->0) out->push_back((unsigned char)(corpus_next(&s)>>56));
+		};
+	};
+	out->resize(n);
+}
+
+/*
+ * A new version of old: bytes changed here and there, blocks inserted,
+ * dropped and copied from elsewhere, about one edit per editEvery bytes.
+ */
+static inline void corpus_edit(uint64_t seed,const std::vector<unsigned char> &old,
+		size_t editEvery,std::vector<unsigned char> *out)
+{
+	uint64_t s=seed|1,r;
+	size_t pos=0,run,len,from,k;
+
+	out->clear();
+	out->reserve(old.size()+old.size()/16);
+	while(pos<old.size()) {
+		run=1+(size_t)(corpus_next(&s)%(2*editEvery));
+		if(run>old.size()-pos) run=old.size()-pos;
+		out->insert(out->end(),old.begin()+pos,old.begin()+pos+run);
+		pos+=run;
+
+		r=corpus_next(&s);
+		len=1+(size_t)((r>>8)%256);
+		switch(r&3) {
+		case 0:
+			for(k=0;(k<len) && !out->empty();k+=8)
+				(*out)[out->size()-1-(k%out->size())]+=(unsigned char)(r>>48|1);
+			break;
+		case 1:
+			while(len-->0) out->push_back((unsigned char)(corpus_next(&s)>>56));
+			break;
+		case 2:
+			pos+=len;
+			break;
+		default:
+			from=(size_t)(corpus_next(&s)%old.size());
+			if(len>old.size()-from) len=old.size()-from;
+			out->insert(out->end(),old.begin()+from,old.begin()+from+len);
+		};
+	};
+}
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+/*
+ * Patch size overhead of bsdiff's sliced scan, BSDiffOptions::Segments,
+ * over the serial scan on an asset-like corpus, printed and held within
+ * SEGMENTS_OVERHEAD. Every sliced patch must apply with bspatch().
+ *
+ * The serial patch must be the original bsdiff's, byte for byte. This
+ * test is built a second time with search()'s skip of known prefixes
+ * turned off (BSDIFF_LCPMIN past any length), which must give the very
+ * same patch: the bound costs nothing in size.
+ */
+
+#include "../src/bsdiff.cpp"
+#include "corpus.h"
+
+/* The most a sliced patch may outgrow the serial one by, in percent */
+#define SEGMENTS_OVERHEAD 2.0
+
+/* MD5 of the original bsdiff's patch of the corpus below */
+#define SEGMENTS_SERIAL "059914b0d99ac66fa9310e0a9ef0e6d4"
+
+int main()
+{
+	std::vector<u_char> o,n,patch,back;
+	BSDiffOptions opts;
+	size_t serial=0;
+	double overhead;
+	int failures=0,s;
+	MD5 md5;
+
+	corpus_asset(7,4<<20,&o);
+	corpus_edit(8,o,2048,&n);
+
+	for(s=1;s<=32;s*=2) {
+		opts.Segments=s;
+		opts.Threads=s;
+		patch.clear();
+		back.clear();
+		if((bsdiff(BSInput(&o[0],o.size()),BSInput(&n[0],n.size()),
+				BSOutput(&patch),opts)!=BSDIFF_OK) ||
+				(bspatch(BSInput(&o[0],o.size()),BSOutput(&back),
+				BSInput(&patch[0],patch.size()))!=BSDIFF_OK) ||
+				(back!=n)) {
+			fprintf(stderr,"FAIL: %d slices: the patch doesn't apply\n",s);
+			failures++;
+			continue;
+		};
+
+		if(s==1) {
+			serial=patch.size();
+			if(strcmp(md5.digestMemory(&patch[0],(int)patch.size()),SEGMENTS_SERIAL)) {
+				fprintf(stderr,"FAIL: the serial patch isn't the original bsdiff's\n");
+				failures++;
+			};
+		};
+		overhead=(serial>0) ? 100.0*((double)patch.size()-serial)/serial : 0;
+		printf("%2d slices: %lu bytes, %+.2f%%\n",s,(unsigned long)patch.size(),overhead);
+		if(overhead>SEGMENTS_OVERHEAD) {
+			fprintf(stderr,"FAIL: %d slices: over %.1f%% larger\n",s,SEGMENTS_OVERHEAD);
+			failures++;
+		};
+	};
+
+	return (failures==0) ? 0 : 1;
+}
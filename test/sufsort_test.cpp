@@ -0,0 +1,164 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+/*
+ * Regression test of bsdiff's suffix sorting engines. src/bsdiff.cpp is
+ * compiled in whole so that its static sorts can be called: SA-IS, the
+ * original qsufsort and the parallel sort must give the same suffix
+ * array, for both index widths. The default patches must also be, byte
+ * for byte, those the original bsdiff made of the same inputs, whose MD5
+ * digests are recorded below.
+ */
+
+#include "../src/bsdiff.cpp"
+#include "corpus.h"
+
+static int failures=0;
+
+static void check(bool cond,const char *what,const char *name)
+{
+	if(cond) return;
+	fprintf(stderr,"FAIL: %s: %s\n",name,what);
+	failures++;
+}
+
+/* Whether I is the suffix array of old, by comparing neighbours */
+template<class T>
+static bool is_sorted(const T *I,const u_char *old,off_t n)
+{
+	off_t i,a,b,len;
+	int c;
+
+	if(I[0]!=n) return false;
+	for(i=1;i<n;i++) {
+		a=I[i];b=I[i+1];
+		len=MIN(n-a,n-b);
+		c=memcmp(old+a,old+b,len);
+		if((c>0) || ((c==0) && (n-a>n-b))) return false;
+	};
+	return true;
+}
+
+template<class T>
+static void check_sorts(const std::vector<u_char> &in,const char *name)
+{
+	static const int threads[]={1,2,4,7};
+	std::vector<u_char> buf(in);
+	off_t n=(off_t)in.size();
+	size_t len=(n+1)*sizeof(T);
+	memtrack mt={0,0};
+	bs_progress pr;
+	T *ref,*I;
+	size_t t;
+
+	buf.push_back(0);
+	bs_progress_init(&pr,NULL,NULL,0);
+	ref=sufsort<T>(&buf[0],n,BSDIFF_SORT_QSUFSORT,1,&mt,&pr);
+	if(n<=(1<<16))
+		check(is_sorted(ref,&buf[0],n),"qsufsort isn't sorted",name);
+
+	I=sufsort<T>(&buf[0],n,BSDIFF_SORT_SAIS,1,&mt,&pr);
+	check(!memcmp(ref,I,len),"SA-IS differs from qsufsort",name);
+	free(I);
+
+	for(t=0;t<sizeof(threads)/sizeof(threads[0]);t++) {
+		I=sufsort<T>(&buf[0],n,BSDIFF_SORT_PARALLEL,threads[t],&mt,&pr);
+		check(!memcmp(ref,I,len),"the parallel sort differs from qsufsort",name);
+		free(I);
+	};
+	free(ref);
+}
+
+static void check_patch(const std::vector<u_char> &o,const std::vector<u_char> &n,
+		const char *digest,const char *name)
+{
+	BSDiffOptions opts[4];
+	std::vector<u_char> patch;
+	size_t i;
+	MD5 md5;
+
+	opts[1].Sort=BSDIFF_SORT_QSUFSORT;
+	opts[2].Sort=BSDIFF_SORT_PARALLEL;
+	opts[2].Threads=4;
+	opts[3].Index=BSDIFF_INDEX_64;
+	opts[3].Threads=0;
+
+	for(i=0;i<sizeof(opts)/sizeof(opts[0]);i++) {
+		patch.clear();
+		if(bsdiff(BSInput(o.empty() ? NULL : &o[0],o.size()),
+				BSInput(n.empty() ? NULL : &n[0],n.size()),
+				BSOutput(&patch),opts[i])!=BSDIFF_OK) {
+			check(false,"bsdiff() failed",name);
+			continue;
+		};
+		check(!strcmp(md5.digestMemory(&patch[0],(int)patch.size()),digest),
+			"the patch isn't the original bsdiff's",name);
+	};
+}
+
+int main()
+{
+	std::vector<u_char> o,n;
+
+	try {
+		corpus_random(1,100000,&o);
+		check_sorts<int32_t>(o,"random");
+		check_sorts<off_t>(o,"random, 64-bit");
+		o.clear();
+		check_sorts<int32_t>(o,"empty");
+		o.assign(1,'x');
+		check_sorts<int32_t>(o,"single byte");
+		o.assign(65536,'a');
+		check_sorts<int32_t>(o,"one repeated byte");
+		o.clear();
+		while(o.size()<50000) o.insert(o.end(),(const u_char*)"abc",(const u_char*)"abc"+3);
+		check_sorts<int32_t>(o,"period 3");
+		corpus_fibonacci(46368,&o);
+		check_sorts<int32_t>(o,"Fibonacci word");
+		check_sorts<off_t>(o,"Fibonacci word, 64-bit");
+		corpus_random(2,50000,&o);
+		for(size_t i=0;i<o.size();i++) o[i]&=1;
+		check_sorts<int32_t>(o,"two letters");
+		corpus_asset(3,300000,&o);
+		check_sorts<int32_t>(o,"asset");
+
+		corpus_asset(1,1<<20,&o);
+		corpus_edit(2,o,4096,&n);
+		check_patch(o,n,"2691fbd16dc9e6221c923b1111a06f77","asset patch");
+		corpus_random(3,65536,&o);
+		corpus_random(4,65536,&n);
+		check_patch(o,n,"ecf8e0a78cfc467b5b17595b19438b35","unrelated patch");
+		o.clear();
+		corpus_asset(5,10000,&n);
+		check_patch(o,n,"b5217a1283168e05d83e9dc76e0fa2a4","patch from nothing");
+		corpus_fibonacci(30000,&o);
+		corpus_edit(6,o,512,&n);
+		check_patch(o,n,"b2738db457b32810853b24d3605ef3ca","Fibonacci word patch");
+	} catch(const bs_error &e) {
+		fprintf(stderr,"FAIL: %s\n",bsdiff_strerror(e.status));
+		return 1;
+	};
+
+	if(failures==0) printf("all suffix sorts agree\n");
+	return (failures==0) ? 0 : 1;
+}
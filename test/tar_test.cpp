@@ -0,0 +1,221 @@
+/*
+ *  Copyright (c) 2011 Ahmad Amireh <ahmad@amireh.net>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ *  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+/*
+ * FdTar against Tar: an archive FdTar writes to a file, to a pipe (where
+ * sendfile(2) stands in for copy_file_range(2)) or with read(2) and
+ * write(2) alone must hold the same entries as Tar's, so must putFiles()
+ * through an FdTar, larger files going to FdTar::putFile(). A file that
+ * can't be opened throws, a full device leaves it !good().
+ */
+
+#include "Pixy.h"
+#include "Tarball.h"
+#include "corpus.h"
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+typedef std::vector<std::pair<std::string,std::string> > tar_files;
+typedef std::vector<std::pair<std::string,std::string> > tar_entries;
+
+static int failures=0;
+
+static void check(bool cond,const char *what,const char *name)
+{
+	if(cond) return;
+	fprintf(stderr,"FAIL: %s: %s\n",name,what);
+	failures++;
+}
+
+/* FdTar moving the bodies with read(2) and write(2) from the start */
+class ReadWriteTar : public lindenb::io::FdTar
+{
+public:
+	ReadWriteTar(int fd):FdTar(fd)
+	{
+		method=READ_WRITE;
+	}
+};
+
+/* The names and bodies in tar, false if it isn't a well-formed archive */
+static bool entries(const std::string& tar,tar_entries *out)
+{
+	size_t pos=0,len,i;
+	unsigned int sum;
+
+	out->clear();
+	while(pos+512<=tar.size()) {
+		const char *h=tar.data()+pos;
+		if(h[0]==0)
+			return (tar.size()-pos==1024) && (tar.find_first_not_of('\0',pos)==std::string::npos);
+		for(sum=0,i=0;i<512;i++)
+			sum+=(i>=148 && i<156) ? ' ' : (unsigned char)h[i];
+		if(strtoul(h+148,NULL,8)!=sum) return false;
+		len=strtoul(h+124,NULL,8);
+		if(pos+512+len>tar.size()) return false;
+		out->push_back(std::make_pair(std::string(h,strnlen(h,100)),tar.substr(pos+512,len)));
+		pos+=512+(len+511)/512*512;
+	};
+	return false;
+}
+
+static std::string slurp(const std::string& path)
+{
+	std::ifstream in(path.c_str(),std::ios::binary);
+	std::ostringstream s;
+	s << in.rdbuf();
+	return s.str();
+}
+
+/* What putFile() of each file gives through an FdTar, or ReadWriteTar */
+template<class T> static std::string fdtar(const tar_files& files,const std::string& path,int threads)
+{
+	int fd=open(path.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+	{
+		T tar(fd);
+		if(threads<0) {
+			for(size_t i=0;i<files.size();i++)
+				tar.putFile(files[i].first.c_str(),files[i].second.c_str());
+		} else
+			tar.putFiles(files,threads,1<<20);
+		tar.finish();
+		check(tar.good(),"not good() after writing to a file",path.c_str());
+	}
+	close(fd);
+	return slurp(path);
+}
+
+/* The same written to a pipe from a child process */
+static std::string fdtar_pipe(const tar_files& files)
+{
+	std::string tar;
+	char buf[1<<16];
+	ssize_t n;
+	int p[2],status;
+	pid_t pid;
+
+	if(pipe(p)!=0) return tar;
+	if((pid=fork())==0) {
+		close(p[0]);
+		bool good;
+		{
+			lindenb::io::FdTar out(p[1]);
+			for(size_t i=0;i<files.size();i++)
+				out.putFile(files[i].first.c_str(),files[i].second.c_str());
+			out.finish();
+			good=out.good();
+		}
+		_exit(good ? 0 : 1);
+	};
+	close(p[1]);
+	while((n=read(p[0],buf,sizeof(buf)))>0)
+		tar.append(buf,n);
+	close(p[0]);
+	check((pid>0) && (waitpid(pid,&status,0)==pid) && WIFEXITED(status) &&
+		(WEXITSTATUS(status)==0),"the writer failed","pipe");
+	return tar;
+}
+
+int main()
+{
+	char dirbuf[]="/tmp/kiwi_tar_test.XXXXXX";
+	std::vector<unsigned char> data;
+	tar_entries want,got;
+	std::string dir,tar;
+	tar_files files;
+	size_t i,len;
+	int fd;
+
+	if(mkdtemp(dirbuf)==NULL) {
+		perror("mkdtemp");
+		return 1;
+	};
+	dir=dirbuf;
+
+	/* empty, a record exactly, a large file and small ones around it */
+	const size_t sizes[]={ 0,512,1,3<<20,511,513,70000,1<<16 };
+	corpus_asset(1,(3<<20)+64,&data);
+	for(i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++) {
+		char name[32];
+		len=sizes[i];
+		sprintf(name,"/%02lu",(unsigned long)i);
+		FILE *f=fopen((dir+name).c_str(),"wb");
+		if((f==NULL) || (fwrite(&data[i],1,len,f)!=len) || fclose(f)) {
+			perror((dir+name).c_str());
+			return 1;
+		};
+		files.push_back(std::make_pair(dir+name,std::string("patch")+name));
+	};
+
+	{
+		std::ofstream o((dir+"/want.tar").c_str(),std::ios::binary);
+		lindenb::io::Tar out(o);
+		for(i=0;i<files.size();i++)
+			out.putFile(files[i].first.c_str(),files[i].second.c_str());
+		out.finish();
+	}
+	tar=slurp(dir+"/want.tar");
+	check(entries(tar,&want) && (want.size()==files.size()),"malformed","Tar");
+
+	tar=fdtar<lindenb::io::FdTar>(files,dir+"/got.tar",-1);
+	check(entries(tar,&got) && (got==want),"entries differ from Tar's","FdTar");
+	tar=fdtar<ReadWriteTar>(files,dir+"/got.tar",-1);
+	check(entries(tar,&got) && (got==want),"entries differ from Tar's","FdTar read/write");
+	tar=fdtar<lindenb::io::FdTar>(files,dir+"/got.tar",1);
+	check(entries(tar,&got) && (got==want),"entries differ from Tar's","FdTar putFiles");
+	tar=fdtar_pipe(files);
+	check(entries(tar,&got) && (got==want),"entries differ from Tar's","FdTar to a pipe");
+
+	fd=open((dir+"/got.tar").c_str(),O_WRONLY|O_TRUNC);
+	{
+		lindenb::io::FdTar out(fd);
+		bool thrown=false;
+		try {
+			out.putFile((dir+"/missing").c_str(),"missing");
+		} catch(std::runtime_error&) {
+			thrown=true;
+		};
+		check(thrown,"no exception","missing file");
+	}
+	close(fd);
+
+	fd=open("/dev/full",O_WRONLY);
+	if(fd>=0) {
+		{
+			lindenb::io::FdTar out(fd);
+			out.putFile(files[3].first.c_str(),files[3].second.c_str());
+			out.finish();
+			check(!out.good(),"good() on a full device","/dev/full");
+		}
+		close(fd);
+	};
+
+	for(i=0;i<files.size();i++)
+		remove(files[i].first.c_str());
+	remove((dir+"/want.tar").c_str());
+	remove((dir+"/got.tar").c_str());
+	rmdir(dir.c_str());
+	return (failures==0) ? 0 : 1;
+}